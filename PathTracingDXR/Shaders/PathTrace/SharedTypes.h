@@ -54,6 +54,13 @@ struct Light {
     float3 intensity;
 };
 
+// one texel of a lat-long environment map in the alias table that importance samples it
+struct EnvAliasEntry {
+    float threshold;
+    uint  alias;
+    float density;
+};
+
 struct CameraConstants {
     float4 position;
     float4 u;
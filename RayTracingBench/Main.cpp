@@ -0,0 +1,50 @@
+
+#include "pch.h"
+#include "RenderBenchmark.h"
+
+int main(int argc, char *argv[]) {
+    RenderBenchmark::Options options;
+    options.maxThreads = 0;
+    options.quick = false;
+    options.modelFile = "..\\..\\Models\\CornellBox\\CornellBox-Sphere.obj";
+    options.referenceSamples = 4096;
+    options.packets = false;
+    options.wavefront = false;
+    bool convergence = false; // error against spp per sampler instead of throughput
+    std::string file("benchmark.json");
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            options.maxThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-quick") == 0) {
+            options.quick = true;
+        } else if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc) {
+            options.sceneFilter = argv[++i];
+        } else if (strcmp(argv[i], "-model") == 0 && i + 1 < argc) {
+            options.modelFile = argv[++i];
+        } else if (strcmp(argv[i], "-packets") == 0) {
+            options.packets = true;
+        } else if (strcmp(argv[i], "-wavefront") == 0) {
+            options.wavefront = true;
+        } else if (strcmp(argv[i], "-convergence") == 0) {
+            convergence = true;
+        } else if (strcmp(argv[i], "-reference-spp") == 0 && i + 1 < argc) {
+            options.referenceSamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            file = argv[++i];
+        }
+    }
+
+    std::ofstream ofs(file);
+    if (!ofs.is_open()) {
+        std::cerr << "Can not open " << file << std::endl;
+        return 1;
+    }
+    RenderBenchmark benchmark(options);
+    if (convergence) {
+        benchmark.RunConvergence(ofs, std::cout);
+    } else {
+        benchmark.Run(ofs, std::cout);
+    }
+    std::cout << "Results written to " << file << std::endl;
+    return 0;
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "Integrators.h"
+#include "SceneSetup.h"
+#include "TileRenderer.h"
+#include "DXRRenderer.h"
+#include "Denoiser.h"
+
+#include <psapi.h>
+
+// Renders a fixed matrix of scenes, resolutions and sample counts with 1, 2, 4 ... N
+// worker threads and reports throughput as JSON. Scenes and sample streams are
+// deterministic, so two runs on the same machine measure exactly the same work. The
+// peak working set is of the whole process, a run reports how far it grew past the
+// peak before its scene was set up; a scene that stays below the peak of an earlier
+// one reports 0, -scene runs it on its own. RunConvergence instead measures image
+// error against spp for every sampler, before and after the Denoiser.
+class RenderBenchmark {
+public:
+    struct Options {
+        int             maxThreads;     // 0: one per hardware thread
+        bool            quick;          // smallest resolution and spp only
+        std::string     sceneFilter;    // run only the scene with this name
+        std::string     modelFile;      // the CornellBox, relative to the working directory
+        int             referenceSamples;   // spp of the convergence reference
+        bool            packets;        // camera rays traced as 4x4 packets
+        bool            wavefront;      // paths traced stage by stage in batches
+    };
+
+    RenderBenchmark(const Options &options)
+    : mOptions(options)
+    {
+        if (mOptions.maxThreads <= 0) {
+            mOptions.maxThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        }
+    }
+    ~RenderBenchmark(void) {
+
+    }
+
+    // progress goes to log, the JSON document to json
+    void Run(std::ostream &json, std::ostream &log);
+    // RMSE against a high spp reference at 1, 2, 4 ... 256 spp, per sampler, raw and denoised
+    void RunConvergence(std::ostream &json, std::ostream &log);
+
+    static size_t PeakResidentBytes(void);
+
+    template <typename TimePoint>
+    INLINE static double ElapsedMs(const TimePoint &start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+private:
+    struct Resolution {
+        int width;
+        int height;
+    };
+
+    // baseline is the peak resident bytes before the scene was set up
+    void RunScene(const std::string &name, SceneSetup &setup, double buildMs, size_t baseline, std::ostream &json, std::ostream &log, bool &firstCase);
+    // the CPU port of the DXR path tracer, one frame per spp
+    void RunDXRScene(const std::string &name, const DXRScene &scene, double buildMs, size_t baseline, std::ostream &json, std::ostream &log, bool &firstCase);
+    void BeginCase(const std::string &name, int primitives, double buildMs, const Resolution &res, int samples, std::ostream &json, bool &firstCase) const;
+    void WriteRun(const std::string &name, const Resolution &res, int samples, int threads, double seconds, int64_t totalSamples, const RayStats &rays, double singleSeconds,
+                  size_t baseline, bool first, std::ostream &json, std::ostream &log) const;
+    void RenderFrame(const Scene &scene, Camera &camera, const SamplerSettings &sampler, int samples, FrameBuffer &frame, FeatureBuffer *features = nullptr) const;
+    static double RootMeanSquareError(const FrameBuffer &frame, const FrameBuffer &reference);
+    std::vector<int> ThreadCounts(void) const;
+
+    static constexpr int TileSize = 32;
+
+    Options mOptions;
+};
+
+INLINE size_t RenderBenchmark::PeakResidentBytes(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+}
+
+INLINE std::vector<int> RenderBenchmark::ThreadCounts(void) const {
+    std::vector<int> counts;
+    for (int threads = 1; threads < mOptions.maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(mOptions.maxThreads);
+    return counts;
+}
+
+INLINE void RenderBenchmark::Run(std::ostream &json, std::ostream &log) {
+    json << "{\n";
+    json << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    json << "  \"simd_width\": " << SIMD_WIDTH << ",\n";
+    json << "  \"max_depth\": " << maxDepth << ",\n";
+    json << "  \"packets\": " << (mOptions.packets ? "true" : "false") << ",\n";
+    json << "  \"wavefront\": " << (mOptions.wavefront ? "true" : "false") << ",\n";
+    json << "  \"cases\": [";
+
+    bool firstCase = true;
+    auto Wanted = [this](const char *name) { return mOptions.sceneFilter.empty() || mOptions.sceneFilter == name; };
+
+    if (Wanted("random_spheres")) {
+        size_t baseline = PeakResidentBytes();
+        SceneSetup setup;
+        auto start = std::chrono::high_resolution_clock::now();
+        setup.RandomSpheres();
+        RunScene("random_spheres", setup, ElapsedMs(start), baseline, json, log, firstCase);
+    }
+    if (Wanted("lit_spheres")) {
+        size_t baseline = PeakResidentBytes();
+        SceneSetup setup;
+        auto start = std::chrono::high_resolution_clock::now();
+        setup.LitSpheres();
+        RunScene("lit_spheres", setup, ElapsedMs(start), baseline, json, log, firstCase);
+    }
+    if (Wanted("sphere_field_1m")) {
+        size_t baseline = PeakResidentBytes();
+        SceneSetup setup;
+        auto start = std::chrono::high_resolution_clock::now();
+        setup.SphereField(1000);
+        RunScene("sphere_field_1m", setup, ElapsedMs(start), baseline, json, log, firstCase);
+    }
+    if (Wanted("instanced_props")) {
+        size_t baseline = PeakResidentBytes();
+        SceneSetup setup;
+        auto start = std::chrono::high_resolution_clock::now();
+        setup.InstancedProps(10000);
+        RunScene("instanced_props", setup, ElapsedMs(start), baseline, json, log, firstCase);
+    }
+    if (Wanted("cornell_box")) {
+        size_t baseline = PeakResidentBytes();
+        SceneSetup setup;
+        auto start = std::chrono::high_resolution_clock::now();
+        // every resolution of the matrix has the same aspect ratio
+        if (setup.LoadModel(mOptions.modelFile, 1.6f)) {
+            RunScene("cornell_box", setup, ElapsedMs(start), baseline, json, log, firstCase);
+        } else {
+            log << "Can not load " << mOptions.modelFile << ", cornell_box skipped\n";
+        }
+    }
+    if (Wanted("dxr_cornell_box")) {
+        size_t baseline = PeakResidentBytes();
+        auto start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<Utils::Scene> model(Utils::Model::LoadFromFile(mOptions.modelFile.c_str()));
+        if (model) {
+            std::unique_ptr<DXRScene> scene(DXRScene::Create(*model));
+            RunDXRScene("dxr_cornell_box", *scene, ElapsedMs(start), baseline, json, log, firstCase);
+        } else {
+            log << "Can not load " << mOptions.modelFile << ", dxr_cornell_box skipped\n";
+        }
+    }
+
+    json << "\n  ],\n";
+    json << "  \"peak_rss_bytes\": " << PeakResidentBytes() << "\n";
+    json << "}\n";
+}
+
+INLINE void RenderBenchmark::BeginCase(const std::string &name, int primitives, double buildMs, const Resolution &res, int samples, std::ostream &json, bool &firstCase) const {
+    json << (firstCase ? "\n" : ",\n");
+    firstCase = false;
+    json << "    {\n";
+    json << "      \"scene\": \"" << name << "\",\n";
+    json << "      \"primitives\": " << primitives << ",\n";
+    json << "      \"build_ms\": " << buildMs << ",\n";
+    json << "      \"width\": " << res.width << ",\n";
+    json << "      \"height\": " << res.height << ",\n";
+    json << "      \"spp\": " << samples << ",\n";
+    json << "      \"runs\": [";
+}
+
+INLINE void RenderBenchmark::WriteRun(const std::string &name, const Resolution &res, int samples, int threads, double seconds, int64_t totalSamples, const RayStats &rays, double singleSeconds,
+                                      size_t baseline, bool first, std::ostream &json, std::ostream &log) const {
+    double speedup = singleSeconds / seconds;
+    json << (first ? "\n" : ",\n");
+    json << "        { \"threads\": " << threads
+         << ", \"seconds\": " << seconds
+         << ", \"samples\": " << totalSamples
+         << ", \"ns_per_sample\": " << seconds * 1e9 / totalSamples
+         << ", \"primary_rays\": " << rays.primary
+         << ", \"secondary_rays\": " << rays.secondary
+         << ", \"shadow_rays\": " << rays.shadow
+         << ", \"primary_rays_per_sec\": " << rays.primary / seconds
+         << ", \"secondary_rays_per_sec\": " << rays.secondary / seconds
+         << ", \"rays_per_sec\": " << (rays.primary + rays.secondary + rays.shadow) / seconds
+         << ", \"speedup\": " << speedup
+         << ", \"efficiency\": " << speedup / threads
+         << ", \"peak_rss_delta_bytes\": " << PeakResidentBytes() - baseline << " }";
+
+    log << name << " " << res.width << "x" << res.height << " @ " << samples << " spp, " << threads << " threads: "
+        << seconds << " s, " << (rays.primary + rays.secondary + rays.shadow) / seconds / 1e6 << " Mrays/s\n";
+}
+
+INLINE void RenderBenchmark::RunScene(const std::string &name, SceneSetup &setup, double buildMs, size_t baseline, std::ostream &json, std::ostream &log, bool &firstCase) {
+    static const Resolution resolutions[] = { { 320, 200 }, { 640, 400 } };
+    static const int sampleCounts[] = { 4, 16 };
+    int resolutionCount = mOptions.quick ? 1 : _countof(resolutions);
+    int sampleCountCount = mOptions.quick ? 1 : _countof(sampleCounts);
+
+    Scene scene = setup.View();
+    for (int r = 0; r < resolutionCount; ++r) {
+        const Resolution &res = resolutions[r];
+        Camera camera = setup.MakeCamera(float(res.width) / float(res.height));
+        for (int c = 0; c < sampleCountCount; ++c) {
+            int samples = sampleCounts[c];
+            BeginCase(name, setup.PrimitiveCount(), buildMs, res, samples, json, firstCase);
+
+            double singleSeconds = 0.0;
+            std::vector<int> threadCounts = ThreadCounts();
+            for (size_t t = 0; t < threadCounts.size(); ++t) {
+                int threads = threadCounts[t];
+                TileRenderer renderer(res.width, res.height, samples, TileSize, threads);
+                if (mOptions.packets) {
+                    renderer.SetPacketShade(TracePathFromHit);
+                }
+                renderer.SetWavefront(mOptions.wavefront);
+                renderer.Render(scene, camera, TracePath);
+
+                double seconds = renderer.RenderSeconds();
+                // the first run is always single threaded
+                if (t == 0) {
+                    singleSeconds = seconds;
+                }
+                WriteRun(name, res, samples, threads, seconds, renderer.TotalSamples(), renderer.Rays(), singleSeconds, baseline, t == 0, json, log);
+            }
+            json << "\n      ]\n";
+            json << "    }";
+        }
+    }
+}
+
+INLINE void RenderBenchmark::RunDXRScene(const std::string &name, const DXRScene &scene, double buildMs, size_t baseline, std::ostream &json, std::ostream &log, bool &firstCase) {
+    static const Resolution resolutions[] = { { 320, 200 }, { 640, 400 } };
+    static const int sampleCounts[] = { 4, 16 };
+    int resolutionCount = mOptions.quick ? 1 : _countof(resolutions);
+    int sampleCountCount = mOptions.quick ? 1 : _countof(sampleCounts);
+
+    for (int r = 0; r < resolutionCount; ++r) {
+        const Resolution &res = resolutions[r];
+        for (int c = 0; c < sampleCountCount; ++c) {
+            int samples = sampleCounts[c];
+            BeginCase(name, static_cast<int>(scene.TriangleCount()), buildMs, res, samples, json, firstCase);
+
+            double singleSeconds = 0.0;
+            std::vector<int> threadCounts = ThreadCounts();
+            for (size_t t = 0; t < threadCounts.size(); ++t) {
+                int threads = threadCounts[t];
+                DXRRenderer renderer(scene, res.width, res.height, TileSize, threads);
+                renderer.FrameScene();
+                renderer.Accumulate(samples);
+
+                double seconds = renderer.RenderSeconds();
+                if (t == 0) {
+                    singleSeconds = seconds;
+                }
+                WriteRun(name, res, samples, threads, seconds, int64_t(res.width) * res.height * samples, renderer.Rays(), singleSeconds, baseline, t == 0, json, log);
+            }
+            json << "\n      ]\n";
+            json << "    }";
+        }
+    }
+}
+
+INLINE void RenderBenchmark::RenderFrame(const Scene &scene, Camera &camera, const SamplerSettings &sampler, int samples, FrameBuffer &frame, FeatureBuffer *features) const {
+    TileRenderer renderer(frame.Width(), frame.Height(), samples, TileSize, mOptions.maxThreads);
+    renderer.SetSampler(sampler);
+    renderer.SetFeatures(features);
+    frame.Clear();
+    renderer.Render(scene, camera, TracePath, &frame);
+}
+
+INLINE double RenderBenchmark::RootMeanSquareError(const FrameBuffer &frame, const FrameBuffer &reference) {
+    double sum = 0.0;
+    for (int y = 0; y < frame.Height(); ++y) {
+        for (int x = 0; x < frame.Width(); ++x) {
+            XMFLOAT4 a = frame.Resolve(x, y);
+            XMFLOAT4 b = reference.Resolve(x, y);
+            sum += double(a.x - b.x) * (a.x - b.x) + double(a.y - b.y) * (a.y - b.y) + double(a.z - b.z) * (a.z - b.z);
+        }
+    }
+    return std::sqrt(sum / (3.0 * frame.Width() * frame.Height()));
+}
+
+INLINE void RenderBenchmark::RunConvergence(std::ostream &json, std::ostream &log) {
+    static const int width = 160;
+    static const int height = 100;
+    int maxSamples = mOptions.quick ? 16 : 256;
+
+    SceneSetup setup;
+    setup.RandomSpheres();
+    Scene scene = setup.View();
+    Camera camera = setup.MakeCamera(float(width) / float(height));
+
+    // independent samples with a seed none of the measured runs use
+    FrameBuffer reference(width, height);
+    auto start = std::chrono::high_resolution_clock::now();
+    RenderFrame(scene, camera, SamplerSettings::Create(IndependentSampler, mOptions.referenceSamples, 0x5eed), mOptions.referenceSamples, reference);
+    log << "reference " << width << "x" << height << " @ " << mOptions.referenceSamples << " spp: " << ElapsedMs(start) / 1000.0 << " s\n";
+
+    json << "{\n";
+    json << "  \"scene\": \"random_spheres\",\n";
+    json << "  \"width\": " << width << ",\n";
+    json << "  \"height\": " << height << ",\n";
+    json << "  \"reference_spp\": " << mOptions.referenceSamples << ",\n";
+    json << "  \"samplers\": [";
+
+    FrameBuffer frame(width, height);
+    // the same frames once more through the denoiser
+    FeatureBuffer features(width, height);
+    FrameBuffer denoised(width, height);
+    Denoiser denoiser(width, height, mOptions.maxThreads);
+    std::vector<XMFLOAT4> pixels;
+    Tile image = { 0, 0, 0, 0, width, height };
+    for (uint32_t t = 0; t < SamplerTypeCount; ++t) {
+        SamplerType type = SamplerType(t);
+        json << (t == 0 ? "\n" : ",\n");
+        json << "    {\n";
+        json << "      \"sampler\": \"" << SamplerSettings::Name(type) << "\",\n";
+        json << "      \"curve\": [";
+
+        // least squares slope of log error over log spp, -0.5 is plain Monte Carlo
+        double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+        int points = 0;
+        for (int samples = 1; samples <= maxSamples; samples *= 2, ++points) {
+            start = std::chrono::high_resolution_clock::now();
+            RenderFrame(scene, camera, SamplerSettings::Create(type, samples), samples, frame, &features);
+            double seconds = ElapsedMs(start) / 1000.0;
+            double rmse = RootMeanSquareError(frame, reference);
+
+            start = std::chrono::high_resolution_clock::now();
+            denoiser.Run(frame, features, pixels);
+            double denoiseMs = ElapsedMs(start);
+            denoised.Clear();
+            denoised.AddTile(image, pixels.data());
+            double rmseDenoised = RootMeanSquareError(denoised, reference);
+
+            double lx = std::log(double(samples)), ly = std::log(rmse);
+            sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly;
+
+            json << (points == 0 ? "\n" : ",\n");
+            json << "        { \"spp\": " << samples << ", \"rmse\": " << rmse << ", \"seconds\": " << seconds
+                 << ", \"rmse_denoised\": " << rmseDenoised << ", \"denoise_ms\": " << denoiseMs << " }";
+            log << SamplerSettings::Name(type) << " @ " << samples << " spp: rmse " << rmse << ", denoised " << rmseDenoised << " (" << denoiseMs << " ms)\n";
+        }
+        double slope = (points * sxy - sx * sy) / (points * sxx - sx * sx);
+        json << "\n      ],\n";
+        json << "      \"slope\": " << slope << "\n";
+        json << "    }";
+    }
+    json << "\n  ]\n";
+    json << "}\n";
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Ray.h"
+
+class AABB {
+public:
+    AABB(void) {
+        Reset();
+    }
+    AABB(const XMVECTOR &min, const XMVECTOR &max)
+    {
+        mMin = min;
+        mMax = max;
+    }
+    ~AABB(void) {
+
+    }
+
+    INLINE XMVECTOR Min(void) const { return mMin; }
+    INLINE XMVECTOR Max(void) const { return mMax; }
+    INLINE XMVECTOR Centroid(void) const { return (mMin + mMax) * 0.5f; }
+    INLINE bool IsEmpty(void) const { return !XMVector3LessOrEqual(mMin, mMax); }
+
+    INLINE void Reset(void) {
+        mMin = {  FLT_MAX,  FLT_MAX,  FLT_MAX, 0.0f };
+        mMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX, 0.0f };
+    }
+
+    INLINE void Merge(const AABB &other) {
+        mMin = XMVectorMin(mMin, other.mMin);
+        mMax = XMVectorMax(mMax, other.mMax);
+    }
+
+    INLINE void Merge(const XMVECTOR &point) {
+        mMin = XMVectorMin(mMin, point);
+        mMax = XMVectorMax(mMax, point);
+    }
+
+    INLINE float SurfaceArea(void) const {
+        if (IsEmpty()) {
+            return 0.0f;
+        }
+        XMVECTOR d = mMax - mMin;
+        float x = XMVectorGetX(d), y = XMVectorGetY(d), z = XMVectorGetZ(d);
+        return 2.0f * (x * y + y * z + z * x);
+    }
+
+    // slab test, invDir is the per component reciprocal of the ray direction
+    INLINE bool Hit(const XMVECTOR &origin, const XMVECTOR &invDir, float tMin, float tMax, float &tNear) const {
+        return Hit(mMin, mMax, origin, invDir, tMin, tMax, tNear);
+    }
+
+    INLINE static bool Hit(const XMVECTOR &min, const XMVECTOR &max, const XMVECTOR &origin, const XMVECTOR &invDir, float tMin, float tMax, float &tNear) {
+        XMVECTOR t0 = (min - origin) * invDir;
+        XMVECTOR t1 = (max - origin) * invDir;
+        XMVECTOR tSmall = XMVectorMin(t0, t1);
+        // widened by 1 + 2 gamma(3) (PBRT 3.9.2) so rounding can not reject a ray that
+        // grazes a corner of the box, such as one aimed exactly at a mesh vertex
+        XMVECTOR tBig = XMVectorMax(t0, t1) * 1.0000004f;
+        tMin = std::max(tMin, std::max(XMVectorGetX(tSmall), std::max(XMVectorGetY(tSmall), XMVectorGetZ(tSmall))));
+        tMax = std::min(tMax, std::min(XMVectorGetX(tBig), std::min(XMVectorGetY(tBig), XMVectorGetZ(tBig))));
+        tNear = tMin;
+        return tMin <= tMax;
+    }
+
+private:
+    XMVECTOR mMin;
+    XMVECTOR mMax;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+// Running mean and variance of a pixel estimate, Welford's update. The colour is
+// averaged per channel, the variance is tracked on luminance only, which is what the
+// stopping rule looks at.
+class PixelEstimate {
+public:
+    PixelEstimate(void)
+    : mCount(0)
+    , mLumMean(0.0f)
+    , mLumM2(0.0f)
+    {
+        mSum = XMVectorZero();
+    }
+
+    INLINE int Count(void) const { return mCount; }
+    INLINE XMVECTOR Mean(void) const { return mCount > 0 ? mSum / float(mCount) : XMVectorZero(); }
+
+    INLINE void Add(XMVECTOR sample) {
+        float lum = XMVectorGetX(XMVector3Dot(sample, XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f)));
+        ++mCount;
+        float delta = lum - mLumMean;
+        mLumMean += delta / float(mCount);
+        mLumM2 += delta * (lum - mLumMean);
+        mSum += sample;
+    }
+
+    // standard error of the mean luminance relative to the mean itself; the floor keeps
+    // near black pixels from asking for samples nobody can see
+    INLINE float RelativeError(void) const {
+        if (mCount < 2) {
+            return FLT_MAX;
+        }
+        float variance = mLumM2 / float(mCount - 1);
+        return std::sqrt(variance / float(mCount)) / std::max(mLumMean, ErrorFloor);
+    }
+    // variance of the mean luminance, FLT_MAX below two samples
+    INLINE float Variance(void) const {
+        return mCount < 2 ? FLT_MAX : mLumM2 / float(mCount - 1) / float(mCount);
+    }
+
+    static constexpr float ErrorFloor = 0.05f;
+
+private:
+    XMVECTOR    mSum;
+    int         mCount;
+    float       mLumMean;
+    float       mLumM2;
+};
+
+// Stopping rule for adaptive sampling. Every pixel gets minSamples first. After that a
+// tile keeps handing out batches to the pixels whose relative error is still above
+// targetError, until none is left, a pixel reaches maxSamples or the tile has spent its
+// budget (the fixed spp times its pixel count). Converged regions such as the sky stop
+// early and leave their share to the glass and the soft shadows of the same tile.
+// Tiles never share state, so the result does not depend on the thread count.
+struct AdaptiveSettings {
+    bool    enabled;
+    float   targetError;
+    int     minSamples;
+    int     maxSamples;
+    int     batchSamples;
+
+    INLINE static AdaptiveSettings Fixed(void) {
+        return { false, 0.0f, 0, 0, 0 };
+    }
+
+    INLINE static AdaptiveSettings Create(int samples, float targetError) {
+        AdaptiveSettings settings;
+        settings.enabled = true;
+        settings.targetError = targetError;
+        // at most half the budget, the batches always have the rest to spend
+        settings.minSamples = std::max(std::min(16, samples / 2), 2);
+        settings.maxSamples = samples * 8;
+        settings.batchSamples = std::max(samples / 8, 4);
+        return settings;
+    }
+};
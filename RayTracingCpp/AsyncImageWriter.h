@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ImageWriter.h"
+
+// Moves file output off the render threads. Workers hand over a copy of each finished
+// tile and carry on tracing while a single writer thread pushes it to the ImageWriter.
+// The queue is bounded, a worker blocks only when the disk falls that far behind, so
+// memory stays at a few tiles no matter how large the frame is.
+class AsyncImageWriter {
+public:
+    AsyncImageWriter(ImageWriter *writer, int maxPending)
+    : mWriter(writer)
+    , mMaxPending(std::max(maxPending, 1))
+    , mFinished(false)
+    , mTilesWritten(0)
+    {
+        mThread = std::thread(&AsyncImageWriter::WriterMain, this);
+    }
+    ~AsyncImageWriter(void) {
+        Finish();
+    }
+
+    INLINE int TilesWritten(void) const { return mTilesWritten; }
+
+    void Submit(const Tile &tile, const XMFLOAT4 *pixels);
+    // drains the queue and joins the writer thread
+    void Finish(void);
+
+private:
+    struct Pending {
+        Tile                    tile;
+        std::vector<XMFLOAT4>   pixels;
+    };
+
+    void WriterMain(void);
+
+    ImageWriter *               mWriter;
+    int                         mMaxPending;
+    bool                        mFinished;
+    int                         mTilesWritten;
+    std::deque<Pending>         mQueue;
+    std::mutex                  mLock;
+    std::condition_variable     mNotEmpty;
+    std::condition_variable     mNotFull;
+    std::thread                 mThread;
+};
+
+INLINE void AsyncImageWriter::Submit(const Tile &tile, const XMFLOAT4 *pixels) {
+    Pending pending;
+    pending.tile = tile;
+    pending.pixels.assign(pixels, pixels + size_t(tile.width) * tile.height);
+
+    std::unique_lock<std::mutex> lock(mLock);
+    mNotFull.wait(lock, [this](void) { return static_cast<int>(mQueue.size()) < mMaxPending; });
+    mQueue.push_back(std::move(pending));
+    lock.unlock();
+    mNotEmpty.notify_one();
+}
+
+INLINE void AsyncImageWriter::Finish(void) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mFinished = true;
+    }
+    mNotEmpty.notify_one();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+INLINE void AsyncImageWriter::WriterMain(void) {
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mNotEmpty.wait(lock, [this](void) { return !mQueue.empty() || mFinished; });
+        if (mQueue.empty()) {
+            return;
+        }
+        Pending pending = std::move(mQueue.front());
+        mQueue.pop_front();
+        lock.unlock();
+        mNotFull.notify_one();
+
+        mWriter->WriteTile(pending.tile, pending.pixels.data());
+        ++mTilesWritten;
+    }
+}
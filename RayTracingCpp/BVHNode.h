@@ -0,0 +1,1351 @@
+#pragma once
+
+#include "Hitable.h"
+#include "AABB.h"
+
+// How a BVHNode is built, from the best trees to the fastest builds.
+enum BVHBuildType : uint32_t {
+    SAHBuild,           // binned SAH on the calling thread
+    ParallelSAHBuild,   // the same splits, subtrees and the scans of large nodes on a thread pool
+    TreeletBuild,       // Morton BVH with its treelets reordered for the SAH
+    MortonBuild,        // linear BVH over sorted Morton codes, for rebuilds every frame
+    BVHBuildTypeCount
+};
+
+struct BVHBuildSettings {
+    BVHBuildType    type;
+    int             threadCount;    // 0: one per hardware thread, unused by SAHBuild
+
+    INLINE static BVHBuildSettings Create(BVHBuildType type = SAHBuild, int threadCount = 0) {
+        BVHBuildSettings settings;
+        settings.type = type;
+        settings.threadCount = threadCount;
+        return settings;
+    }
+
+    INLINE static const char * Name(BVHBuildType type) {
+        static const char *names[] = { "sah", "parallel", "treelet", "morton" };
+        return names[type];
+    }
+
+    INLINE static bool Parse(const char *name, BVHBuildType &type) {
+        for (uint32_t t = 0; t < BVHBuildTypeCount; ++t) {
+            if (strcmp(name, Name(BVHBuildType(t))) == 0) {
+                type = BVHBuildType(t);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Bounding volume hierarchy over a list of Hitables, built top down with a binned
+// surface area heuristic. Nodes live in one flat array in depth first order: the
+// first child of an interior node is the node right after it, the second child is
+// referenced by index, so traversal never chases Hitable pointers.
+// HitPacket walks the tree once for a whole RayPacket: each node is fetched once, a
+// child is entered from the first ray that hits it ("first active ray", Wald et al.
+// 2007) and a box that no ray can hit is skipped by the packet's interval test.
+// Refit keeps the tree in step with primitives that move: the boxes are recomputed
+// bottom up and only the subtrees that got much worse are built again.
+// The parallel builds split the top of the tree on the calling thread until there are
+// enough ranges to go round the threads, build those into trees of their own and copy
+// them in, so every build ends up in the same layout. The Morton builds split sorted
+// codes at their highest differing bit (Lauterbach et al. 2009); TreeletBuild then
+// finds the best topology of every treelet of up to TreeletSize leaves bottom up, by
+// dynamic programming over its subsets (Karras and Aila 2013).
+class BVHNode : public Hitable {
+public:
+    struct Node {
+        XMFLOAT3 min;
+        uint32_t offset;    // leaf: first primitive, interior: index of the second child
+        XMFLOAT3 max;
+        uint32_t count;     // primitive count, 0 for interior nodes
+    };
+
+    struct RefitStats {
+        double  ms;         // refit and partial rebuilds
+        int     subtrees;   // refit in parallel below the top levels
+        int     rebuilt;    // subtrees built again
+        float   cost;       // SAH cost of the tree relative to the one it was built with
+    };
+
+    BVHNode(Hitable **list, int listSize, int maxLeafSize = 4, const BVHBuildSettings &settings = BVHBuildSettings::Create());
+    ~BVHNode(void) {
+
+    }
+
+    INLINE const std::vector<Node> & Nodes(void) const { return mNodes; }
+    INLINE int Depth(void) const { return mDepth; }
+    // primitives in leaf order, a leaf covers count of them from offset
+    INLINE const std::vector<Hitable *> & Prims(void) const { return mPrims; }
+    // SAH cost of the tree, normalised by the area of the root
+    float Cost(void) const;
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual void HitPacket(RayPacket &packet);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+    // Updates the tree after its primitives moved. The top levels are split into
+    // SubtreeCount subtrees that are refit on threadCount threads (0: one per hardware
+    // thread), then the nodes above them. A subtree whose SAH cost grew to more than
+    // rebuildRatio times its cost when it was built is built again from its primitives.
+    RefitStats Refit(float rebuildRatio = 1.5f, int threadCount = 0);
+
+private:
+    static constexpr int    BinCount = 16;
+    static constexpr int    MaxDepth = 64;
+    static constexpr float  TraversalCost = 1.0f;
+    static constexpr float  IntersectCost = 1.0f;
+    static constexpr int    SubtreeCount = 256;
+    static constexpr int    MortonBits = 10;        // per axis
+    static constexpr int    RadixBits = 10;
+    static constexpr int    TreeletSize = 7;
+    static constexpr int    TreeletMinPrims = 64;   // smaller subtrees are left as built
+    // ranges below this are split on one thread
+    static constexpr uint32_t ParallelScanSize = 1 << 16;
+    static constexpr uint32_t MinTaskSize = 1 << 10;
+
+    struct BuildPrim {
+        AABB        box;
+        XMVECTOR    centroid;
+        Hitable    *hitable;
+        uint32_t    code;       // Morton code of the centroid, Morton builds only
+    };
+
+    struct Bin {
+        AABB    box;
+        int     count;
+    };
+
+    // a unit of refit work, its nodes are [root, end) in the flat array
+    struct Subtree {
+        uint32_t    root;
+        uint32_t    end;
+        int         depth;      // of the root
+        float       buildCost;  // summed SAH cost of its nodes when it was built
+    };
+
+    // a node of the top of a parallel build, either split further or one task
+    struct TopNode {
+        int     first;
+        int     second;
+        int     task;       // index into the tasks, -1 for a split
+    };
+
+    struct Task {
+        uint32_t    begin;
+        uint32_t    end;
+        int         depth;
+    };
+
+    // the topology of a node while the treelets are reordered
+    struct Link {
+        uint32_t    left;
+        uint32_t    right;
+        uint32_t    prims;      // below the node
+        float       cost;       // summed SAH cost of the subtree
+        int         depth;
+        int         height;     // of the subtree, 0 for a leaf
+    };
+
+    // builds below a node at rootDepth, for subtrees built again
+    BVHNode(Hitable **list, int listSize, int maxLeafSize, int rootDepth);
+    // builds prims [begin, end) below a node at rootDepth, a task of a parallel build
+    BVHNode(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int maxLeafSize, int rootDepth, bool morton);
+
+    static void GatherPrims(Hitable **list, int listSize, std::vector<BuildPrim> &prims);
+    uint32_t Build(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth);
+    uint32_t BuildMorton(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth);
+    uint32_t MakeLeaf(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, const AABB &bounds);
+    // The bounds of [begin, end) and, unless it should be a leaf, the binned SAH split
+    // with the range partitioned around mid. Scans of large ranges are split up into
+    // chunks for threadCount threads, the split found is the same either way.
+    bool Split(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth, int threadCount, AABB &bounds, uint32_t &mid);
+    // the first prim of [begin, end) with the highest bit set that not all codes share
+    static uint32_t MortonSplit(const std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end);
+    // the low bits of v two bits apart, one axis of a Morton code
+    INLINE static uint32_t SpreadBits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+    // sorts the prims by the Morton codes of their centroids, a radix sort over chunks
+    static void SortMorton(std::vector<BuildPrim> &prims, int threadCount);
+    void BuildParallel(std::vector<BuildPrim> &prims, int rootDepth, int maxLeafSize, int threadCount, bool morton);
+    int SplitTop(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth, int threadCount, bool morton,
+                 std::vector<TopNode> &top, std::vector<Task> &tasks);
+    // copies the top node and the trees of its tasks into place, returns its index
+    uint32_t EmitTop(const std::vector<TopNode> &top, int index, std::vector<std::unique_ptr<BVHNode>> &trees, std::vector<uint32_t> &splits);
+    void OptimizeTreelets(int threadCount);
+    void OptimizeTreelet(uint32_t root, std::vector<Link> &links);
+    // writes the linked tree below index out in depth first order, a subtree of up to
+    // mMaxLeafSize prims that costs more than one leaf over them becomes that leaf
+    uint32_t Relink(uint32_t index, int depth, const std::vector<Link> &links, std::vector<Node> &nodes, std::vector<Hitable *> &prims);
+
+    INLINE static bool NodeHit(const Node &node, const XMVECTOR &origin, const XMVECTOR &invDir, float tMin, float tMax, float &tNear) {
+        return AABB::Hit(XMLoadFloat3(&node.min), XMLoadFloat3(&node.max), origin, invDir, tMin, tMax, tNear);
+    }
+
+    // single ray traversal of the subtree below root
+    bool Traverse(uint32_t root, const Ray &ray, float tMin, float tMax, Record &record);
+    void TraverseRay(uint32_t root, RayPacket &packet, int r);
+    // index of the first ray from first on that hits the node, packet.count if none
+    int FirstActive(uint32_t index, const RayPacket &packet, int first, float &tNear) const;
+
+    INLINE static float NodeArea(const Node &node) {
+        float x = node.max.x - node.min.x, y = node.max.y - node.min.y, z = node.max.z - node.min.z;
+        return 2.0f * (x * y + y * z + z * x);
+    }
+    INLINE static float NodeCost(const Node &node) {
+        return NodeArea(node) * (node.count > 0 ? IntersectCost * node.count : TraversalCost);
+    }
+    // the box of a node from its primitives or children
+    void RefitNode(uint32_t index);
+    // splits the tree into mSubtrees below mTopNodes
+    void Partition(void);
+    // SAH cost of nodes [begin, end), area times cost summed, not normalised by the
+    // root area so a subtree that merely moves keeps its cost; refit first if asked
+    float RangeCost(uint32_t begin, uint32_t end, bool refit);
+    void RebuildSubtrees(const std::vector<int> &degraded, std::vector<float> &costs, int threadCount);
+    // func(i) for i in [0, count) on up to threadCount threads
+    template <typename Func>
+    static void ParallelFor(int count, int threadCount, const Func &func);
+
+    std::vector<Node>       mNodes;
+    std::vector<Hitable *>  mPrims;     // primitives in leaf order
+    int                     mMaxLeafSize;
+    int                     mDepth;
+    // set up by the first Refit
+    std::vector<Subtree>    mSubtrees;  // in node order
+    std::vector<uint32_t>   mTopNodes;  // ancestors of the subtrees, children before parents
+    float                   mBuildCost;
+};
+
+INLINE BVHNode::BVHNode(Hitable **list, int listSize, int maxLeafSize, const BVHBuildSettings &settings)
+: mMaxLeafSize(std::max(maxLeafSize, 1))
+, mDepth(0)
+, mBuildCost(0.0f)
+{
+    std::vector<BuildPrim> prims;
+    GatherPrims(list, listSize, prims);
+    if (prims.empty()) {
+        return;
+    }
+
+    int threadCount = settings.threadCount;
+    if (threadCount <= 0) {
+        threadCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    switch (settings.type) {
+    case ParallelSAHBuild:
+        BuildParallel(prims, 1, mMaxLeafSize, threadCount, false);
+        break;
+    case TreeletBuild:
+    case MortonBuild:
+        SortMorton(prims, threadCount);
+        if (settings.type == TreeletBuild) {
+            // treelets start from single prim leaves and gather them up again
+            BuildParallel(prims, 1, 1, threadCount, true);
+            OptimizeTreelets(threadCount);
+        } else {
+            BuildParallel(prims, 1, mMaxLeafSize, threadCount, true);
+        }
+        break;
+    default:
+        mPrims.reserve(prims.size());
+        mNodes.reserve(prims.size() * 2);
+        Build(prims, 0, static_cast<uint32_t>(prims.size()), 1);
+        mNodes.shrink_to_fit();
+        break;
+    }
+}
+
+INLINE BVHNode::BVHNode(Hitable **list, int listSize, int maxLeafSize, int rootDepth)
+: mMaxLeafSize(std::max(maxLeafSize, 1))
+, mDepth(0)
+, mBuildCost(0.0f)
+{
+    std::vector<BuildPrim> prims;
+    GatherPrims(list, listSize, prims);
+
+    mPrims.reserve(prims.size());
+    mNodes.reserve(prims.size() * 2);
+    if (!prims.empty()) {
+        Build(prims, 0, static_cast<uint32_t>(prims.size()), rootDepth);
+    }
+    mNodes.shrink_to_fit();
+}
+
+INLINE BVHNode::BVHNode(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int maxLeafSize, int rootDepth, bool morton)
+: mMaxLeafSize(maxLeafSize)
+, mDepth(0)
+, mBuildCost(0.0f)
+{
+    mPrims.reserve(end - begin);
+    mNodes.reserve((end - begin) * 2);
+    if (morton) {
+        BuildMorton(prims, begin, end, rootDepth);
+    } else {
+        Build(prims, begin, end, rootDepth);
+    }
+}
+
+INLINE void BVHNode::GatherPrims(Hitable **list, int listSize, std::vector<BuildPrim> &prims) {
+    prims.reserve(listSize);
+    for (int i = 0; i < listSize; ++i) {
+        BuildPrim prim;
+        if (!list[i]->BoundingBox(prim.box)) {
+            continue;
+        }
+        prim.centroid = prim.box.Centroid();
+        prim.hitable = list[i];
+        prim.code = 0;
+        prims.push_back(prim);
+    }
+}
+
+INLINE uint32_t BVHNode::MakeLeaf(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, const AABB &bounds) {
+    Node node;
+    XMStoreFloat3(&node.min, bounds.Min());
+    XMStoreFloat3(&node.max, bounds.Max());
+    node.offset = static_cast<uint32_t>(mPrims.size());
+    node.count = end - begin;
+    for (uint32_t i = begin; i < end; ++i) {
+        mPrims.push_back(prims[i].hitable);
+    }
+    mNodes.push_back(node);
+    return static_cast<uint32_t>(mNodes.size() - 1);
+}
+
+INLINE bool BVHNode::Split(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth, int threadCount, AABB &bounds, uint32_t &mid) {
+    uint32_t count = end - begin;
+    int chunks = count >= ParallelScanSize ? threadCount : 1;
+    auto ChunkBegin = [=](int c) {
+        return begin + static_cast<uint32_t>(uint64_t(count) * c / chunks);
+    };
+
+    auto ScanBounds = [&prims](uint32_t first, uint32_t last, AABB &box, AABB &centroids) {
+        for (uint32_t i = first; i < last; ++i) {
+            box.Merge(prims[i].box);
+            centroids.Merge(prims[i].centroid);
+        }
+    };
+    bounds.Reset();
+    AABB centroidBounds;
+    if (chunks == 1) {
+        ScanBounds(begin, end, bounds, centroidBounds);
+    } else {
+        std::vector<AABB> partial(2 * chunks);
+        ParallelFor(chunks, threadCount, [&](int c) {
+            ScanBounds(ChunkBegin(c), ChunkBegin(c + 1), partial[2 * c], partial[2 * c + 1]);
+        });
+        for (int c = 0; c < chunks; ++c) {
+            bounds.Merge(partial[2 * c]);
+            centroidBounds.Merge(partial[2 * c + 1]);
+        }
+    }
+
+    if (count == 1 || depth >= MaxDepth) {
+        return false;
+    }
+
+    // bin along every axis with an extent, bins[axis * BinCount + b]
+    XMVECTOR cMin = centroidBounds.Min();
+    XMVECTOR extent = centroidBounds.Max() - cMin;
+    float axisMin[3], scale[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float axisExtent = XMVectorGetByIndex(extent, axis);
+        axisMin[axis] = XMVectorGetByIndex(cMin, axis);
+        scale[axis] = axisExtent > 0.0f ? BinCount / axisExtent : 0.0f;
+    }
+    auto BinRange = [&](uint32_t first, uint32_t last, Bin *bins) {
+        for (int b = 0; b < 3 * BinCount; ++b) {
+            bins[b].count = 0;
+        }
+        for (uint32_t i = first; i < last; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                if (scale[axis] > 0.0f) {
+                    int b = std::min(BinCount - 1, int((XMVectorGetByIndex(prims[i].centroid, axis) - axisMin[axis]) * scale[axis]));
+                    bins[axis * BinCount + b].box.Merge(prims[i].box);
+                    bins[axis * BinCount + b].count += 1;
+                }
+            }
+        }
+    };
+    Bin bins[3 * BinCount];
+    if (chunks == 1) {
+        BinRange(begin, end, bins);
+    } else {
+        std::vector<Bin> partial(size_t(chunks) * 3 * BinCount);
+        ParallelFor(chunks, threadCount, [&](int c) {
+            BinRange(ChunkBegin(c), ChunkBegin(c + 1), &partial[size_t(c) * 3 * BinCount]);
+        });
+        for (int b = 0; b < 3 * BinCount; ++b) {
+            bins[b].count = 0;
+            for (int c = 0; c < chunks; ++c) {
+                bins[b].box.Merge(partial[size_t(c) * 3 * BinCount + b].box);
+                bins[b].count += partial[size_t(c) * 3 * BinCount + b].count;
+            }
+        }
+    }
+
+    // evaluate the binned SAH along every axis, keep the cheapest split plane
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (scale[axis] <= 0.0f) {
+            continue;
+        }
+        const Bin *axisBins = bins + axis * BinCount;
+
+        // sweep from the right to collect suffix areas, then from the left to evaluate
+        float rightArea[BinCount];
+        int rightCount[BinCount];
+        AABB box;
+        int sum = 0;
+        for (int b = BinCount - 1; b > 0; --b) {
+            box.Merge(axisBins[b].box);
+            sum += axisBins[b].count;
+            rightArea[b] = box.SurfaceArea();
+            rightCount[b] = sum;
+        }
+        box.Reset();
+        sum = 0;
+        for (int b = 0; b < BinCount - 1; ++b) {
+            box.Merge(axisBins[b].box);
+            sum += axisBins[b].count;
+            if (sum == 0 || rightCount[b + 1] == 0) {
+                continue;
+            }
+            float cost = box.SurfaceArea() * sum + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    float area = bounds.SurfaceArea();
+    float leafCost = IntersectCost * count;
+    float splitCost = (bestAxis < 0 || area <= 0.0f) ? FLT_MAX : TraversalCost + IntersectCost * bestCost / area;
+    if (count <= static_cast<uint32_t>(mMaxLeafSize) && leafCost <= splitCost) {
+        return false;
+    }
+
+    if (bestAxis >= 0) {
+        float splitMin = axisMin[bestAxis];
+        float splitScale = scale[bestAxis];
+        auto Left = [=](const BuildPrim &prim) {
+            int b = std::min(BinCount - 1, int((XMVectorGetByIndex(prim.centroid, bestAxis) - splitMin) * splitScale));
+            return b <= bestSplit;
+        };
+        if (chunks == 1) {
+            mid = static_cast<uint32_t>(std::partition(prims.begin() + begin, prims.begin() + end, Left) - prims.begin());
+        } else {
+            // count the left prims of every chunk, then scatter both sides to their place
+            std::vector<uint32_t> leftCounts(chunks);
+            ParallelFor(chunks, threadCount, [&](int c) {
+                leftCounts[c] = static_cast<uint32_t>(std::count_if(prims.begin() + ChunkBegin(c), prims.begin() + ChunkBegin(c + 1), Left));
+            });
+            std::vector<uint32_t> leftAt(chunks), rightAt(chunks);
+            uint32_t lefts = 0;
+            for (int c = 0; c < chunks; ++c) {
+                leftAt[c] = lefts;
+                lefts += leftCounts[c];
+            }
+            uint32_t rights = lefts;
+            for (int c = 0; c < chunks; ++c) {
+                rightAt[c] = rights;
+                rights += ChunkBegin(c + 1) - ChunkBegin(c) - leftCounts[c];
+            }
+            std::vector<BuildPrim> sorted(count);
+            ParallelFor(chunks, threadCount, [&](int c) {
+                uint32_t left = leftAt[c], right = rightAt[c];
+                for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+                    sorted[Left(prims[i]) ? left++ : right++] = prims[i];
+                }
+            });
+            ParallelFor(chunks, threadCount, [&](int c) {
+                std::copy(sorted.begin() + (ChunkBegin(c) - begin), sorted.begin() + (ChunkBegin(c + 1) - begin), prims.begin() + ChunkBegin(c));
+            });
+            mid = begin + lefts;
+        }
+    } else {
+        // all centroids coincide, split in the middle of the list
+        mid = begin + count / 2;
+    }
+    if (mid == begin || mid == end) {
+        mid = begin + count / 2;
+    }
+    return true;
+}
+
+inline uint32_t BVHNode::Build(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth) {
+    mDepth = std::max(mDepth, depth);
+
+    AABB bounds;
+    uint32_t mid;
+    if (!Split(prims, begin, end, depth, 1, bounds, mid)) {
+        return MakeLeaf(prims, begin, end, bounds);
+    }
+
+    uint32_t index = static_cast<uint32_t>(mNodes.size());
+    mNodes.push_back(Node());
+    Build(prims, begin, mid, depth + 1);
+    uint32_t second = Build(prims, mid, end, depth + 1);
+
+    Node &node = mNodes[index];
+    XMStoreFloat3(&node.min, bounds.Min());
+    XMStoreFloat3(&node.max, bounds.Max());
+    node.offset = second;
+    node.count = 0;
+    return index;
+}
+
+INLINE uint32_t BVHNode::MortonSplit(const std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end) {
+    uint32_t diff = prims[begin].code ^ prims[end - 1].code;
+    if (diff == 0) {
+        // equal codes, split in the middle of the list
+        return begin + (end - begin) / 2;
+    }
+    uint32_t bit = 1u << 31;
+    while (!(diff & bit)) {
+        bit >>= 1;
+    }
+    // the codes are sorted and agree above the bit, the ones that have it come last
+    auto it = std::partition_point(prims.begin() + begin, prims.begin() + end, [=](const BuildPrim &prim) {
+        return !(prim.code & bit);
+    });
+    return static_cast<uint32_t>(it - prims.begin());
+}
+
+inline uint32_t BVHNode::BuildMorton(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth) {
+    mDepth = std::max(mDepth, depth);
+
+    if (end - begin <= static_cast<uint32_t>(mMaxLeafSize) || depth >= MaxDepth) {
+        AABB bounds;
+        for (uint32_t i = begin; i < end; ++i) {
+            bounds.Merge(prims[i].box);
+        }
+        return MakeLeaf(prims, begin, end, bounds);
+    }
+
+    uint32_t mid = MortonSplit(prims, begin, end);
+    uint32_t index = static_cast<uint32_t>(mNodes.size());
+    mNodes.push_back(Node());
+    BuildMorton(prims, begin, mid, depth + 1);
+    uint32_t second = BuildMorton(prims, mid, end, depth + 1);
+
+    // the box from the children, no scan over the prims
+    mNodes[index].offset = second;
+    mNodes[index].count = 0;
+    RefitNode(index);
+    return index;
+}
+
+INLINE void BVHNode::SortMorton(std::vector<BuildPrim> &prims, int threadCount) {
+    uint32_t count = static_cast<uint32_t>(prims.size());
+    int chunks = count >= ParallelScanSize ? threadCount : 1;
+    auto ChunkBegin = [=](int c) {
+        return static_cast<uint32_t>(uint64_t(count) * c / chunks);
+    };
+
+    std::vector<AABB> partial(chunks);
+    ParallelFor(chunks, threadCount, [&](int c) {
+        for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+            partial[c].Merge(prims[i].centroid);
+        }
+    });
+    AABB centroidBounds;
+    for (const AABB &box : partial) {
+        centroidBounds.Merge(box);
+    }
+
+    // keys are the code above the prim index, a flat axis gets all zeros
+    XMVECTOR cMin = centroidBounds.Min();
+    XMVECTOR extent = centroidBounds.Max() - cMin;
+    XMVECTOR cells = XMVectorReplicate(float(1 << MortonBits));
+    XMVECTOR scale = XMVectorSelect(cells / extent, XMVectorZero(), XMVectorLessOrEqual(extent, XMVectorZero()));
+    XMVECTOR last = XMVectorReplicate(float((1 << MortonBits) - 1));
+    std::vector<uint64_t> keys(count), sorted(count);
+    ParallelFor(chunks, threadCount, [&](int c) {
+        for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+            XMFLOAT3 cell;
+            XMStoreFloat3(&cell, XMVectorMin((prims[i].centroid - cMin) * scale, last));
+            uint32_t code = SpreadBits(uint32_t(cell.x)) | SpreadBits(uint32_t(cell.y)) << 1 | SpreadBits(uint32_t(cell.z)) << 2;
+            keys[i] = uint64_t(code) << 32 | i;
+        }
+    });
+
+    // least significant digit first, every chunk scatters to its own offsets per digit
+    static const int radix = 1 << RadixBits;
+    std::vector<uint32_t> offsets(size_t(chunks) * radix);
+    for (int shift = 32; shift < 32 + 3 * MortonBits; shift += RadixBits) {
+        ParallelFor(chunks, threadCount, [&](int c) {
+            uint32_t *counts = &offsets[size_t(c) * radix];
+            std::fill(counts, counts + radix, 0);
+            for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+                counts[(keys[i] >> shift) & (radix - 1)] += 1;
+            }
+        });
+        uint32_t sum = 0;
+        for (int digit = 0; digit < radix; ++digit) {
+            for (int c = 0; c < chunks; ++c) {
+                uint32_t digitCount = offsets[size_t(c) * radix + digit];
+                offsets[size_t(c) * radix + digit] = sum;
+                sum += digitCount;
+            }
+        }
+        ParallelFor(chunks, threadCount, [&](int c) {
+            uint32_t *at = &offsets[size_t(c) * radix];
+            for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+                sorted[at[(keys[i] >> shift) & (radix - 1)]++] = keys[i];
+            }
+        });
+        keys.swap(sorted);
+    }
+
+    std::vector<BuildPrim> ordered(count);
+    ParallelFor(chunks, threadCount, [&](int c) {
+        for (uint32_t i = ChunkBegin(c); i < ChunkBegin(c + 1); ++i) {
+            ordered[i] = prims[keys[i] & 0xFFFFFFFFu];
+            ordered[i].code = static_cast<uint32_t>(keys[i] >> 32);
+        }
+    });
+    prims.swap(ordered);
+}
+
+INLINE void BVHNode::BuildParallel(std::vector<BuildPrim> &prims, int rootDepth, int maxLeafSize, int threadCount, bool morton) {
+    std::vector<TopNode> top;
+    std::vector<Task> tasks;
+    SplitTop(prims, 0, static_cast<uint32_t>(prims.size()), rootDepth, threadCount, morton, top, tasks);
+
+    // the largest tasks first, so the threads run out of work at about the same time
+    std::vector<int> order(tasks.size());
+    for (int t = 0; t < static_cast<int>(tasks.size()); ++t) {
+        order[t] = t;
+    }
+    std::sort(order.begin(), order.end(), [&tasks](int a, int b) {
+        return tasks[a].end - tasks[a].begin > tasks[b].end - tasks[b].begin;
+    });
+    std::vector<std::unique_ptr<BVHNode>> trees(tasks.size());
+    ParallelFor(static_cast<int>(tasks.size()), threadCount, [&](int t) {
+        const Task &task = tasks[order[t]];
+        trees[order[t]].reset(new BVHNode(prims, task.begin, task.end, maxLeafSize, task.depth, morton));
+    });
+
+    size_t nodeCount = top.size();
+    for (auto &tree : trees) {
+        nodeCount += tree->mNodes.size();
+    }
+    mNodes.reserve(nodeCount);
+    mPrims.reserve(prims.size());
+    std::vector<uint32_t> splits;
+    EmitTop(top, 0, trees, splits);
+
+    // the boxes of the top nodes from their children, bottom up
+    for (auto it = splits.rbegin(); it != splits.rend(); ++it) {
+        RefitNode(*it);
+    }
+}
+
+inline int BVHNode::SplitTop(std::vector<BuildPrim> &prims, uint32_t begin, uint32_t end, int depth, int threadCount, bool morton,
+                             std::vector<TopNode> &top, std::vector<Task> &tasks) {
+    mDepth = std::max(mDepth, depth);
+    int index = static_cast<int>(top.size());
+    top.push_back({ -1, -1, -1 });
+
+    // a few tasks per thread is enough to even out their sizes
+    uint32_t taskSize = std::max(static_cast<uint32_t>(prims.size() / (8 * threadCount)), MinTaskSize);
+    uint32_t mid = 0;
+    bool split = end - begin > taskSize && depth < MaxDepth;
+    if (split && morton) {
+        mid = MortonSplit(prims, begin, end);
+    } else if (split) {
+        AABB bounds;
+        split = Split(prims, begin, end, depth, threadCount, bounds, mid);
+    }
+    if (!split) {
+        top[index].task = static_cast<int>(tasks.size());
+        tasks.push_back({ begin, end, depth });
+        return index;
+    }
+
+    int first = SplitTop(prims, begin, mid, depth + 1, threadCount, morton, top, tasks);
+    int second = SplitTop(prims, mid, end, depth + 1, threadCount, morton, top, tasks);
+    top[index].first = first;
+    top[index].second = second;
+    return index;
+}
+
+inline uint32_t BVHNode::EmitTop(const std::vector<TopNode> &top, int index, std::vector<std::unique_ptr<BVHNode>> &trees, std::vector<uint32_t> &splits) {
+    const TopNode &topNode = top[index];
+    uint32_t at = static_cast<uint32_t>(mNodes.size());
+    if (topNode.task >= 0) {
+        const BVHNode &tree = *trees[topNode.task];
+        uint32_t primBase = static_cast<uint32_t>(mPrims.size());
+        mPrims.insert(mPrims.end(), tree.mPrims.begin(), tree.mPrims.end());
+        for (Node node : tree.mNodes) {
+            node.offset += node.count > 0 ? primBase : at;
+            mNodes.push_back(node);
+        }
+        mDepth = std::max(mDepth, tree.mDepth);
+        trees[topNode.task].reset();
+        return at;
+    }
+
+    splits.push_back(at);
+    mNodes.push_back(Node());
+    EmitTop(top, topNode.first, trees, splits);
+    uint32_t second = EmitTop(top, topNode.second, trees, splits);
+    mNodes[at].offset = second;
+    mNodes[at].count = 0;
+    return at;
+}
+
+INLINE void BVHNode::OptimizeTreelets(int threadCount) {
+    uint32_t nodeCount = static_cast<uint32_t>(mNodes.size());
+    std::vector<Link> links(nodeCount);
+    links[0].depth = 1;
+    for (uint32_t index = 0; index < nodeCount; ++index) {
+        const Node &node = mNodes[index];
+        if (node.count == 0) {
+            links[index].left = index + 1;
+            links[index].right = node.offset;
+            links[index + 1].depth = links[node.offset].depth = links[index].depth + 1;
+        }
+    }
+    for (uint32_t index = nodeCount; index-- > 0;) {
+        const Node &node = mNodes[index];
+        Link &link = links[index];
+        link.cost = NodeCost(node);
+        if (node.count > 0) {
+            link.prims = node.count;
+            link.height = 0;
+        } else {
+            link.prims = links[link.left].prims + links[link.right].prims;
+            link.cost += links[link.left].cost + links[link.right].cost;
+            link.height = std::max(links[link.left].height, links[link.right].height) + 1;
+        }
+    }
+
+    // A treelet only changes the nodes below its root, so the subtrees of a refit
+    // partition are independent. Children come after their parent in both, a backwards
+    // sweep is bottom up.
+    Partition();
+    ParallelFor(static_cast<int>(mSubtrees.size()), threadCount, [&](int s) {
+        for (uint32_t index = mSubtrees[s].end; index-- > mSubtrees[s].root;) {
+            if (mNodes[index].count == 0 && links[index].prims >= TreeletMinPrims) {
+                OptimizeTreelet(index, links);
+            }
+        }
+    });
+    for (uint32_t index : mTopNodes) {
+        OptimizeTreelet(index, links);
+    }
+    mSubtrees.clear();
+    mTopNodes.clear();
+    mBuildCost = 0.0f;
+
+    std::vector<Node> nodes;
+    std::vector<Hitable *> prims;
+    nodes.reserve(nodeCount);
+    prims.reserve(mPrims.size());
+    mDepth = 0;
+    Relink(0, 1, links, nodes, prims);
+    mNodes.swap(nodes);
+    mPrims.swap(prims);
+}
+
+INLINE void BVHNode::OptimizeTreelet(uint32_t root, std::vector<Link> &links) {
+    // grow the treelet from the children of the root, opening the largest leaf each time
+    uint32_t leaves[TreeletSize];
+    uint32_t inner[TreeletSize - 1];
+    int leafCount = 2, innerCount = 1;
+    leaves[0] = links[root].left;
+    leaves[1] = links[root].right;
+    inner[0] = root;
+    while (leafCount < TreeletSize) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int l = 0; l < leafCount; ++l) {
+            const Node &node = mNodes[leaves[l]];
+            if (node.count == 0 && NodeArea(node) > largestArea) {
+                largest = l;
+                largestArea = NodeArea(node);
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        uint32_t opened = leaves[largest];
+        inner[innerCount++] = opened;
+        leaves[largest] = links[opened].left;
+        leaves[leafCount++] = links[opened].right;
+    }
+
+    // the best subtree over every subset of the leaves, subsets are numbered below the
+    // sets they are part of
+    int full = (1 << leafCount) - 1;
+    XMVECTOR mins[1 << TreeletSize], maxs[1 << TreeletSize];
+    float best[1 << TreeletSize];
+    int splits[1 << TreeletSize], heights[1 << TreeletSize];
+    uint32_t prims[1 << TreeletSize];
+    for (int set = 1; set <= full; ++set) {
+        int low = set & -set;
+        if (set == low) {
+            int l = 0;
+            while (low != 1 << l) {
+                ++l;
+            }
+            const Node &node = mNodes[leaves[l]];
+            mins[set] = XMLoadFloat3(&node.min);
+            maxs[set] = XMLoadFloat3(&node.max);
+            best[set] = links[leaves[l]].cost;
+            heights[set] = links[leaves[l]].height;
+            prims[set] = links[leaves[l]].prims;
+            continue;
+        }
+        mins[set] = XMVectorMin(mins[set ^ low], mins[low]);
+        maxs[set] = XMVectorMax(maxs[set ^ low], maxs[low]);
+        prims[set] = prims[set ^ low] + prims[low];
+
+        // the other leaves on the left are every proper subset of the rest
+        int rest = set ^ low;
+        float bestSplit = FLT_MAX;
+        for (int others = (rest - 1) & rest;; others = (others - 1) & rest) {
+            int part = others | low;
+            if (best[part] + best[set ^ part] < bestSplit) {
+                bestSplit = best[part] + best[set ^ part];
+                splits[set] = part;
+            }
+            if (others == 0) {
+                break;
+            }
+        }
+        best[set] = TraversalCost * AABB(mins[set], maxs[set]).SurfaceArea() + bestSplit;
+        heights[set] = std::max(heights[splits[set]], heights[set ^ splits[set]]) + 1;
+    }
+    // keep the old treelet unless the new one is better and no deeper than traversal allows
+    if (best[full] >= links[root].cost * 0.9999f || links[root].depth + heights[full] > MaxDepth) {
+        return;
+    }
+
+    // hand the inner nodes out to the sets top down, the root keeps its place
+    uint32_t owners[1 << TreeletSize];
+    int pending[TreeletSize];
+    int top = 0, next = 1;
+    owners[full] = root;
+    pending[top++] = full;
+    while (top > 0) {
+        int set = pending[--top];
+        uint32_t index = owners[set];
+        uint32_t children[2];
+        int parts[2] = { splits[set], set ^ splits[set] };
+        for (int side = 0; side < 2; ++side) {
+            int part = parts[side];
+            if ((part & (part - 1)) == 0) {
+                int l = 0;
+                while (part != 1 << l) {
+                    ++l;
+                }
+                children[side] = leaves[l];
+            } else {
+                owners[part] = inner[next++];
+                children[side] = owners[part];
+                pending[top++] = part;
+            }
+        }
+
+        Node &node = mNodes[index];
+        XMStoreFloat3(&node.min, mins[set]);
+        XMStoreFloat3(&node.max, maxs[set]);
+        Link &link = links[index];
+        link.left = children[0];
+        link.right = children[1];
+        link.prims = prims[set];
+        link.cost = best[set];
+        link.height = heights[set];
+    }
+}
+
+inline uint32_t BVHNode::Relink(uint32_t index, int depth, const std::vector<Link> &links, std::vector<Node> &nodes, std::vector<Hitable *> &prims) {
+    mDepth = std::max(mDepth, depth);
+    uint32_t at = static_cast<uint32_t>(nodes.size());
+    Node node = mNodes[index];
+    if (node.count > 0) {
+        prims.insert(prims.end(), mPrims.begin() + node.offset, mPrims.begin() + node.offset + node.count);
+        node.offset = static_cast<uint32_t>(prims.size()) - node.count;
+        nodes.push_back(node);
+        return at;
+    }
+
+    const Link &link = links[index];
+    if (link.prims <= static_cast<uint32_t>(mMaxLeafSize) && IntersectCost * link.prims * NodeArea(node) <= link.cost) {
+        uint32_t pending[MaxDepth + 1];
+        int top = 0;
+        pending[top++] = index;
+        while (top > 0) {
+            uint32_t below = pending[--top];
+            const Node &inner = mNodes[below];
+            if (inner.count > 0) {
+                prims.insert(prims.end(), mPrims.begin() + inner.offset, mPrims.begin() + inner.offset + inner.count);
+            } else {
+                pending[top++] = links[below].right;
+                pending[top++] = links[below].left;
+            }
+        }
+        node.offset = static_cast<uint32_t>(prims.size()) - link.prims;
+        node.count = link.prims;
+        nodes.push_back(node);
+        return at;
+    }
+
+    nodes.push_back(node);
+    Relink(links[index].left, depth + 1, links, nodes, prims);
+    nodes[at].offset = Relink(links[index].right, depth + 1, links, nodes, prims);
+    return at;
+}
+
+INLINE float BVHNode::Cost(void) const {
+    if (mNodes.empty()) {
+        return 0.0f;
+    }
+    double cost = 0.0;
+    for (const Node &node : mNodes) {
+        cost += NodeCost(node);
+    }
+    float area = NodeArea(mNodes[0]);
+    return area > 0.0f ? static_cast<float>(cost / area) : 0.0f;
+}
+
+INLINE bool BVHNode::BoundingBox(AABB &box) {
+    if (mNodes.empty()) {
+        return false;
+    }
+    box = AABB(XMLoadFloat3(&mNodes[0].min), XMLoadFloat3(&mNodes[0].max));
+    return true;
+}
+
+INLINE bool BVHNode::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    if (mNodes.empty()) {
+        return false;
+    }
+    return Traverse(0, ray, tMin, tMax, record);
+}
+
+INLINE bool BVHNode::Traverse(uint32_t root, const Ray &ray, float tMin, float tMax, Record &record) {
+    XMVECTOR origin = ray.Origin();
+    XMVECTOR invDir = XMVectorReciprocal(ray.Direction());
+
+    struct Entry {
+        uint32_t    node;
+        float       tNear;
+    };
+    Entry stack[MaxDepth + 1];
+    int top = 0;
+
+    float tNear;
+    if (!NodeHit(mNodes[root], origin, invDir, tMin, tMax, tNear)) {
+        return false;
+    }
+    stack[top++] = { root, tNear };
+
+    Record temp;
+    bool isHit = false;
+    float closetHit = tMax;
+    while (top > 0) {
+        Entry entry = stack[--top];
+        // a closer hit was found after this node got pushed
+        if (entry.tNear > closetHit) {
+            continue;
+        }
+
+        const Node &node = mNodes[entry.node];
+        if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                if (mPrims[i]->Hit(ray, tMin, closetHit, temp)) {
+                    isHit = true;
+                    closetHit = temp.t;
+                    record = temp;
+                }
+            }
+            continue;
+        }
+
+        uint32_t first = entry.node + 1;
+        uint32_t second = node.offset;
+        float tFirst, tSecond;
+        bool hitFirst = NodeHit(mNodes[first], origin, invDir, tMin, closetHit, tFirst);
+        bool hitSecond = NodeHit(mNodes[second], origin, invDir, tMin, closetHit, tSecond);
+        if (hitFirst && hitSecond) {
+            // push the far child first so the near one is visited next
+            if (tSecond < tFirst) {
+                std::swap(first, second);
+                std::swap(tFirst, tSecond);
+            }
+            stack[top++] = { second, tSecond };
+            stack[top++] = { first, tFirst };
+        } else if (hitFirst) {
+            stack[top++] = { first, tFirst };
+        } else if (hitSecond) {
+            stack[top++] = { second, tSecond };
+        }
+    }
+
+    return isHit;
+}
+
+// Any hit traversal: no record, no front to back order, done at the first primitive
+// that blocks the ray.
+INLINE bool BVHNode::Occluded(const Ray &ray, float tMin, float tMax) {
+    if (mNodes.empty()) {
+        return false;
+    }
+
+    XMVECTOR origin = ray.Origin();
+    XMVECTOR invDir = XMVectorReciprocal(ray.Direction());
+    uint32_t stack[MaxDepth + 1];
+    int top = 0;
+
+    float tNear;
+    if (!NodeHit(mNodes[0], origin, invDir, tMin, tMax, tNear)) {
+        return false;
+    }
+    stack[top++] = 0;
+
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        const Node &node = mNodes[index];
+        if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                if (mPrims[i]->Occluded(ray, tMin, tMax)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        if (NodeHit(mNodes[node.offset], origin, invDir, tMin, tMax, tNear)) {
+            stack[top++] = node.offset;
+        }
+        if (NodeHit(mNodes[index + 1], origin, invDir, tMin, tMax, tNear)) {
+            stack[top++] = index + 1;
+        }
+    }
+    return false;
+}
+
+INLINE void BVHNode::TraverseRay(uint32_t root, RayPacket &packet, int r) {
+    Record record;
+    if (Traverse(root, packet.rays[r], packet.tMin, packet.tMax[r], record)) {
+        packet.hit[r] = true;
+        packet.tMax[r] = record.t;
+        packet.records[r] = record;
+    }
+}
+
+INLINE int BVHNode::FirstActive(uint32_t index, const RayPacket &packet, int first, float &tNear) const {
+    const Node &node = mNodes[index];
+    XMVECTOR min = XMLoadFloat3(&node.min);
+    XMVECTOR max = XMLoadFloat3(&node.max);
+    // coherent rays mostly agree, so the ray that got us here usually decides
+    if (AABB::Hit(min, max, packet.rays[first].Origin(), packet.invDirs[first], packet.tMin, packet.tMax[first], tNear)) {
+        return first;
+    }
+    if (!packet.MayHit(min, max)) {
+        return packet.count;
+    }
+    for (int r = first + 1; r < packet.count; ++r) {
+        if (AABB::Hit(min, max, packet.rays[r].Origin(), packet.invDirs[r], packet.tMin, packet.tMax[r], tNear)) {
+            return r;
+        }
+    }
+    return packet.count;
+}
+
+INLINE void BVHNode::HitPacket(RayPacket &packet) {
+    if (mNodes.empty() || packet.count == 0) {
+        return;
+    }
+
+    packet.Prepare();
+    // rays that disagree on a direction sign share no slab planes, the interval
+    // bounds would cover everything
+    if (!packet.coherent) {
+        for (int r = 0; r < packet.count; ++r) {
+            TraverseRay(0, packet, r);
+        }
+        return;
+    }
+
+    struct Entry {
+        uint32_t    node;
+        int         first;
+    };
+    Entry stack[MaxDepth + 1];
+    int top = 0;
+
+    float tNear;
+    int first = FirstActive(0, packet, 0, tNear);
+    if (first == packet.count) {
+        return;
+    }
+    stack[top++] = { 0, first };
+
+    Record temp;
+    while (top > 0) {
+        Entry entry = stack[--top];
+        // the packet has diverged down to one ray, which is faster on its own
+        if (entry.first == packet.count - 1) {
+            TraverseRay(entry.node, packet, entry.first);
+            continue;
+        }
+
+        const Node &node = mNodes[entry.node];
+        if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                Hitable *prim = mPrims[i];
+                for (int r = entry.first; r < packet.count; ++r) {
+                    if (prim->Hit(packet.rays[r], packet.tMin, packet.tMax[r], temp)) {
+                        packet.hit[r] = true;
+                        packet.tMax[r] = temp.t;
+                        packet.records[r] = temp;
+                    }
+                }
+            }
+            continue;
+        }
+
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.offset;
+        float tLeft, tRight;
+        int leftFirst = FirstActive(left, packet, entry.first, tLeft);
+        int rightFirst = FirstActive(right, packet, entry.first, tRight);
+        // front to back for the leading ray of each child
+        if (rightFirst < leftFirst || (rightFirst == leftFirst && tRight < tLeft)) {
+            std::swap(left, right);
+            std::swap(leftFirst, rightFirst);
+        }
+        if (rightFirst < packet.count) {
+            stack[top++] = { right, rightFirst };
+        }
+        if (leftFirst < packet.count) {
+            stack[top++] = { left, leftFirst };
+        }
+    }
+}
+
+template <typename Func>
+INLINE void BVHNode::ParallelFor(int count, int threadCount, const Func &func) {
+    std::atomic<int> next(0);
+    auto Worker = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            func(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < std::min(threadCount, count); ++t) {
+        threads.emplace_back(Worker);
+    }
+    Worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+INLINE void BVHNode::RefitNode(uint32_t index) {
+    Node &node = mNodes[index];
+    if (node.count > 0) {
+        AABB bounds;
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            AABB box;
+            mPrims[i]->BoundingBox(box);
+            bounds.Merge(box);
+        }
+        XMStoreFloat3(&node.min, bounds.Min());
+        XMStoreFloat3(&node.max, bounds.Max());
+    } else {
+        const Node &first = mNodes[index + 1];
+        const Node &second = mNodes[node.offset];
+        XMStoreFloat3(&node.min, XMVectorMin(XMLoadFloat3(&first.min), XMLoadFloat3(&second.min)));
+        XMStoreFloat3(&node.max, XMVectorMax(XMLoadFloat3(&first.max), XMLoadFloat3(&second.max)));
+    }
+}
+
+INLINE float BVHNode::RangeCost(uint32_t begin, uint32_t end, bool refit) {
+    // children always come after their parent, a backwards sweep is bottom up
+    float cost = 0.0f;
+    for (uint32_t index = end; index-- > begin;) {
+        if (refit) {
+            RefitNode(index);
+        }
+        cost += NodeCost(mNodes[index]);
+    }
+    return cost;
+}
+
+INLINE void BVHNode::Partition(void) {
+    // keep splitting the largest subtree until there are enough to go round the threads
+    mSubtrees.assign(1, { 0, static_cast<uint32_t>(mNodes.size()), 1, 0.0f });
+    mTopNodes.clear();
+    while (mSubtrees.size() < SubtreeCount) {
+        int largest = -1;
+        for (int s = 0; s < static_cast<int>(mSubtrees.size()); ++s) {
+            const Subtree &subtree = mSubtrees[s];
+            if (mNodes[subtree.root].count == 0 && (largest < 0 || subtree.end - subtree.root > mSubtrees[largest].end - mSubtrees[largest].root)) {
+                largest = s;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        Subtree parent = mSubtrees[largest];
+        uint32_t second = mNodes[parent.root].offset;
+        mTopNodes.push_back(parent.root);
+        mSubtrees[largest] = { parent.root + 1, second, parent.depth + 1, 0.0f };
+        mSubtrees.push_back({ second, parent.end, parent.depth + 1, 0.0f });
+    }
+    std::sort(mSubtrees.begin(), mSubtrees.end(), [](const Subtree &a, const Subtree &b) { return a.root < b.root; });
+    std::sort(mTopNodes.begin(), mTopNodes.end(), std::greater<uint32_t>());
+
+    // the boxes are still the ones the tree was built with
+    float cost = 0.0f;
+    for (auto &subtree : mSubtrees) {
+        subtree.buildCost = RangeCost(subtree.root, subtree.end, false);
+        cost += subtree.buildCost;
+    }
+    for (uint32_t index : mTopNodes) {
+        cost += NodeCost(mNodes[index]);
+    }
+    mBuildCost = cost;
+}
+
+INLINE void BVHNode::RebuildSubtrees(const std::vector<int> &degraded, std::vector<float> &costs, int threadCount) {
+    // a subtree owns a contiguous run of mPrims, from its leftmost to its rightmost leaf
+    auto PrimRange = [this](const Subtree &subtree, uint32_t &begin, uint32_t &end) {
+        uint32_t first = subtree.root, last = subtree.root;
+        while (mNodes[first].count == 0) {
+            first = first + 1;
+        }
+        while (mNodes[last].count == 0) {
+            last = mNodes[last].offset;
+        }
+        begin = mNodes[first].offset;
+        end = mNodes[last].offset + mNodes[last].count;
+    };
+
+    std::vector<std::unique_ptr<BVHNode>> rebuilt(mSubtrees.size());
+    ParallelFor(static_cast<int>(degraded.size()), threadCount, [&](int d) {
+        const Subtree &subtree = mSubtrees[degraded[d]];
+        uint32_t begin, end;
+        PrimRange(subtree, begin, end);
+        std::vector<Hitable *> prims(mPrims.begin() + begin, mPrims.begin() + end);
+        rebuilt[degraded[d]].reset(new BVHNode(prims.data(), static_cast<int>(prims.size()), mMaxLeafSize, subtree.depth));
+    });
+
+    // Copy the array over in node order with the new subtrees in place of the old ones.
+    // Old indices of the top nodes and subtree roots map to new ones in the same order.
+    std::vector<Node> nodes;
+    nodes.reserve(mNodes.size());
+    std::vector<std::pair<uint32_t, uint32_t>> remap;
+    size_t next = 0;
+    uint32_t index = 0;
+    while (index < mNodes.size()) {
+        uint32_t moved = static_cast<uint32_t>(nodes.size());
+        remap.push_back({ index, moved });
+        if (next == mSubtrees.size() || mSubtrees[next].root != index) {
+            nodes.push_back(mNodes[index++]);
+            continue;
+        }
+
+        Subtree &subtree = mSubtrees[next];
+        const BVHNode *tree = rebuilt[next].get();
+        if (tree) {
+            uint32_t begin, end;
+            PrimRange(subtree, begin, end);
+            std::copy(tree->mPrims.begin(), tree->mPrims.end(), mPrims.begin() + begin);
+            for (Node node : tree->mNodes) {
+                node.offset += node.count > 0 ? begin : moved;
+                nodes.push_back(node);
+            }
+            mDepth = std::max(mDepth, tree->mDepth);
+        } else {
+            for (uint32_t i = subtree.root; i < subtree.end; ++i) {
+                Node node = mNodes[i];
+                node.offset += node.count > 0 ? 0 : moved - subtree.root;
+                nodes.push_back(node);
+            }
+        }
+        index = subtree.end;
+        subtree.root = moved;
+        subtree.end = static_cast<uint32_t>(nodes.size());
+        ++next;
+    }
+
+    auto Remap = [&remap](uint32_t old) {
+        return std::lower_bound(remap.begin(), remap.end(), std::make_pair(old, 0u))->second;
+    };
+    for (uint32_t &top : mTopNodes) {
+        top = Remap(top);
+        nodes[top].offset = Remap(nodes[top].offset);
+    }
+    mNodes.swap(nodes);
+
+    for (int s : degraded) {
+        Subtree &subtree = mSubtrees[s];
+        costs[s] = RangeCost(subtree.root, subtree.end, false);
+        subtree.buildCost = costs[s];
+    }
+}
+
+INLINE BVHNode::RefitStats BVHNode::Refit(float rebuildRatio, int threadCount) {
+    auto start = std::chrono::high_resolution_clock::now();
+    RefitStats stats = { 0.0, 0, 0, 1.0f };
+    if (mNodes.empty()) {
+        return stats;
+    }
+    if (threadCount <= 0) {
+        threadCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    if (mSubtrees.empty()) {
+        Partition();
+    }
+
+    std::vector<float> costs(mSubtrees.size());
+    ParallelFor(static_cast<int>(mSubtrees.size()), threadCount, [&](int s) {
+        costs[s] = RangeCost(mSubtrees[s].root, mSubtrees[s].end, true);
+    });
+
+    std::vector<int> degraded;
+    for (int s = 0; s < static_cast<int>(mSubtrees.size()); ++s) {
+        const Subtree &subtree = mSubtrees[s];
+        if (subtree.buildCost > 0.0f && costs[s] > rebuildRatio * subtree.buildCost) {
+            degraded.push_back(s);
+        }
+    }
+    if (!degraded.empty()) {
+        RebuildSubtrees(degraded, costs, threadCount);
+    }
+
+    float cost = 0.0f;
+    for (float subtreeCost : costs) {
+        cost += subtreeCost;
+    }
+    for (uint32_t index : mTopNodes) {
+        RefitNode(index);
+        cost += NodeCost(mNodes[index]);
+    }
+
+    stats.subtrees = static_cast<int>(mSubtrees.size());
+    stats.rebuilt = static_cast<int>(degraded.size());
+    stats.cost = mBuildCost > 0.0f ? cost / mBuildCost : 1.0f;
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Ray.h"
+#include "Sphere.h"
+#include "HitableList.h"
+#include "BVHNode.h"
+#include "SphereBatch.h"
+#include "WideBVH.h"
+
+// Closest hit throughput of the linear HitableList against the BVH, and the BVH over
+// SIMD sphere batches, on random sphere fields of growing size. Spheres and rays come
+// from a private, fixed seed engine so every run measures the same work. RunWide
+// compares the binary BVH with the WideBVH collapsed from it, in node memory and
+// rays/sec, up to 10M spheres. RunRefit animates 1M spheres and times BVHNode::Refit
+// per frame against building the tree again. RunBuild times every BVHBuildType against
+// the SAH cost and rays/sec of its tree.
+class BVHBenchmark {
+public:
+    BVHBenchmark(double secondsPerCase = 1.0)
+    : mSecondsPerCase(secondsPerCase)
+    {
+
+    }
+    ~BVHBenchmark(void) {
+
+    }
+
+    void Run(std::ostream &os);
+    void RunWide(std::ostream &os);
+    void RunRefit(std::ostream &os);
+    void RunBuild(std::ostream &os, int threadCount = 0);
+
+private:
+    static constexpr int RayCount = 1 << 16;
+
+    // sphereCount spheres at a constant density and RayCount rays from around the field into it
+    static void MakeField(int sphereCount, std::vector<Sphere *> &spheres, std::vector<Ray> &rays);
+
+    // traces rays round robin until the time budget is spent and every hit slot is
+    // filled, returns rays/sec
+    double Measure(Hitable *world, const std::vector<Ray> &rays, std::vector<float> &hits);
+
+    double mSecondsPerCase;
+};
+
+INLINE double BVHBenchmark::Measure(Hitable *world, const std::vector<Ray> &rays, std::vector<float> &hits) {
+    Hitable::Record record = {};
+    size_t traced = 0;
+    std::chrono::duration<double> elapsed(0.0);
+    auto start = std::chrono::high_resolution_clock::now();
+    do {
+        // check the clock in small batches so the slow cases do not overshoot
+        for (int i = 0; i < 64; ++i, ++traced) {
+            const Ray &ray = rays[traced % rays.size()];
+            bool isHit = world->Hit(ray, 0.001f, 1e+38f, record);
+            if (traced < hits.size()) {
+                hits[traced] = isHit ? record.t : -1.0f;
+            }
+        }
+        elapsed = std::chrono::high_resolution_clock::now() - start;
+    } while (elapsed.count() < mSecondsPerCase || traced < hits.size());
+    return traced / elapsed.count();
+}
+
+INLINE void BVHBenchmark::MakeField(int sphereCount, std::vector<Sphere *> &spheres, std::vector<Ray> &rays) {
+    std::mt19937 engine(7);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+    // keep the density constant, a sphere per 8 unit cube on average
+    float halfSize = std::cbrt(float(sphereCount)) * 1.0f;
+    spheres.reserve(sphereCount);
+    for (int i = 0; i < sphereCount; ++i) {
+        XMVECTOR center = { (dist(engine) * 2.0f - 1.0f) * halfSize, (dist(engine) * 2.0f - 1.0f) * halfSize, (dist(engine) * 2.0f - 1.0f) * halfSize, 0.0f };
+        spheres.push_back(new Sphere(center, 0.2f + 0.3f * dist(engine), 0));
+    }
+
+    // rays start on a sphere around the field and aim at random points inside it
+    rays.reserve(RayCount);
+    for (int i = 0; i < RayCount; ++i) {
+        XMVECTOR from = XMVector3Normalize({ dist(engine) * 2.0f - 1.0f, dist(engine) * 2.0f - 1.0f, dist(engine) * 2.0f - 1.0f, 0.0f }) * (halfSize * 2.0f);
+        XMVECTOR to = { (dist(engine) * 2.0f - 1.0f) * halfSize, (dist(engine) * 2.0f - 1.0f) * halfSize, (dist(engine) * 2.0f - 1.0f) * halfSize, 0.0f };
+        rays.push_back(Ray(from, to - from));
+    }
+}
+
+INLINE void BVHBenchmark::Run(std::ostream &os) {
+    static const int sphereCounts[] = { 500, 5000, 50000, 250000, 1000000 };
+
+    os << "spheres, build ms, bvh nodes, bvh depth, list rays/s, bvh rays/s, batch bvh rays/s, speedup, batch speedup, mismatches\n";
+    for (int sphereCount : sphereCounts) {
+        std::vector<Sphere *> spheres;
+        std::vector<Ray> rays;
+        MakeField(sphereCount, spheres, rays);
+
+        std::vector<Hitable *> hitables(spheres.begin(), spheres.end());
+        auto start = std::chrono::high_resolution_clock::now();
+        BVHNode bvh(hitables.data(), sphereCount);
+        std::chrono::duration<double, std::milli> buildMs = std::chrono::high_resolution_clock::now() - start;
+
+        std::vector<Hitable *> batches;
+        SphereBatch::Partition(spheres.data(), sphereCount, SIMD_WIDTH, batches);
+        BVHNode batchBvh(batches.data(), static_cast<int>(batches.size()));
+
+        HitableList list(hitables.data(), sphereCount);
+
+        // the first rays of every run are compared to make sure they find the same hits, the
+        // batches use a different discriminant so their distances get a relative tolerance
+        std::vector<float> listHits(64), bvhHits(64), batchHits(64);
+        double listRate = Measure(&list, rays, listHits);
+        double bvhRate = Measure(&bvh, rays, bvhHits);
+        double batchRate = Measure(&batchBvh, rays, batchHits);
+        int mismatches = 0;
+        for (size_t i = 0; i < listHits.size(); ++i) {
+            if (std::fabs(listHits[i] - bvhHits[i]) > 1e-4f || std::fabs(listHits[i] - batchHits[i]) > 1e-4f * std::max(1.0f, listHits[i])) {
+                ++mismatches;
+            }
+        }
+
+        os << sphereCount << ", " << buildMs.count() << ", " << bvh.Nodes().size() << ", " << bvh.Depth() << ", "
+           << listRate << ", " << bvhRate << ", " << batchRate << ", " << bvhRate / listRate << ", " << batchRate / listRate << ", " << mismatches << std::endl;
+
+        for (auto batch : batches) {
+            delete batch;
+        }
+        for (auto sphere : spheres) {
+            delete sphere;
+        }
+    }
+}
+
+INLINE void BVHBenchmark::RunWide(std::ostream &os) {
+    static const int sphereCounts[] = { 10000, 100000, 1000000, 10000000 };
+
+    os << "spheres, build ms, collapse ms, bvh nodes, bvh node MB, bvh8 nodes, bvh8 node MB, bvh8 depth, memory ratio, bvh rays/s, bvh8 rays/s, speedup, mismatches\n";
+    for (int sphereCount : sphereCounts) {
+        std::vector<Sphere *> spheres;
+        std::vector<Ray> rays;
+        MakeField(sphereCount, spheres, rays);
+
+        std::unique_ptr<BVHNode> bvh;
+        std::chrono::duration<double, std::milli> buildMs;
+        {
+            std::vector<Hitable *> hitables(spheres.begin(), spheres.end());
+            auto start = std::chrono::high_resolution_clock::now();
+            bvh.reset(new BVHNode(hitables.data(), sphereCount));
+            buildMs = std::chrono::high_resolution_clock::now() - start;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        WideBVH wide(*bvh);
+        std::chrono::duration<double, std::milli> collapseMs = std::chrono::high_resolution_clock::now() - start;
+
+        double bvhBytes = double(bvh->Nodes().size()) * sizeof(BVHNode::Node);
+        double wideBytes = double(wide.Nodes().size()) * sizeof(WideBVH::Node);
+
+        // the wide tree has the same primitives and boxes no smaller, so it must find the same hits
+        std::vector<float> bvhHits(1024), wideHits(1024);
+        double bvhRate = Measure(bvh.get(), rays, bvhHits);
+        double wideRate = Measure(&wide, rays, wideHits);
+        int mismatches = 0;
+        for (size_t i = 0; i < bvhHits.size(); ++i) {
+            if (bvhHits[i] != wideHits[i]) {
+                ++mismatches;
+            }
+        }
+
+        os << sphereCount << ", " << buildMs.count() << ", " << collapseMs.count() << ", " << bvh->Nodes().size() << ", " << bvhBytes / (1024.0 * 1024.0) << ", "
+           << wide.Nodes().size() << ", " << wideBytes / (1024.0 * 1024.0) << ", " << wide.Depth() << ", " << bvhBytes / wideBytes << ", "
+           << bvhRate << ", " << wideRate << ", " << wideRate / bvhRate << ", " << mismatches << std::endl;
+
+        bvh.reset();
+        for (auto sphere : spheres) {
+            delete sphere;
+        }
+    }
+}
+
+INLINE void BVHBenchmark::RunRefit(std::ostream &os) {
+    static const int sphereCount = 1000000;
+    static const int frameCount = 8;
+
+    std::vector<Sphere *> spheres;
+    std::vector<Ray> rays;
+    MakeField(sphereCount, spheres, rays);
+    std::vector<Hitable *> hitables(spheres.begin(), spheres.end());
+
+    // a slow turntable of the whole field, and a ball of spheres in one corner blowing
+    // up to twice its size, so the subtrees there degrade and get rebuilt
+    float halfSize = std::cbrt(float(sphereCount));
+    XMVECTOR blast = XMVectorSet(0.5f, 0.5f, 0.5f, 0.0f) * halfSize;
+    std::vector<XMVECTOR> rest(sphereCount);
+    for (int i = 0; i < sphereCount; ++i) {
+        rest[i] = spheres[i]->Center();
+    }
+
+    BVHNode bvh(hitables.data(), sphereCount);
+
+    os << "frame, refit ms, subtrees, rebuilt, sah cost, build ms, refit rays/s, build rays/s, mismatches\n";
+    for (int frame = 1; frame <= frameCount; ++frame) {
+        XMMATRIX rotation = XMMatrixRotationY(XMConvertToRadians(1.0f * frame));
+        for (int i = 0; i < sphereCount; ++i) {
+            XMVECTOR offset = rest[i] - blast;
+            bool inside = XMVectorGetX(XMVector3Length(offset)) < 0.25f * halfSize;
+            XMVECTOR center = inside ? blast + offset * (1.0f + float(frame) / frameCount) : rest[i];
+            spheres[i]->SetCenter(XMVector3TransformCoord(center, rotation));
+        }
+
+        BVHNode::RefitStats stats = bvh.Refit();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        BVHNode fresh(hitables.data(), sphereCount);
+        std::chrono::duration<double, std::milli> buildMs = std::chrono::high_resolution_clock::now() - start;
+
+        std::vector<float> refitHits(1024), buildHits(1024);
+        double refitRate = Measure(&bvh, rays, refitHits);
+        double buildRate = Measure(&fresh, rays, buildHits);
+        int mismatches = 0;
+        for (size_t i = 0; i < refitHits.size(); ++i) {
+            if (refitHits[i] != buildHits[i]) {
+                ++mismatches;
+            }
+        }
+
+        os << frame << ", " << stats.ms << ", " << stats.subtrees << ", " << stats.rebuilt << ", " << stats.cost << ", " << buildMs.count() << ", "
+           << refitRate << ", " << buildRate << ", " << mismatches << std::endl;
+    }
+
+    for (auto sphere : spheres) {
+        delete sphere;
+    }
+}
+
+INLINE void BVHBenchmark::RunBuild(std::ostream &os, int threadCount) {
+    static const int sphereCounts[] = { 100000, 1000000 };
+
+    os << "spheres, build, threads, build ms, bvh nodes, bvh depth, sah cost, rays/s, mismatches\n";
+    for (int sphereCount : sphereCounts) {
+        std::vector<Sphere *> spheres;
+        std::vector<Ray> rays;
+        MakeField(sphereCount, spheres, rays);
+        std::vector<Hitable *> hitables(spheres.begin(), spheres.end());
+
+        // every build is held to the hits of the serial SAH tree
+        std::vector<float> referenceHits(1024);
+        for (uint32_t type = 0; type < BVHBuildTypeCount; ++type) {
+            BVHBuildSettings settings = BVHBuildSettings::Create(BVHBuildType(type), threadCount);
+            auto start = std::chrono::high_resolution_clock::now();
+            BVHNode bvh(hitables.data(), sphereCount, 4, settings);
+            std::chrono::duration<double, std::milli> buildMs = std::chrono::high_resolution_clock::now() - start;
+
+            std::vector<float> hits(referenceHits.size());
+            double rate = Measure(&bvh, rays, type == SAHBuild ? referenceHits : hits);
+            int mismatches = 0;
+            for (size_t i = 0; type != SAHBuild && i < hits.size(); ++i) {
+                if (hits[i] != referenceHits[i]) {
+                    ++mismatches;
+                }
+            }
+
+            int threads = threadCount > 0 ? threadCount : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+            os << sphereCount << ", " << BVHBuildSettings::Name(BVHBuildType(type)) << ", " << (type == SAHBuild ? 1 : threads) << ", "
+               << buildMs.count() << ", " << bvh.Nodes().size() << ", " << bvh.Depth() << ", " << bvh.Cost() << ", " << rate << ", " << mismatches << std::endl;
+        }
+
+        for (auto sphere : spheres) {
+            delete sphere;
+        }
+    }
+}
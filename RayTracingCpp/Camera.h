@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Ray.h"
+#include "Random.h"
 
 class Camera {
 public:
@@ -21,8 +22,8 @@ public:
     
     }
 
-    INLINE Ray GenRay(float u, float v) {
-        XMVECTOR rd = RandomInUnitDisk() * mLenRadius;
+    INLINE Ray GenRay(float u, float v, RandomStream &rng) {
+        XMVECTOR rd = rng.InUnitDisk() * mLenRadius;
         XMVECTOR offset = mU * XMVectorGetX(rd) + mV * XMVectorGetY(rd);
         return Ray(mOrigin + offset, (mBottomLeft + (mHorizontal * u) + (mVertical * v)) - mOrigin - offset);
     }
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "DXRScene.h"
+#include "TileScheduler.h"
+#include "RayStats.h"
+
+// PathTrace.hlsli and the ray generation shader of PtMain.hlsl on the CPU, rendering
+// the image of the DXR path tracer from the same constants without a GPU. One
+// DispatchRays is one frame of PtExample: a pool of threads pulls tiles from a
+// TileScheduler and runs the ray generation shader for their pixels, which writes or
+// accumulates into the render target. The shaders' recursion is kept as it is, closest
+// hit and miss shaders are the member functions of the same names.
+class DXRRenderer {
+public:
+    DXRRenderer(const DXRScene &scene, int width, int height, int tileSize = 32, int threadCount = 0);
+    ~DXRRenderer(void) {
+
+    }
+
+    INLINE int Width(void) const { return mWidth; }
+    INLINE int Height(void) const { return mHeight; }
+    INLINE int ThreadCount(void) const { return mThreadCount; }
+    // of the last DispatchRays
+    INLINE double RenderSeconds(void) const { return mRenderSeconds; }
+    INLINE const RayStats & Rays(void) const { return mRays; }
+
+    // the constant buffers, edited between dispatches like PtExample::Update does
+    INLINE Dxr::AppSettings & Settings(void) { return mSettings; }
+    INLINE Dxr::SceneConstants & SceneConstants(void) { return mSceneConsts; }
+    INLINE Dxr::CameraConstants & CameraConstants(void) { return mCameraConsts; }
+
+    // one frame, RayGener for every pixel
+    void DispatchRays(void);
+    // Frames of PtExample with a still camera: jittered by a fixed sequence, seeded by
+    // the frame number and accumulated from the first. Seconds and rays are their totals.
+    void Accumulate(int frames);
+
+    // the render target: radiance summed over the accumulated frames in xyz, their count in w
+    INLINE const XMFLOAT4 & RenderTarget(int x, int y) const { return mRenderTarget[size_t(y) * mWidth + x]; }
+    // the post pass: the average, gamma corrected for display
+    INLINE XMVECTOR PostPass(int x, int y) const {
+        XMFLOAT4 color = RenderTarget(x, y);
+        return XMVectorPow(XMVectorSet(color.x, color.y, color.z, 0.0f) / color.w, XMVectorReplicate(1.0f / 2.2f));
+    }
+
+    // the position, u, v and w Utils::Camera hands PtExample, which scales w to the far plane
+    static void LookAt(const XMVECTOR &eye, const XMVECTOR &lookAt, float fov, float aspect, float farPlane, Dxr::CameraConstants &camera);
+    // a pinhole camera in front of the +z face of the scene, as SceneSetup::LoadModel places it
+    void FrameScene(void);
+    // the settings and scene constants PtExample starts with
+    static void Defaults(Dxr::AppSettings &settings, Dxr::SceneConstants &sceneConsts);
+
+private:
+    void WorkerMain(int worker, TileScheduler &scheduler);
+
+    XMVECTOR RayGener(uint32_t x, uint32_t y) const;
+    Ray PinholdCameraRay(float pixelX, float pixelY) const;
+    Ray LensCameraRay(float pixelX, float pixelY, uint32_t &randSeed) const;
+    XMVECTOR IndirectRayGen(const XMVECTOR &origin, const XMVECTOR &direction, uint32_t seed, uint32_t depth) const;
+    // TraceRay with the primary or indirect hit group, both run the same shaders
+    void TraceRay(const Ray &ray, Dxr::RayPayload &payload) const;
+    void ClosestHit(const Ray &ray, const Hitable::Record &record, Dxr::RayPayload &payload) const;
+    void Miss(const Ray &ray, Dxr::RayPayload &payload) const;
+
+    XMVECTOR ScatterRay(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const;
+    XMVECTOR LambertianScatter(uint32_t &randSeed, uint32_t rayDepth, const Dxr::HitSample &hs) const;
+    XMVECTOR MetalScatter(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const;
+    XMVECTOR DielectricScatter(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const;
+    XMVECTOR EnvironmentColor(const XMVECTOR &dir) const;
+
+    static constexpr float  TMin = 1e-4f;
+    static constexpr float  TMax = 1e+38f;
+
+    const DXRScene         &mScene;
+    int                     mWidth;
+    int                     mHeight;
+    int                     mTileSize;
+    int                     mThreadCount;
+    double                  mRenderSeconds;
+    Dxr::AppSettings        mSettings;
+    Dxr::SceneConstants     mSceneConsts;
+    Dxr::CameraConstants    mCameraConsts;
+    std::vector<XMFLOAT4>   mRenderTarget;
+    RayStats                mRays;
+    std::vector<RayStats>   mWorkerRays;
+};
+
+INLINE DXRRenderer::DXRRenderer(const DXRScene &scene, int width, int height, int tileSize, int threadCount)
+: mScene(scene)
+, mWidth(width)
+, mHeight(height)
+, mTileSize(tileSize)
+, mThreadCount(threadCount)
+, mRenderSeconds(0.0)
+, mCameraConsts()
+, mRenderTarget(size_t(width) * height, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f))
+{
+    if (mThreadCount <= 0) {
+        mThreadCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    Defaults(mSettings, mSceneConsts);
+}
+
+INLINE void DXRRenderer::Defaults(Dxr::AppSettings &settings, Dxr::SceneConstants &sceneConsts) {
+    settings.enableAccumulate = 1;
+    settings.enableJitterCamera = 1;
+    settings.enableLensCamera = 0;
+    settings.enableEnvironmentMap = 0;
+
+    sceneConsts = {};
+    sceneConsts.bgColor = { 3.0f, 3.0f, 3.0f, 3.0f };
+    sceneConsts.maxRayDepth = 3;
+    sceneConsts.sampleCount = 1;
+}
+
+INLINE void DXRRenderer::LookAt(const XMVECTOR &eye, const XMVECTOR &lookAt, float fov, float aspect, float farPlane, Dxr::CameraConstants &camera) {
+    XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+    XMVECTOR direction = XMVector3Normalize(lookAt - eye);
+    XMVECTOR w = direction * farPlane;
+    XMVECTOR u = XMVector3Normalize(XMVector3Cross(w, up)) * (farPlane * std::tan(fov * 0.5f) * aspect);
+    XMVECTOR v = XMVector3Normalize(XMVector3Cross(u, w)) * (farPlane * std::tan(fov * 0.5f));
+    XMStoreFloat4(&camera.position, XMVectorSetW(eye, 0.0f));
+    XMStoreFloat4(&camera.u, u);
+    XMStoreFloat4(&camera.v, v);
+    XMStoreFloat4(&camera.w, w);
+}
+
+INLINE void DXRRenderer::FrameScene(void) {
+    AABB bounds;
+    mScene.BoundingBox(bounds);
+    XMVECTOR extent = (bounds.Max() - bounds.Min()) * 0.5f;
+    float fov = XM_PIDIV4;
+    float aspect = float(mWidth) / float(mHeight);
+    float distance = XMVectorGetZ(extent) + 1.05f * std::max(XMVectorGetY(extent), XMVectorGetX(extent) / aspect) / std::tan(fov * 0.5f);
+    LookAt(bounds.Centroid() + XMVectorSet(0.0f, 0.0f, distance, 0.0f), bounds.Centroid(), fov, aspect, 1000.0f, mCameraConsts);
+}
+
+INLINE void DXRRenderer::Accumulate(int frames) {
+    std::mt19937 engine(1);
+    std::uniform_real_distribution<float> jitter;
+    double seconds = 0.0;
+    RayStats rays = {};
+    for (int frame = 0; frame < frames; ++frame) {
+        mCameraConsts.jitter = { jitter(engine) - 0.5f, jitter(engine) - 0.5f };
+        mSceneConsts.frameSeed = frame + 1;
+        mSceneConsts.accumCount = frame;
+        DispatchRays();
+        seconds += mRenderSeconds;
+        rays.primary += mRays.primary;
+        rays.secondary += mRays.secondary;
+    }
+    mRenderSeconds = seconds;
+    mRays = rays;
+}
+
+INLINE void DXRRenderer::DispatchRays(void) {
+    TileScheduler scheduler(mWidth, mHeight, mTileSize, mThreadCount);
+    mWorkerRays.assign(mThreadCount, RayStats());
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    threads.reserve(mThreadCount);
+    for (int w = 0; w < mThreadCount; ++w) {
+        threads.emplace_back(&DXRRenderer::WorkerMain, this, w, std::ref(scheduler));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    mRenderSeconds = elapsed.count();
+
+    mRays = RayStats();
+    for (auto &rays : mWorkerRays) {
+        mRays.primary += rays.primary;
+        mRays.secondary += rays.secondary;
+    }
+}
+
+INLINE void DXRRenderer::WorkerMain(int worker, TileScheduler &scheduler) {
+    RayStats before = RayStats::Thread();
+    bool accumulate = mSettings.enableAccumulate && mSceneConsts.accumCount;
+
+    Tile tile;
+    while (scheduler.Next(worker, tile)) {
+        for (int y = tile.y; y < tile.y + tile.height; ++y) {
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                // tiles never overlap, the render target needs no lock
+                XMFLOAT4 &target = mRenderTarget[size_t(y) * mWidth + x];
+                XMVECTOR color = XMVectorSetW(RayGener(x, y), 1.0f);
+                XMStoreFloat4(&target, accumulate ? XMLoadFloat4(&target) + color : color);
+            }
+        }
+    }
+
+    const RayStats &after = RayStats::Thread();
+    mWorkerRays[worker].primary = after.primary - before.primary;
+    mWorkerRays[worker].secondary = after.secondary - before.secondary;
+}
+
+INLINE Ray DXRRenderer::PinholdCameraRay(float pixelX, float pixelY) const {
+    float ndcX = 2.0f * pixelX - 1.0f;
+    float ndcY = -2.0f * pixelY + 1.0f;
+    XMVECTOR direction = ndcX * XMLoadFloat4(&mCameraConsts.u) + ndcY * XMLoadFloat4(&mCameraConsts.v) + XMLoadFloat4(&mCameraConsts.w);
+    return Ray(XMVectorSetW(XMLoadFloat4(&mCameraConsts.position), 0.0f), XMVector3Normalize(XMVectorSetW(direction, 0.0f)));
+}
+
+INLINE Ray DXRRenderer::LensCameraRay(float pixelX, float pixelY, uint32_t &randSeed) const {
+    float ndcX = 2.0f * pixelX - 1.0f;
+    float ndcY = -2.0f * pixelY + 1.0f;
+    XMVECTOR u = XMVectorSetW(XMLoadFloat4(&mCameraConsts.u), 0.0f);
+    XMVECTOR v = XMVectorSetW(XMLoadFloat4(&mCameraConsts.v), 0.0f);
+    XMVECTOR w = XMLoadFloat4(&mCameraConsts.w);
+    XMVECTOR position = XMVectorSetW(XMLoadFloat4(&mCameraConsts.position), 0.0f);
+
+    XMVECTOR rayDir = XMVectorSetW(ndcX * u + ndcY * v + w, 0.0f);
+    rayDir /= XMVectorGetX(XMVector4Length(w));
+
+    XMVECTOR focalPoint = position + mCameraConsts.focalLength * rayDir;
+
+    // point on the lens in polar coordinates
+    float angle = 2.0f * XM_PI * Dxr::NextRand(randSeed);
+    float radius = mCameraConsts.lensRadius * Dxr::NextRand(randSeed);
+
+    XMVECTOR origin = position + (std::cos(angle) * radius) * XMVector3Normalize(u) + (std::sin(angle) * radius) * XMVector3Normalize(v);
+    return Ray(origin, XMVector3Normalize(focalPoint - origin));
+}
+
+INLINE XMVECTOR DXRRenderer::RayGener(uint32_t x, uint32_t y) const {
+    uint32_t randSeed = Dxr::InitRand(x + y * mWidth, mSceneConsts.frameSeed);
+
+    float pixelX = (x + 0.5f) / mWidth;
+    float pixelY = (y + 0.5f) / mHeight;
+    if (mSettings.enableJitterCamera) {
+        pixelX += mCameraConsts.jitter.x / mWidth;
+        pixelY += mCameraConsts.jitter.y / mHeight;
+    }
+
+    Ray ray = mSettings.enableLensCamera ? LensCameraRay(pixelX, pixelY, randSeed) : PinholdCameraRay(pixelX, pixelY);
+
+    ++RayStats::Thread().primary;
+    Dxr::RayPayload payload = { XMVectorZero(), randSeed, 0 };
+    TraceRay(ray, payload);
+    return payload.color;
+}
+
+// the seed goes into the payload by value, so the caller's stream does not see what the
+// indirect ray drew, as on the GPU
+inline XMVECTOR DXRRenderer::IndirectRayGen(const XMVECTOR &origin, const XMVECTOR &direction, uint32_t seed, uint32_t depth) const {
+    Ray ray(origin, XMVector3Normalize(direction));
+
+    ++RayStats::Thread().secondary;
+    Dxr::RayPayload payload = { XMVectorZero(), seed, depth };
+    TraceRay(ray, payload);
+    return payload.color;
+}
+
+inline void DXRRenderer::TraceRay(const Ray &ray, Dxr::RayPayload &payload) const {
+    Hitable::Record record;
+    if (mScene.TraceRay(ray, TMin, TMax, record)) {
+        ClosestHit(ray, record, payload);
+    } else {
+        Miss(ray, payload);
+    }
+}
+
+INLINE void DXRRenderer::Miss(const Ray &ray, Dxr::RayPayload &payload) const {
+    payload.color = EnvironmentColor(ray.Direction());
+}
+
+inline void DXRRenderer::ClosestHit(const Ray &ray, const Hitable::Record &record, Dxr::RayPayload &payload) const {
+    if (payload.depth >= mSceneConsts.maxRayDepth) {
+        return;
+    }
+
+    Dxr::HitSample hs;
+    mScene.EvaluateHit(ray, record, hs);
+
+    XMVECTOR incoming = XMVectorZero();
+    for (uint32_t i = 0; i < mSceneConsts.sampleCount; ++i) {
+        incoming += ScatterRay(payload.seed, payload.depth, ray, hs);
+    }
+    incoming /= float(mSceneConsts.sampleCount);
+
+    payload.color += incoming;
+}
+
+INLINE XMVECTOR DXRRenderer::EnvironmentColor(const XMVECTOR &dir) const {
+    if (mSettings.enableEnvironmentMap && mScene.Environment()) {
+        return XMVectorSetW(mScene.Environment()->SampleLevel(Dxr::DirToLatLong(dir)), 0.0f);
+    } else {
+        return XMVectorSetW(XMLoadFloat4(&mSceneConsts.bgColor), 0.0f);
+    }
+}
+
+inline XMVECTOR DXRRenderer::ScatterRay(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const {
+    switch (hs.matType) {
+        case Dxr::LambertianMat:    return LambertianScatter(randSeed, rayDepth, hs);
+        case Dxr::MetalMat:         return MetalScatter(randSeed, rayDepth, ray, hs);
+        case Dxr::DielectricMat:    return DielectricScatter(randSeed, rayDepth, ray, hs);
+        default:                    return XMVectorZero();
+    }
+}
+
+inline XMVECTOR DXRRenderer::LambertianScatter(uint32_t &randSeed, uint32_t rayDepth, const Dxr::HitSample &hs) const {
+    XMVECTOR L = Dxr::UniformHemisphereSample(randSeed, hs.normal);
+    XMVECTOR intensity = hs.albedo * IndirectRayGen(hs.position, L, randSeed, rayDepth + 1);
+    return hs.emissive + intensity;
+}
+
+inline XMVECTOR DXRRenderer::MetalScatter(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const {
+    XMVECTOR R = XMVector3Reflect(ray.Direction(), hs.normal);
+    XMVECTOR L = XMVector3Normalize(R + Dxr::UniformHemisphereSample(randSeed, hs.normal) * hs.roughness);
+    XMVECTOR intensity = XMVectorZero();
+    if (XMVectorGetX(XMVector3Dot(hs.normal, L)) > 0.0f) {
+        intensity = hs.albedo * IndirectRayGen(hs.position, L, randSeed, rayDepth + 1);
+    }
+    return hs.emissive + intensity;
+}
+
+inline XMVECTOR DXRRenderer::DielectricScatter(uint32_t &randSeed, uint32_t rayDepth, const Ray &ray, const Dxr::HitSample &hs) const {
+    XMVECTOR outwardNormal;
+    float refractivity;
+    float cosine;
+    XMVECTOR direction = ray.Direction();
+    float IDotN = XMVectorGetX(XMVector3Dot(direction, hs.normal));
+    if (IDotN > 0.0f) {
+        outwardNormal = -hs.normal;
+        refractivity = hs.refractivity;
+        cosine = refractivity * IDotN;
+    } else {
+        outwardNormal = hs.normal;
+        refractivity = 1.0f / hs.refractivity;
+        cosine = -IDotN;
+    }
+
+    // zero on total internal reflection, like HLSL refract
+    XMVECTOR refracted = XMVector3Refract(direction, outwardNormal, refractivity);
+
+    float reflectPercentage;
+    if (XMVectorGetX(XMVector3Dot(refracted, refracted)) < 0.0001f) {
+        reflectPercentage = 1.0f;
+    } else {
+        reflectPercentage = Dxr::Schlick(cosine, hs.refractivity);
+    }
+
+    XMVECTOR intensity;
+    if (Dxr::NextRand(randSeed) < reflectPercentage) {
+        XMVECTOR reflected = XMVector3Reflect(direction, hs.normal);
+        intensity = hs.albedo * IndirectRayGen(hs.position, reflected, randSeed, rayDepth + 1);
+    } else {
+        intensity = hs.albedo * IndirectRayGen(hs.position, refracted, randSeed, rayDepth + 1);
+    }
+    return hs.emissive + intensity;
+}
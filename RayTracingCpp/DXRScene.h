@@ -0,0 +1,225 @@
+#pragma once
+
+#include "DXRShading.h"
+#include "DXRTexture.h"
+#include "BVHNode.h"
+#include "TriangleBatch.h"
+#include "Framework/Utils/Model.h"
+
+// Everything the DXR path tracer binds, on the CPU: the shared vertex and index
+// buffers, one Geometry and Material per InstanceID, the lights, the textures and the
+// acceleration structure. PtExample builds a BLAS per geometry under a TLAS of identity
+// instances; here all of them go into one BVH of TriangleBatches whose triangles carry
+// their InstanceID, which traces the same and saves the instance hop.
+class DXRScene {
+public:
+    DXRScene(const std::vector<Dxr::Vertex> &vertices, const std::vector<uint32_t> &indices);
+    ~DXRScene(void) {
+        for (auto batch : mBatches) {
+            delete batch;
+        }
+    }
+
+    // Returns the InstanceID. Like a geometry without D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE,
+    // one that is not opaque runs the alpha test of the any hit shaders.
+    uint32_t AddGeometry(const Dxr::Geometry &geometry, const Dxr::Material &material, bool opaque);
+    INLINE void AddLight(const Dxr::Light &light) { mLights.push_back(light); }
+    // the index materials refer to; takes ownership, nullptr keeps the slot empty
+    INLINE uint32_t AddTexture(DXRTexture *texture) {
+        mTextures.emplace_back(texture);
+        return static_cast<uint32_t>(mTextures.size() - 1);
+    }
+    INLINE void SetEnvironment(DXRTexture *texture) { mEnvTexture.reset(texture); }
+    // the acceleration structure over every geometry added so far
+    void Build(int maxLeafSize = 2);
+
+    INLINE uint32_t GeometryCount(void) const { return static_cast<uint32_t>(mGeometries.size()); }
+    INLINE uint32_t TriangleCount(void) const { return static_cast<uint32_t>(mAttributes.materials.size()); }
+    INLINE uint32_t LightCount(void) const { return static_cast<uint32_t>(mLights.size()); }
+    INLINE const Dxr::Light & Light(uint32_t index) const { return mLights[index]; }
+    INLINE const DXRTexture * Environment(void) const { return mEnvTexture.get(); }
+    INLINE bool BoundingBox(AABB &box) const { return mBVH && mBVH->BoundingBox(box); }
+
+    // TraceRay with RAY_FLAG_CULL_BACK_FACING_TRIANGLES. record.matIndex is the InstanceID,
+    // record.primIndex the triangle in the index buffer.
+    INLINE bool TraceRay(const Ray &ray, float tMin, float tMax, Hitable::Record &record) const {
+        return mBVH->Hit(ray, tMin, tMax, record);
+    }
+
+    // EvaluateHit of Shading.hlsli for the hit in record
+    void EvaluateHit(const Ray &ray, const Hitable::Record &record, Dxr::HitSample &hs) const;
+    // AlphaTestFailed of Shading.hlsli
+    bool AlphaTestFailed(float threshold, uint32_t instance, uint32_t triangle, float u, float v) const;
+
+    // What PtExample::BuildGeometry and BuildAccelerationStructure upload for a scene: a
+    // Lambertian material per shape with the textures and factors of its Utils material,
+    // the textures of the scene and the one directional light.
+    static DXRScene * Create(const Utils::Scene &scene);
+
+private:
+    static bool AnyHit(const void *context, uint32_t triangle, float u, float v);
+
+    INLINE XMVECTOR SampleTexture(uint32_t texture, const XMFLOAT2 &uv, const XMVECTOR &fallback) const {
+        // a texture the CPU can not read falls back to the constant of the material
+        if (texture == Dxr::TexIndexInvalid || texture >= mTextures.size() || !mTextures[texture]) {
+            return fallback;
+        }
+        return mTextures[texture]->SampleLevel(uv);
+    }
+
+    std::vector<Dxr::Vertex>                    mVertices;
+    std::vector<Dxr::Geometry>                  mGeometries;
+    std::vector<Dxr::Material>                  mMaterials;
+    std::vector<uint8_t>                        mOpaque;
+    std::vector<Dxr::Light>                     mLights;
+    std::vector<std::unique_ptr<DXRTexture>>    mTextures;
+    std::unique_ptr<DXRTexture>                 mEnvTexture;
+    TriangleAttributes                          mAttributes;
+    std::vector<Hitable *>                      mBatches;
+    std::unique_ptr<BVHNode>                    mBVH;
+};
+
+INLINE DXRScene::DXRScene(const std::vector<Dxr::Vertex> &vertices, const std::vector<uint32_t> &indices)
+: mVertices(vertices)
+{
+    mAttributes.indices = indices;
+    mAttributes.normals.resize(mVertices.size());
+    for (size_t i = 0; i < mVertices.size(); ++i) {
+        mAttributes.normals[i] = mVertices[i].normal;
+    }
+    mAttributes.materials.assign(indices.size() / 3, 0);
+    mAttributes.alphaTested.assign(indices.size() / 3, 0);
+    mAttributes.anyHit = AnyHit;
+    mAttributes.anyHitContext = this;
+    mAttributes.cullBackFaces = true;
+}
+
+INLINE uint32_t DXRScene::AddGeometry(const Dxr::Geometry &geometry, const Dxr::Material &material, bool opaque) {
+    uint32_t instance = static_cast<uint32_t>(mGeometries.size());
+    mGeometries.push_back(geometry);
+    mMaterials.push_back(material);
+    mOpaque.push_back(opaque ? 1 : 0);
+
+    uint32_t first = geometry.indexOffset / 3;
+    uint32_t last = std::min(first + geometry.indexCount / 3, TriangleCount());
+    for (uint32_t tri = first; tri < last; ++tri) {
+        mAttributes.materials[tri] = instance;
+        mAttributes.alphaTested[tri] = opaque ? 0 : 1;
+    }
+    return instance;
+}
+
+INLINE void DXRScene::Build(int maxLeafSize) {
+    for (auto batch : mBatches) {
+        delete batch;
+    }
+    mBatches.clear();
+
+    std::vector<XMFLOAT3> positions(mVertices.size());
+    for (size_t i = 0; i < mVertices.size(); ++i) {
+        positions[i] = mVertices[i].position;
+    }
+    // only triangles some geometry covers are in the TLAS
+    std::vector<uint32_t> triangles;
+    triangles.reserve(TriangleCount());
+    for (auto &geometry : mGeometries) {
+        uint32_t first = geometry.indexOffset / 3;
+        uint32_t last = std::min(first + geometry.indexCount / 3, TriangleCount());
+        for (uint32_t tri = first; tri < last; ++tri) {
+            triangles.push_back(tri);
+        }
+    }
+    TriangleBatch::Partition(&mAttributes, positions.data(), triangles.data(), static_cast<int>(triangles.size()), mBatches);
+    mBVH.reset(new BVHNode(mBatches.data(), static_cast<int>(mBatches.size()), maxLeafSize));
+}
+
+INLINE bool DXRScene::AnyHit(const void *context, uint32_t triangle, float u, float v) {
+    const DXRScene *scene = static_cast<const DXRScene *>(context);
+    return !scene->AlphaTestFailed(Dxr::AlphaThreshold, scene->mAttributes.materials[triangle], triangle, u, v);
+}
+
+INLINE bool DXRScene::AlphaTestFailed(float threshold, uint32_t instance, uint32_t triangle, float u, float v) const {
+    const uint32_t *idx = &mAttributes.indices[triangle * 3];
+    const Dxr::Material &mat = mMaterials[instance];
+
+    XMVECTOR hitTexCoord = Dxr::BarycentricLerp(XMLoadFloat2(&mVertices[idx[0]].texCoord), XMLoadFloat2(&mVertices[idx[1]].texCoord), XMLoadFloat2(&mVertices[idx[2]].texCoord), u, v);
+    XMFLOAT2 uv;
+    XMStoreFloat2(&uv, hitTexCoord);
+    XMVECTOR baseColor = SampleTexture(mat.albedoTex, uv, XMLoadFloat4(&mat.albedoColor));
+    return XMVectorGetW(baseColor) < threshold;
+}
+
+INLINE void DXRScene::EvaluateHit(const Ray &ray, const Hitable::Record &record, Dxr::HitSample &hs) const {
+    const uint32_t *idx = &mAttributes.indices[record.primIndex * 3];
+    const Dxr::Material &mat = mMaterials[record.matIndex];
+
+    const Dxr::Vertex &vert0 = mVertices[idx[0]];
+    const Dxr::Vertex &vert1 = mVertices[idx[1]];
+    const Dxr::Vertex &vert2 = mVertices[idx[2]];
+
+    // position
+    hs.position = ray.PointAt(record.t);
+
+    // texcoord
+    XMFLOAT2 hitTexCoord;
+    XMStoreFloat2(&hitTexCoord, Dxr::BarycentricLerp(XMLoadFloat2(&vert0.texCoord), XMLoadFloat2(&vert1.texCoord), XMLoadFloat2(&vert2.texCoord), record.u, record.v));
+
+    // normal, the instances have identity transforms
+    XMVECTOR hitNormal = Dxr::BarycentricLerp(XMLoadFloat3(&vert0.normal), XMLoadFloat3(&vert1.normal), XMLoadFloat3(&vert2.normal), record.u, record.v);
+
+    if (mat.normalTex != Dxr::TexIndexInvalid) {
+        XMVECTOR hitTangent = Dxr::BarycentricLerp(XMLoadFloat3(&vert0.tangent), XMLoadFloat3(&vert1.tangent), XMLoadFloat3(&vert2.tangent), record.u, record.v);
+        XMVECTOR hitBitangent = Dxr::BarycentricLerp(XMLoadFloat3(&vert0.bitangent), XMLoadFloat3(&vert1.bitangent), XMLoadFloat3(&vert2.bitangent), record.u, record.v);
+
+        XMVECTOR normal = SampleTexture(mat.normalTex, hitTexCoord, XMVectorSet(0.5f, 0.5f, 1.0f, 1.0f));
+        normal = XMVector3Normalize(normal * 2.0f - XMVectorSplatOne());
+        // mul(transpose(TBN), normal)
+        normal = XMVector3Normalize(hitTangent) * XMVectorGetX(normal) + XMVector3Normalize(hitBitangent) * XMVectorGetY(normal) + XMVector3Normalize(hitNormal) * XMVectorGetZ(normal);
+        hs.normal = XMVector3Normalize(normal);
+    } else {
+        hs.normal = XMVector3Normalize(hitNormal);
+    }
+
+    hs.matType = mat.type;
+
+    hs.albedo = SampleTexture(mat.albedoTex, hitTexCoord, XMLoadFloat4(&mat.albedoColor));
+    hs.emissive = XMLoadFloat3(&mat.emissiveColor);
+    hs.roughness = mat.roughnessTex != Dxr::TexIndexInvalid ? XMVectorGetX(SampleTexture(mat.roughnessTex, hitTexCoord, XMVectorReplicate(mat.roughness))) : mat.roughness;
+    hs.refractivity = mat.refractivity;
+}
+
+INLINE DXRScene * DXRScene::Create(const Utils::Scene &scene) {
+    // Utils::Scene::Vertex and Vertex are the same 56 bytes, uploaded as they are
+    static_assert(sizeof(Utils::Scene::Vertex) == sizeof(Dxr::Vertex), "vertex layouts differ");
+    std::vector<Dxr::Vertex> vertices(scene.mVertices.size());
+    if (!vertices.empty()) {
+        memcpy(vertices.data(), scene.mVertices.data(), vertices.size() * sizeof(Dxr::Vertex));
+    }
+    DXRScene *dxrScene = new DXRScene(vertices, scene.mIndices);
+
+    for (auto &shape : scene.mShapes) {
+        auto &mat = scene.mMaterials[shape.materialIndex];
+        Dxr::Geometry geometry = {};
+        geometry.indexOffset = shape.indexOffset;
+        geometry.indexCount = shape.indexCount;
+        Dxr::Material material = {};
+        material.type = Dxr::LambertianMat;
+        material.normalTex = mat.normalTexture;
+        material.albedoTex = mat.baseTexture;
+        material.roughnessTex = mat.roughnessTexture;
+        material.albedoColor = mat.baseFactor;
+        material.emissiveColor = mat.emissiveFactor;
+        material.roughness = 0.1f;
+        dxrScene->AddGeometry(geometry, material, mat.isOpacity);
+    }
+
+    for (auto image : scene.mImages) {
+        dxrScene->AddTexture(image ? DXRTexture::Create(*image) : nullptr);
+    }
+
+    Dxr::Light light = { DirectLight, 0.0f, 0.0f, 0.0f, { 0.0f, 0.0f, 0.0f }, { 0.2f, -1.0f, 0.15f }, { 1.0f, 1.0f, 1.0f } };
+    dxrScene->AddLight(light);
+
+    dxrScene->Build();
+    return dxrScene;
+}
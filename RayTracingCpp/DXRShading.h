@@ -0,0 +1,150 @@
+#pragma once
+
+#include "DXRTypes.h"
+#include "Light.h"
+
+// The scene independent functions of Shading.hlsli and PathTrace.hlsli, line for line
+// in C++ so the CPU backend draws the same random numbers and directions as the GPU.
+namespace Dxr {
+
+/**Random Functions***********************************************************/
+
+// Generates a seed for a random number generator from 2 inputs plus a backoff
+INLINE uint32_t InitRand(uint32_t val0, uint32_t val1, uint32_t backoff = 16) {
+    uint32_t v0 = val0, v1 = val1, s0 = 0;
+    for (uint32_t n = 0; n < backoff; n++) {
+        s0 += 0x9e3779b9;
+        v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+        v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+    }
+    return v0;
+}
+
+// Takes our seed, updates it, and returns a pseudorandom float in [0..1]
+INLINE float NextRand(uint32_t &s) {
+    s = (1664525u * s + 1013904223u);
+    return float(s & 0x00FFFFFF) / float(0x01000000);
+}
+
+/**Hemi-Sphere Sampler***********************************************************/
+
+// a vector perpendicular to u, "Efficient Construction of Perpendicular Vectors Without Branching"
+INLINE XMVECTOR PerpendicularVector(const XMVECTOR &u) {
+    XMFLOAT3 a;
+    XMStoreFloat3(&a, XMVectorAbs(u));
+    uint32_t xm = ((a.x - a.y) < 0 && (a.x - a.z) < 0) ? 1 : 0;
+    uint32_t ym = (a.y - a.z) < 0 ? (1 ^ xm) : 0;
+    uint32_t zm = 1 ^ (xm | ym);
+    return XMVector3Cross(u, XMVectorSet(float(xm), float(ym), float(zm), 0.0f));
+}
+
+// a cosine weighted random vector around hitNorm
+INLINE XMVECTOR CosHemisphereSample(uint32_t &randSeed, const XMVECTOR &hitNorm) {
+    float randX = NextRand(randSeed);
+    float randY = NextRand(randSeed);
+
+    XMVECTOR bitangent = PerpendicularVector(hitNorm);
+    XMVECTOR tangent = XMVector3Cross(bitangent, hitNorm);
+    float r = std::sqrt(randX);
+    float phi = 2.0f * XM_PI * randY;
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + hitNorm * std::sqrt(1 - randX);
+}
+
+// a uniformly distributed random vector around hitNorm
+INLINE XMVECTOR UniformHemisphereSample(uint32_t &randSeed, const XMVECTOR &hitNorm) {
+    float randX = NextRand(randSeed);
+    float randY = NextRand(randSeed);
+
+    XMVECTOR bitangent = PerpendicularVector(hitNorm);
+    XMVECTOR tangent = XMVector3Cross(bitangent, hitNorm);
+    float r = std::sqrt(std::max(0.0f, 1.0f - randX * randX));
+    float phi = 2.0f * XM_PI * randY;
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + hitNorm * randX;
+}
+
+/**Light Sampler***********************************************************/
+
+INLINE void EvaluateDirectLight(const Light &light, const XMVECTOR &hitPos, LightSample &ls) {
+    ls.L = -XMVector3Normalize(XMLoadFloat3(&light.direction));
+    ls.diffuse = XMLoadFloat3(&light.intensity);
+    ls.specular = ls.diffuse;
+    ls.position = hitPos + ls.L * 1e+30f;
+}
+
+INLINE void EvaluatePointLight(const Light &light, const XMVECTOR &hitPos, LightSample &ls) {
+    ls.position = XMLoadFloat3(&light.position);
+
+    ls.L = ls.position - hitPos;
+    // Avoid NaN
+    float distSquared = XMVectorGetX(XMVector3Dot(ls.L, ls.L));
+    ls.L = (distSquared > 1e-5f) ? XMVector3Normalize(ls.L) : XMVectorZero();
+
+    // The 0.01 is to avoid infs when the light source is close to the shading point
+    float falloff = 1 / (0.0001f + distSquared);
+
+    ls.diffuse = XMLoadFloat3(&light.intensity) * falloff;
+    ls.specular = ls.diffuse;
+}
+
+INLINE void EvaluateSpotLight(const Light &light, const XMVECTOR &hitPos, LightSample &ls) {
+    ls.position = XMLoadFloat3(&light.position);
+
+    ls.L = ls.position - hitPos;
+    // Avoid NaN
+    float distSquared = XMVectorGetX(XMVector3Dot(ls.L, ls.L));
+    ls.L = (distSquared > 1e-5f) ? XMVector3Normalize(ls.L) : XMVectorZero();
+
+    // The 0.01 is to avoid infs when the light source is close to the shading point
+    float falloff = 1 / (0.0001f + distSquared);
+
+    // Calculate the falloff for spot-lights
+    float cosTheta = XMVectorGetX(XMVector3Dot(-ls.L, XMLoadFloat3(&light.direction)));
+    float theta = std::acos(cosTheta);
+    if (theta > light.openAngle * 0.5f) {
+        falloff = 0;
+    } else if (light.penumbraAngle > 0) {
+        float deltaAngle = light.openAngle - theta;
+        falloff *= std::min(std::max((deltaAngle - light.penumbraAngle) / light.penumbraAngle, 0.0f), 1.0f);
+    }
+
+    ls.diffuse = XMLoadFloat3(&light.intensity) * falloff;
+    ls.specular = ls.diffuse;
+}
+
+INLINE void EvaluateLight(const Light &light, const XMVECTOR &hitPos, LightSample &ls) {
+    switch (light.type) {
+        case DirectLight:   return EvaluateDirectLight(light, hitPos, ls);
+        case PointLight:    return EvaluatePointLight(light, hitPos, ls);
+        case SpotLight:     return EvaluateSpotLight(light, hitPos, ls);
+        default:            return;
+    }
+}
+
+/**Others Utils***********************************************************/
+
+// hit attribute from the vertex attributes and the DXR barycentrics u, v
+INLINE XMVECTOR BarycentricLerp(const XMVECTOR &v0, const XMVECTOR &v1, const XMVECTOR &v2, float u, float v) {
+    return v0 + (v1 - v0) * u + (v2 - v0) * v;
+}
+
+// relative luminance of linear RGB in the ITU-R BT.709 color space
+INLINE float Luminance(const XMVECTOR &rgb) {
+    return XMVectorGetX(XMVector3Dot(rgb, XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f)));
+}
+
+// (u, v) of a world space direction in a latitude-longitude map
+INLINE XMFLOAT2 DirToLatLong(const XMVECTOR &dir) {
+    XMFLOAT3 p;
+    XMStoreFloat3(&p, XMVector3Normalize(dir));
+    float u = (1.0f + std::atan2(p.x, -p.z) * XM_1DIVPI) * 0.5f;
+    float v = std::acos(p.y) * XM_1DIVPI;
+    return XMFLOAT2(u, 1.0f - v);
+}
+
+INLINE float Schlick(float cosine, float refIdx) {
+    float r0 = (1.0f - refIdx) / (1.0f + refIdx);
+    r0 = r0 * r0;
+    return r0 + (1.0f - r0) * std::pow((1.0f - cosine), 5.0f);
+}
+
+}
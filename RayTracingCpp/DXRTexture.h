@@ -0,0 +1,92 @@
+#pragma once
+
+#include <dxgiformat.h>
+#include "Framework/Utils/Image.h"
+
+// A texture of the DXR path tracer on the CPU: level 0 of a Utils::Image, kept in its
+// own format and widened on fetch the way a Texture2D<float4> view reads it (missing
+// channels 0, alpha 1). Sampled like gSampler: bilinear with wrapped coordinates.
+class DXRTexture {
+public:
+    // nullptr for a format the GPU path can not upload either
+    static DXRTexture * Create(const Utils::Image &image);
+    ~DXRTexture(void) {
+
+    }
+
+    INLINE int Width(void) const { return mWidth; }
+    INLINE int Height(void) const { return mHeight; }
+
+    // SampleLevel(gSampler, uv, 0)
+    XMVECTOR SampleLevel(const XMFLOAT2 &uv) const;
+    // texel x, y of level 0, Load of a Texture2D<float4>
+    XMVECTOR Fetch(int x, int y) const;
+
+private:
+    DXRTexture(const Utils::Image &image, uint32_t bytesPerPixel);
+
+    int                     mWidth;
+    int                     mHeight;
+    Utils::Image::Format    mFormat;
+    uint32_t                mBytesPerPixel;
+    std::vector<uint8_t>    mTexels;
+};
+
+INLINE DXRTexture::DXRTexture(const Utils::Image &image, uint32_t bytesPerPixel)
+: mWidth(static_cast<int>(image.GetWidth()))
+, mHeight(static_cast<int>(image.GetHeight()))
+, mFormat(image.GetFormat())
+, mBytesPerPixel(bytesPerPixel)
+{
+    const uint8_t *pixels = static_cast<const uint8_t *>(image.GetPixels());
+    mTexels.assign(pixels, pixels + size_t(mWidth) * mHeight * mBytesPerPixel);
+}
+
+INLINE DXRTexture * DXRTexture::Create(const Utils::Image &image) {
+    static const uint32_t bytesPerPixel[] = { 0, 1, 2, 4, 12, 16 };
+    uint32_t format = image.GetFormat();
+    if (format >= _countof(bytesPerPixel) || bytesPerPixel[format] == 0 || image.GetWidth() == 0 || image.GetHeight() == 0) {
+        return nullptr;
+    }
+    return new DXRTexture(image, bytesPerPixel[format]);
+}
+
+INLINE XMVECTOR DXRTexture::Fetch(int x, int y) const {
+    const uint8_t *texel = &mTexels[(size_t(y) * mWidth + x) * mBytesPerPixel];
+    const float unorm = 1.0f / 255.0f;
+    switch (mFormat) {
+        case Utils::Image::R8:
+            return XMVectorSet(texel[0] * unorm, 0.0f, 0.0f, 1.0f);
+        case Utils::Image::R8G8:
+            return XMVectorSet(texel[0] * unorm, texel[1] * unorm, 0.0f, 1.0f);
+        case Utils::Image::R8G8B8A8:
+            return XMVectorSet(texel[0] * unorm, texel[1] * unorm, texel[2] * unorm, texel[3] * unorm);
+        case Utils::Image::R32G32B32_FLOAT:
+            return XMVectorSetW(XMLoadFloat3(reinterpret_cast<const XMFLOAT3 *>(texel)), 1.0f);
+        default:
+            return XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(texel));
+    }
+}
+
+INLINE XMVECTOR DXRTexture::SampleLevel(const XMFLOAT2 &uv) const {
+    // texel centres sit at half integers
+    float x = uv.x * mWidth - 0.5f;
+    float y = uv.y * mHeight - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float ax = x - fx;
+    float ay = y - fy;
+
+    auto Wrap = [](float coord, int size) {
+        int i = static_cast<int>(std::fmod(coord, float(size)));
+        return i < 0 ? i + size : i;
+    };
+    int x0 = Wrap(fx, mWidth);
+    int y0 = Wrap(fy, mHeight);
+    int x1 = x0 + 1 < mWidth ? x0 + 1 : 0;
+    int y1 = y0 + 1 < mHeight ? y0 + 1 : 0;
+
+    XMVECTOR top = XMVectorLerp(Fetch(x0, y0), Fetch(x1, y0), ax);
+    XMVECTOR bottom = XMVectorLerp(Fetch(x0, y1), Fetch(x1, y1), ax);
+    return XMVectorLerp(top, bottom, ay);
+}
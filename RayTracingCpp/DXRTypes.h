@@ -0,0 +1,50 @@
+#pragma once
+
+// The structures the DXR path tracer shares between PtExample and its shaders, taken
+// from the same header so the two can never drift apart. They live in a namespace of
+// their own: Material and Light would clash with the ones of the CPU tracer.
+namespace Dxr {
+#include "PathTracingDXR/Shaders/PathTrace/SharedTypes.h"
+}
+
+// the HLSL type names SharedTypes.h maps onto DirectXMath
+#undef float4
+#undef float3
+#undef float2
+#undef float4x4
+#undef uint4
+#undef uint
+
+namespace Dxr {
+
+// constants of PtMain.hlsl
+static constexpr uint32_t TexIndexInvalid = 0xFFFFFFFF;
+static constexpr float AlphaThreshold = 0.5f;
+
+// What EvaluateHit gathers about the closest hit, HitSample of PtMain.hlsl.
+struct HitSample {
+    XMVECTOR    position;
+    XMVECTOR    normal;
+    XMVECTOR    albedo;
+    XMVECTOR    emissive;
+    uint32_t    matType;
+    float       roughness;
+    float       refractivity;
+};
+
+// LightSample of PtMain.hlsl, what EvaluateLight gives for one light.
+struct LightSample {
+    XMVECTOR    L;
+    XMVECTOR    diffuse;
+    XMVECTOR    specular;
+    XMVECTOR    position;
+};
+
+// GenericRayPayload of PtMain.hlsl, shared by primary and indirect rays.
+struct RayPayload {
+    XMVECTOR    color;
+    uint32_t    seed;
+    uint32_t    depth;
+};
+
+}
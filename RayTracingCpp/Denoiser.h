@@ -0,0 +1,252 @@
+#pragma once
+
+#include "SIMD.h"
+#include "FrameBuffer.h"
+#include "FeatureBuffer.h"
+
+// Edge stopping parameters of the Denoiser. Each term is a distance between the centre
+// pixel and a tap, and the tap weight falls off as exp(-sum of the terms).
+struct DenoiseSettings {
+    int     iterations;     // a-trous passes, the footprint spans 4 * 2^(iterations - 1) + 1 pixels
+    float   sigmaLuminance; // luminance difference, in standard errors of the centre estimate
+    float   sigmaNormal;    // length of the normal difference
+    float   sigmaDepth;     // depth difference relative to the centre depth, per pixel of step
+    float   sigmaAlbedo;    // length of the albedo difference
+
+    INLINE static DenoiseSettings Default(void) {
+        return { 5, 4.0f, 0.25f, 0.1f, 0.1f };
+    }
+};
+
+// Edge-avoiding a-trous wavelet filter over an accumulated frame, guided by the first
+// hit features of a FeatureBuffer. Colour is divided by the albedo first, so texture and
+// material edges survive, and put back after the last pass. Every pass runs a 5x5 B3
+// spline kernel whose taps lie step = 2^pass pixels apart; the variance of every pixel
+// is filtered along with its colour and drives the luminance term of the next pass.
+// Planes are stored one float per pixel with a border of empty pixels as wide as the
+// largest step reaches, so SIMD_WIDTH neighbouring pixels load with one instruction and
+// no tap needs a bounds check. Rows are shared out to a pool of threads per pass.
+class Denoiser {
+public:
+    Denoiser(int width, int height, int threadCount = 0);
+    ~Denoiser(void) {
+
+    }
+
+    INLINE DenoiseSettings & Settings(void) { return mSettings; }
+    INLINE int ThreadCount(void) const { return mThreadCount; }
+
+    // pixels receives the filtered average radiance in xyz and the sample count in w,
+    // rows counted from the top like the frame
+    void Run(const FrameBuffer &frame, const FeatureBuffer &features, std::vector<XMFLOAT4> &pixels);
+
+private:
+    enum Plane {
+        ColorR, ColorG, ColorB, Variance,   // filtered, one set per ping-pong side
+        NormalX, NormalY, NormalZ, Depth, AlbedoR, AlbedoG, AlbedoB,
+        Inside,                             // 1 in the image, 0 in the border
+        PlaneCount
+    };
+
+    static constexpr int    FilteredCount = Variance + 1;
+    // below this an albedo channel is not divided out, black would blow the colour up
+    static constexpr float  MinAlbedo = 0.01f;
+    // stands in for the variance of pixels with a single sample
+    static constexpr float  MaxVariance = 1e+4f;
+
+    void Load(int y, const FrameBuffer &frame, const FeatureBuffer &features);
+    void FilterRow(int y, int step);
+    template <typename RowFunc>
+    void ParallelRows(const RowFunc &func);
+
+    INLINE float * PlaneRow(std::vector<float> *planes, Plane plane, int y) {
+        return &planes[plane][size_t(y + mBorder) * mStride + mBorder];
+    }
+
+    int                     mWidth;
+    int                     mHeight;
+    int                     mThreadCount;
+    int                     mBorder;
+    size_t                  mStride;
+    DenoiseSettings         mSettings;
+    std::vector<float>      mPlanes[PlaneCount];
+    std::vector<float>      mFiltered[FilteredCount];
+};
+
+INLINE Denoiser::Denoiser(int width, int height, int threadCount)
+: mWidth(width)
+, mHeight(height)
+, mThreadCount(threadCount)
+, mBorder(0)
+, mStride(0)
+, mSettings(DenoiseSettings::Default())
+{
+    if (mThreadCount <= 0) {
+        mThreadCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+}
+
+template <typename RowFunc>
+INLINE void Denoiser::ParallelRows(const RowFunc &func) {
+    std::atomic<int> next(0);
+    auto Worker = [&]() {
+        for (int y = next++; y < mHeight; y = next++) {
+            func(y);
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(mThreadCount - 1);
+    for (int t = 1; t < mThreadCount; ++t) {
+        threads.emplace_back(Worker);
+    }
+    Worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+INLINE void Denoiser::Run(const FrameBuffer &frame, const FeatureBuffer &features, std::vector<XMFLOAT4> &pixels) {
+    int iterations = std::max(mSettings.iterations, 0);
+    // the widest pass reaches two steps out; the extra SIMD_WIDTH lets the last block of
+    // a row load past its end
+    mBorder = iterations > 0 ? 2 << (iterations - 1) : 0;
+    mStride = size_t(mWidth) + 2 * mBorder + SIMD_WIDTH;
+    size_t size = mStride * (size_t(mHeight) + 2 * mBorder);
+    for (int p = 0; p < PlaneCount; ++p) {
+        // the border keeps weight 0 and finite values
+        mPlanes[p].assign(size, p == Depth ? 1.0f : 0.0f);
+    }
+    for (int p = 0; p < FilteredCount; ++p) {
+        mFiltered[p].assign(size, 0.0f);
+    }
+
+    ParallelRows([&](int y) { Load(y, frame, features); });
+    for (int i = 0; i < iterations; ++i) {
+        ParallelRows([&](int y) { FilterRow(y, 1 << i); });
+        for (int p = 0; p < FilteredCount; ++p) {
+            std::swap(mPlanes[p], mFiltered[p]);
+        }
+    }
+
+    pixels.resize(size_t(mWidth) * mHeight);
+    ParallelRows([&](int y) {
+        const float *r = PlaneRow(mPlanes, ColorR, y);
+        const float *g = PlaneRow(mPlanes, ColorG, y);
+        const float *b = PlaneRow(mPlanes, ColorB, y);
+        for (int x = 0; x < mWidth; ++x) {
+            const Feature &feature = features.At(x, y);
+            pixels[size_t(y) * mWidth + x] = XMFLOAT4(r[x] * std::max(feature.albedo.x, MinAlbedo), g[x] * std::max(feature.albedo.y, MinAlbedo),
+                                                      b[x] * std::max(feature.albedo.z, MinAlbedo), frame.Resolve(x, y).w);
+        }
+    });
+}
+
+INLINE void Denoiser::Load(int y, const FrameBuffer &frame, const FeatureBuffer &features) {
+    float *planes[PlaneCount];
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p] = PlaneRow(mPlanes, Plane(p), y);
+    }
+    for (int x = 0; x < mWidth; ++x) {
+        XMFLOAT4 color = frame.Resolve(x, y);
+        const Feature &feature = features.At(x, y);
+        XMFLOAT3 demodulate(std::max(feature.albedo.x, MinAlbedo), std::max(feature.albedo.y, MinAlbedo), std::max(feature.albedo.z, MinAlbedo));
+        float luminance = 0.2126f * demodulate.x + 0.7152f * demodulate.y + 0.0722f * demodulate.z;
+
+        planes[ColorR][x] = color.x / demodulate.x;
+        planes[ColorG][x] = color.y / demodulate.y;
+        planes[ColorB][x] = color.z / demodulate.z;
+        planes[Variance][x] = std::min(feature.variance / (luminance * luminance), MaxVariance);
+        planes[NormalX][x] = feature.normal.x;
+        planes[NormalY][x] = feature.normal.y;
+        planes[NormalZ][x] = feature.normal.z;
+        planes[Depth][x] = feature.depth;
+        planes[AlbedoR][x] = feature.albedo.x;
+        planes[AlbedoG][x] = feature.albedo.y;
+        planes[AlbedoB][x] = feature.albedo.z;
+        planes[Inside][x] = 1.0f;
+    }
+}
+
+INLINE void Denoiser::FilterRow(int y, int step) {
+    // B3 spline by distance in steps, and the 3x3 gaussian the variance is blurred with
+    static const float spline[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    static const float gaussian[2] = { 1.0f / 2.0f, 1.0f / 4.0f };
+
+    const float *planes[PlaneCount];
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p] = PlaneRow(mPlanes, Plane(p), y);
+    }
+    float *filtered[FilteredCount];
+    for (int p = 0; p < FilteredCount; ++p) {
+        filtered[p] = PlaneRow(mFiltered, Plane(p), y);
+    }
+    ptrdiff_t stride = static_cast<ptrdiff_t>(mStride);
+
+    SIMDFloat zero = SIMDSet1(0.0f);
+    SIMDFloat lumR = SIMDSet1(0.2126f), lumG = SIMDSet1(0.7152f), lumB = SIMDSet1(0.0722f);
+    SIMDFloat sigmaLuminance = SIMDSet1(mSettings.sigmaLuminance);
+    SIMDFloat invNormal = SIMDSet1(1.0f / (mSettings.sigmaNormal * mSettings.sigmaNormal));
+    SIMDFloat invDepthStep = SIMDSet1(1.0f / (mSettings.sigmaDepth * step));
+    SIMDFloat invAlbedo = SIMDSet1(1.0f / (mSettings.sigmaAlbedo * mSettings.sigmaAlbedo));
+    auto Tap = [&](Plane plane, ptrdiff_t offset) { return SIMDLoad(planes[plane] + offset); };
+
+    for (int x = 0; x < mWidth; x += SIMD_WIDTH) {
+        SIMDFloat r = Tap(ColorR, x), g = Tap(ColorG, x), b = Tap(ColorB, x);
+        SIMDFloat lum = SIMDAdd(SIMDAdd(SIMDMul(r, lumR), SIMDMul(g, lumG)), SIMDMul(b, lumB));
+        SIMDFloat nx = Tap(NormalX, x), ny = Tap(NormalY, x), nz = Tap(NormalZ, x);
+        SIMDFloat ar = Tap(AlbedoR, x), ag = Tap(AlbedoG, x), ab = Tap(AlbedoB, x);
+        SIMDFloat depth = Tap(Depth, x);
+
+        SIMDFloat variance = zero;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                SIMDFloat h = SIMDSet1(gaussian[std::abs(dx)] * gaussian[std::abs(dy)]);
+                variance = SIMDAdd(variance, SIMDMul(h, Tap(Variance, x + dy * stride + dx)));
+            }
+        }
+        // -1 / (sigma * standard error), the epsilon keeps converged pixels filterable
+        SIMDFloat invLuminance = SIMDDiv(SIMDSet1(-1.0f), SIMDAdd(SIMDMul(sigmaLuminance, SIMDSqrt(SIMDMax(variance, zero))), SIMDSet1(1e-4f)));
+        SIMDFloat invDepth = SIMDDiv(invDepthStep, depth);
+
+        SIMDFloat sumW = zero, sumR = zero, sumG = zero, sumB = zero, sumVar = zero;
+        for (int dy = -2; dy <= 2; ++dy) {
+            for (int dx = -2; dx <= 2; ++dx) {
+                ptrdiff_t q = x + (dy * stride + dx) * step;
+                SIMDFloat qr = Tap(ColorR, q), qg = Tap(ColorG, q), qb = Tap(ColorB, q);
+                SIMDFloat dl = SIMDSub(SIMDAdd(SIMDAdd(SIMDMul(qr, lumR), SIMDMul(qg, lumG)), SIMDMul(qb, lumB)), lum);
+                // -|dl| / (sigma * standard error)
+                SIMDFloat exponent = SIMDMul(SIMDMax(dl, SIMDSub(zero, dl)), invLuminance);
+
+                SIMDFloat dnx = SIMDSub(Tap(NormalX, q), nx), dny = SIMDSub(Tap(NormalY, q), ny), dnz = SIMDSub(Tap(NormalZ, q), nz);
+                SIMDFloat dn = SIMDAdd(SIMDAdd(SIMDMul(dnx, dnx), SIMDMul(dny, dny)), SIMDMul(dnz, dnz));
+                SIMDFloat dz = SIMDMul(SIMDSub(Tap(Depth, q), depth), invDepth);
+                SIMDFloat dar = SIMDSub(Tap(AlbedoR, q), ar), dag = SIMDSub(Tap(AlbedoG, q), ag), dab = SIMDSub(Tap(AlbedoB, q), ab);
+                SIMDFloat da = SIMDAdd(SIMDAdd(SIMDMul(dar, dar), SIMDMul(dag, dag)), SIMDMul(dab, dab));
+                exponent = SIMDSub(exponent, SIMDAdd(SIMDAdd(SIMDMul(dn, invNormal), SIMDMul(dz, dz)), SIMDMul(da, invAlbedo)));
+
+                SIMDFloat h = SIMDSet1(spline[std::abs(dx)] * spline[std::abs(dy)]);
+                SIMDFloat w = SIMDMul(SIMDMul(h, Tap(Inside, q)), SIMDExp(exponent));
+                sumW = SIMDAdd(sumW, w);
+                sumR = SIMDAdd(sumR, SIMDMul(w, qr));
+                sumG = SIMDAdd(sumG, SIMDMul(w, qg));
+                sumB = SIMDAdd(sumB, SIMDMul(w, qb));
+                sumVar = SIMDAdd(sumVar, SIMDMul(SIMDMul(w, w), Tap(Variance, q)));
+            }
+        }
+
+        // the centre tap always has weight, only lanes past the row end divide by 0
+        SIMDFloat invW = SIMDDiv(SIMDSet1(1.0f), sumW);
+        SIMDFloat results[FilteredCount] = { SIMDMul(sumR, invW), SIMDMul(sumG, invW), SIMDMul(sumB, invW), SIMDMul(sumVar, SIMDMul(invW, invW)) };
+        int count = std::min(SIMD_WIDTH, mWidth - x);
+        for (int p = 0; p < FilteredCount; ++p) {
+            if (count == SIMD_WIDTH) {
+                SIMDStore(filtered[p] + x, results[p]);
+            } else {
+                // the border right of the row has to stay as it is
+                float lanes[SIMD_WIDTH];
+                SIMDStore(lanes, results[p]);
+                std::copy(lanes, lanes + count, filtered[p] + x);
+            }
+        }
+    }
+}
@@ -1,19 +1,20 @@
 #pragma once
 
+#include "Hitable.h"
 #include "Material.h"
+#include "Random.h"
 
-class Dielectric : public Material {
+class Dielectric {
 public:
-    Dielectric(float refIdx)
-    : mRefIdx(refIdx)
-    {
-
-    }
-    ~Dielectric(void) {
-
+    INLINE static Material Create(float refIdx) {
+        Material mat = {};
+        mat.albedo = XMFLOAT3(0.90f, 0.99f, 0.99f);
+        mat.type = DielectricMat;
+        mat.refIdx = refIdx;
+        return mat;
     }
 
-    virtual bool Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter);
+    static bool Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter);
 
 private:
     INLINE static float Schlick(float cosine, float refIdx) {
@@ -21,13 +22,11 @@ private:
         r0 = r0 * r0;
         return r0 + (1.0f - r0) * std::powf((1.0f - cosine), 5.0f);
     }
-
-    float       mRefIdx; // refractive indices
 };
 
-INLINE bool Dielectric::Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter) {
+INLINE bool Dielectric::Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter) {
     XMVECTOR reflected = XMVector3Reflect(in.Direction(), record.n);
-    attenuation = {0.90f, 0.99f, 0.99f};
+    attenuation = XMLoadFloat3(&mat.albedo);
 
     XMVECTOR outwardNormal;
     float refractionIndex;
@@ -35,11 +34,11 @@ INLINE bool Dielectric::Scatter(const Ray &in, const Hitable::Record &record, XM
     float IDotN = XMVectorGetX(XMVector3Dot(in.Direction(), record.n));
     if (IDotN > 0.0f) {
         outwardNormal = -record.n;
-        refractionIndex = mRefIdx;
-        cosine = mRefIdx * IDotN;
+        refractionIndex = mat.refIdx;
+        cosine = mat.refIdx * IDotN;
     } else {
         outwardNormal = record.n;
-        refractionIndex = 1.0f / mRefIdx;
+        refractionIndex = 1.0f / mat.refIdx;
         cosine = -IDotN;
     }
     float reflectPercentage;
@@ -47,10 +46,10 @@ INLINE bool Dielectric::Scatter(const Ray &in, const Hitable::Record &record, XM
     if (XMVector3Equal(refracted, g_XMZero)) {
         reflectPercentage = 1.0f;
     } else {
-        reflectPercentage = Schlick(cosine, mRefIdx);
+        reflectPercentage = Schlick(cosine, mat.refIdx);
     }
 
-    if (RandomUnit() < reflectPercentage) {
+    if (rng.NextFloat() < reflectPercentage) {
         scatter = Ray(record.p, reflected);
     } else {
         scatter = Ray(record.p, refracted);
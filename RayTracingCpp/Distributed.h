@@ -0,0 +1,360 @@
+#pragma once
+
+#include "TileScheduler.h"
+#include "FrameBuffer.h"
+#include "Sampler.h"
+#include "Progressive.h"
+
+// The jobs of a distributed frame in named shared memory: a header, a table of jobs and
+// a result slot per job. A job is a tile and a range of the samples of its pixels, so a
+// frame can be cut finer than its tiles. Worker processes claim free jobs with a compare
+// and swap on their state, render them into their slot and only then mark them done; a
+// job held by a worker that died is put back by the coordinator and rendered again. A
+// sample is a function of its pixel and index only, so a job renders the same wherever
+// it runs.
+class JobBoard {
+public:
+    struct Job {
+        std::atomic<uint32_t>   state;      // Free, Done or Taken + the worker holding it
+        Tile                    tile;
+        int32_t                 first;      // samples [first, first + count) of every pixel
+        int32_t                 count;
+        uint32_t                worker;     // that finished it
+        double                  ms;
+    };
+
+    JobBoard(void)
+    : mMapping(nullptr)
+    , mView(nullptr)
+    , mCoordinator(nullptr)
+    {
+
+    }
+    ~JobBoard(void) {
+        Close();
+    }
+
+    // Coordinator: a board of every tile of the image cut into ranges of rangeSamples,
+    // all samples in one job if 0. Fails if a board of that name exists.
+    bool Create(const std::string &name, int width, int height, int tileSize, int samples, int rangeSamples,
+                const SamplerSettings &sampler, const std::string &scene);
+    // Worker: the board of name, which must be of the same size, sampler and scene.
+    bool Open(const std::string &name, int width, int height, const SamplerSettings &sampler, const std::string &scene);
+    void Close(void);
+
+    INLINE const std::string & Name(void) const { return mName; }
+    INLINE int JobCount(void) const { return static_cast<int>(Head().jobCount); }
+    INLINE int TileSize(void) const { return Head().tileSize; }
+    INLINE Job & At(int job) const { return Jobs()[job]; }
+    // mean radiance in xyz and sample count in w of every pixel, tile.width to a row
+    INLINE XMFLOAT4 * Results(int job) const {
+        return reinterpret_cast<XMFLOAT4 *>(static_cast<char *>(mView) + ResultsOffset(Head().jobCount)) + size_t(job) * Head().tileSize * Head().tileSize;
+    }
+
+    // Worker. False when no job is free, which is not the end while jobs may be put back.
+    bool Claim(uint32_t worker, int &job);
+    void Finish(uint32_t worker, int job, double ms);
+    // true once the coordinator is done with the workers, or gone
+    bool Stopped(void) const;
+
+    // Coordinator. Reset frees every job for another frame, Release the jobs of a worker
+    // that died and returns how many.
+    void Reset(void);
+    int Release(uint32_t worker);
+    INLINE bool Finished(void) const { return Head().done.load(std::memory_order_acquire) == Head().jobCount; }
+    INLINE void Stop(void) { Head().stop.store(1, std::memory_order_release); }
+
+private:
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t HeaderSize = 128;
+    static constexpr uint32_t Free = 0;
+    static constexpr uint32_t Taken = 1;
+    static constexpr uint32_t Done = 0xFFFFFFFF;
+
+    struct Header {
+        char                    magic[8];
+        uint32_t                version;
+        int32_t                 width;
+        int32_t                 height;
+        int32_t                 tileSize;
+        uint32_t                sampler;
+        uint32_t                samplesPerPixel;
+        uint32_t                seed;
+        uint32_t                jobCount;
+        uint32_t                coordinator;    // process id
+        std::atomic<uint32_t>   done;
+        std::atomic<uint32_t>   stop;
+        uint64_t                scene;          // HashScene of the scene string
+    };
+    static_assert(sizeof(Header) <= HeaderSize, "job board header too large");
+    // the atomics are shared between processes, which only works when they need no lock
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "job states must be lock free");
+
+    INLINE static size_t ResultsOffset(uint32_t jobCount) {
+        return (HeaderSize + jobCount * sizeof(Job) + 63) & ~size_t(63);
+    }
+    INLINE Header & Head(void) const { return *static_cast<Header *>(mView); }
+    INLINE Job * Jobs(void) const { return reinterpret_cast<Job *>(static_cast<char *>(mView) + HeaderSize); }
+
+    std::string mName;
+    HANDLE      mMapping;
+    void        *mView;
+    HANDLE      mCoordinator;
+};
+
+INLINE bool JobBoard::Create(const std::string &name, int width, int height, int tileSize, int samples, int rangeSamples,
+                             const SamplerSettings &sampler, const std::string &scene) {
+    static const char magic[8] = { 'R', 'T', 'J', 'O', 'B', 'S', 0, 0 };
+    Close();
+    rangeSamples = (rangeSamples > 0) ? std::min(rangeSamples, samples) : samples;
+    TileScheduler tiles(width, height, tileSize, 1);
+    int ranges = (samples + rangeSamples - 1) / rangeSamples;
+    uint32_t jobCount = static_cast<uint32_t>(tiles.TileCount() * ranges);
+    uint64_t bytes = ResultsOffset(jobCount) + uint64_t(jobCount) * tileSize * tileSize * sizeof(XMFLOAT4);
+
+    // backed by the paging file and zero filled
+    mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(bytes >> 32), DWORD(bytes), name.c_str());
+    if (!mMapping || GetLastError() == ERROR_ALREADY_EXISTS) {
+        Close();
+        return false;
+    }
+    mView = MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, size_t(bytes));
+    if (!mView) {
+        Close();
+        return false;
+    }
+    mName = name;
+
+    Header &header = Head();
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = Version;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.sampler = sampler.type;
+    header.samplesPerPixel = sampler.samplesPerPixel;
+    header.seed = sampler.seed;
+    header.jobCount = jobCount;
+    header.coordinator = GetCurrentProcessId();
+    new (&header.done) std::atomic<uint32_t>(0);
+    new (&header.stop) std::atomic<uint32_t>(0);
+    header.scene = HashScene(scene);
+
+    // the ranges of a tile are next to each other, a worker sweeping the table finishes
+    // tiles rather than starting all of them
+    Tile tile;
+    int index = 0;
+    while (tiles.Next(0, tile)) {
+        for (int range = 0; range < ranges; ++range) {
+            Job &job = Jobs()[index++];
+            new (&job.state) std::atomic<uint32_t>(Free);
+            job.tile = tile;
+            job.first = range * rangeSamples;
+            job.count = std::min(rangeSamples, samples - job.first);
+            job.worker = 0;
+            job.ms = 0.0;
+        }
+    }
+    return true;
+}
+
+INLINE bool JobBoard::Open(const std::string &name, int width, int height, const SamplerSettings &sampler, const std::string &scene) {
+    static const char magic[8] = { 'R', 'T', 'J', 'O', 'B', 'S', 0, 0 };
+    Close();
+    mMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    mView = mMapping ? MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    if (!mView) {
+        Close();
+        return false;
+    }
+    mName = name;
+
+    const Header &header = Head();
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != Version || header.width != width || header.height != height ||
+        header.sampler != sampler.type || header.samplesPerPixel != sampler.samplesPerPixel || header.seed != sampler.seed || header.scene != HashScene(scene)) {
+        Close();
+        return false;
+    }
+    // a worker left behind by a coordinator that was killed stops by itself
+    mCoordinator = OpenProcess(SYNCHRONIZE, FALSE, header.coordinator);
+    if (!mCoordinator) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+INLINE void JobBoard::Close(void) {
+    if (mView) {
+        UnmapViewOfFile(mView);
+        mView = nullptr;
+    }
+    if (mMapping) {
+        CloseHandle(mMapping);
+        mMapping = nullptr;
+    }
+    if (mCoordinator) {
+        CloseHandle(mCoordinator);
+        mCoordinator = nullptr;
+    }
+    mName.clear();
+}
+
+INLINE bool JobBoard::Claim(uint32_t worker, int &job) {
+    int jobCount = JobCount();
+    for (int i = 0; i < jobCount; ++i) {
+        uint32_t expected = Free;
+        if (Jobs()[i].state.compare_exchange_strong(expected, Taken + worker, std::memory_order_acq_rel)) {
+            job = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+INLINE void JobBoard::Finish(uint32_t worker, int job, double ms) {
+    Job &entry = Jobs()[job];
+    entry.worker = worker;
+    entry.ms = ms;
+    // the results are written before anyone can see the job done
+    entry.state.store(Done, std::memory_order_release);
+    Head().done.fetch_add(1, std::memory_order_acq_rel);
+}
+
+INLINE bool JobBoard::Stopped(void) const {
+    if (Head().stop.load(std::memory_order_acquire) != 0) {
+        return true;
+    }
+    return mCoordinator && WaitForSingleObject(mCoordinator, 0) == WAIT_OBJECT_0;
+}
+
+INLINE void JobBoard::Reset(void) {
+    int jobCount = JobCount();
+    for (int i = 0; i < jobCount; ++i) {
+        Jobs()[i].state.store(Free, std::memory_order_relaxed);
+        Jobs()[i].ms = 0.0;
+    }
+    Head().stop.store(0, std::memory_order_relaxed);
+    Head().done.store(0, std::memory_order_release);
+}
+
+INLINE int JobBoard::Release(uint32_t worker) {
+    int released = 0;
+    int jobCount = JobCount();
+    for (int i = 0; i < jobCount; ++i) {
+        uint32_t expected = Taken + worker;
+        if (Jobs()[i].state.compare_exchange_strong(expected, Free, std::memory_order_acq_rel)) {
+            ++released;
+        }
+    }
+    return released;
+}
+
+// Renders the frame of a JobBoard with worker processes, this executable started again
+// with the arguments of the coordinator and -worker <board> <slot>. A worker that exits
+// before the frame is done has its jobs put back and is started again, up to
+// MaxRestarts per frame. The jobs are added to the frame in the order of the table once
+// all are done, so the image does not depend on which worker rendered what or when.
+class RenderCoordinator {
+public:
+    struct Stats {
+        int     workers;
+        int     threads;        // per worker
+        int     jobs;
+        int     reissued;       // jobs put back after their worker died
+        int     restarts;
+        double  seconds;        // from the first worker started to the frame merged
+        double  jobSeconds;     // spent in the jobs, summed over all threads
+    };
+
+    // arguments are those of the coordinator the workers need to set the same scene up
+    RenderCoordinator(const std::string &arguments);
+    ~RenderCoordinator(void) {
+
+    }
+
+    // false when the workers failed the frame, every one of them is gone by then
+    bool Render(JobBoard &board, int workerCount, int threadsPerWorker, FrameBuffer &frame, Stats &stats);
+
+private:
+    static constexpr int    MaxRestarts = 8;
+    static constexpr int    PollMs = 2;
+
+    HANDLE Start(const JobBoard &board, int slot, int threads) const;
+
+    std::string mCommand;
+};
+
+INLINE RenderCoordinator::RenderCoordinator(const std::string &arguments)
+{
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    mCommand = "\"" + std::string(path, length) + "\" " + arguments;
+}
+
+INLINE bool RenderCoordinator::Render(JobBoard &board, int workerCount, int threadsPerWorker, FrameBuffer &frame, Stats &stats) {
+    stats = { workerCount, threadsPerWorker, board.JobCount(), 0, 0, 0.0, 0.0 };
+    board.Reset();
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<HANDLE> workers(workerCount, nullptr);
+    int alive = 0;
+    for (int slot = 0; slot < workerCount; ++slot) {
+        workers[slot] = Start(board, slot, threadsPerWorker);
+        alive += workers[slot] ? 1 : 0;
+    }
+    while (alive > 0 && !board.Finished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PollMs));
+        for (int slot = 0; slot < workerCount; ++slot) {
+            if (!workers[slot] || WaitForSingleObject(workers[slot], 0) != WAIT_OBJECT_0) {
+                continue;
+            }
+            // workers only exit on their own once stopped, this one failed or was killed
+            CloseHandle(workers[slot]);
+            workers[slot] = nullptr;
+            --alive;
+            stats.reissued += board.Release(static_cast<uint32_t>(slot));
+            if (!board.Finished() && stats.restarts < MaxRestarts) {
+                ++stats.restarts;
+                workers[slot] = Start(board, slot, threadsPerWorker);
+                alive += workers[slot] ? 1 : 0;
+            }
+        }
+    }
+    bool finished = board.Finished();
+    board.Stop();
+    for (HANDLE worker : workers) {
+        if (worker) {
+            WaitForSingleObject(worker, INFINITE);
+            CloseHandle(worker);
+        }
+    }
+    if (!finished) {
+        return false;
+    }
+
+    for (int job = 0; job < board.JobCount(); ++job) {
+        const JobBoard::Job &entry = board.At(job);
+        frame.AddTile(entry.tile, board.Results(job));
+        stats.jobSeconds += entry.ms / 1000.0;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return true;
+}
+
+INLINE HANDLE RenderCoordinator::Start(const JobBoard &board, int slot, int threads) const {
+    std::ostringstream command;
+    command << mCommand << " -worker " << board.Name() << ' ' << slot << " -threads " << threads;
+    std::string line = command.str();
+    std::vector<char> buffer(line.begin(), line.end());
+    buffer.push_back('\0');
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION process = {};
+    if (!CreateProcessA(nullptr, buffer.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process)) {
+        return nullptr;
+    }
+    CloseHandle(process.hThread);
+    return process.hProcess;
+}
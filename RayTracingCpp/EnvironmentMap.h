@@ -0,0 +1,150 @@
+#pragma once
+
+#include "DXRShading.h"
+#include "DXRTexture.h"
+#include "Random.h"
+
+// A lat-long environment map, laid out the way DirToLatLong of the DXR path tracer reads
+// it, with a Walker alias table over its texels for importance sampling. A texel is
+// picked in proportion to its luminance times sin(theta), the solid angle it covers, in
+// O(1): one index and one comparison against its threshold, after which the direction
+// is uniform within the texel. The table is an array of Dxr::EnvAliasEntry, so it can
+// be uploaded to the GPU as a structured buffer as it is.
+class EnvironmentMap {
+public:
+    // nullptr for a format DXRTexture can not read or an image without any light;
+    // an HDR image of R32G32B32[A32]_FLOAT is what lights a scene
+    static EnvironmentMap * Create(const Utils::Image &image);
+    ~EnvironmentMap(void) {
+
+    }
+
+    INLINE int Width(void) const { return mTexture->Width(); }
+    INLINE int Height(void) const { return mTexture->Height(); }
+    // Width() * Height() entries in texel order, the density of a texel is its share of
+    // the lat-long square over that of a uniform one
+    INLINE const std::vector<Dxr::EnvAliasEntry> & Entries(void) const { return mEntries; }
+    INLINE size_t ByteSize(void) const { return mEntries.size() * sizeof(Dxr::EnvAliasEntry); }
+
+    // arriving from direction, bilinear like gEnvTexture
+    INLINE XMVECTOR Radiance(const XMVECTOR &direction) const {
+        return XMVectorSetW(mTexture->SampleLevel(Dxr::DirToLatLong(direction)), 0.0f);
+    }
+    // a direction towards the map with its solid angle density, 0 when it can not be
+    // used; always draws four numbers from rng
+    XMVECTOR Sample(RandomStream &rng, float &pdf) const;
+    // density Sample gives direction
+    float Pdf(const XMVECTOR &direction) const;
+
+private:
+    EnvironmentMap(DXRTexture *texture)
+    : mTexture(texture)
+    {
+
+    }
+
+    // Vose's construction of the alias table, false when no texel has any weight
+    bool Build(void);
+
+    // the density of a texel over the lat-long square to one over solid angle
+    INLINE static float SolidAnglePdf(float density, float sinTheta) {
+        return sinTheta > 0.0f ? density / (XM_2PI * XM_PI * sinTheta) : 0.0f;
+    }
+
+    std::unique_ptr<DXRTexture>         mTexture;
+    std::vector<Dxr::EnvAliasEntry>     mEntries;
+};
+
+INLINE EnvironmentMap * EnvironmentMap::Create(const Utils::Image &image) {
+    DXRTexture *texture = DXRTexture::Create(image);
+    if (!texture) {
+        return nullptr;
+    }
+    std::unique_ptr<EnvironmentMap> map(new EnvironmentMap(texture));
+    return map->Build() ? map.release() : nullptr;
+}
+
+INLINE bool EnvironmentMap::Build(void) {
+    int width = Width();
+    int height = Height();
+    size_t count = size_t(width) * height;
+    std::vector<double> weights(count);
+    double sum = 0.0;
+    for (int y = 0; y < height; ++y) {
+        // row 0 is the bottom of the sky, theta = pi (1 - v)
+        float sinTheta = std::sin(XM_PI * (y + 0.5f) / float(height));
+        for (int x = 0; x < width; ++x) {
+            float lum = XMVectorGetX(XMVector3Dot(mTexture->Fetch(x, y), XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f)));
+            double weight = double(std::max(lum, 0.0f)) * sinTheta;
+            weights[size_t(y) * width + x] = weight;
+            sum += weight;
+        }
+    }
+    if (sum <= 0.0) {
+        return false;
+    }
+
+    // scaled to a mean of 1, a texel below it lends the rest of its slot to one above
+    mEntries.resize(count);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (size_t i = 0; i < count; ++i) {
+        weights[i] *= double(count) / sum;
+        mEntries[i].density = float(weights[i]);
+        (weights[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+        uint32_t lender = small.back();
+        small.pop_back();
+        uint32_t taker = large.back();
+        mEntries[lender].threshold = float(weights[lender]);
+        mEntries[lender].alias = taker;
+        weights[taker] -= 1.0 - weights[lender];
+        if (weights[taker] < 1.0) {
+            large.pop_back();
+            small.push_back(taker);
+        }
+    }
+    // whatever is left is a full slot up to rounding
+    for (uint32_t i : small) {
+        mEntries[i].threshold = 1.0f;
+        mEntries[i].alias = i;
+    }
+    for (uint32_t i : large) {
+        mEntries[i].threshold = 1.0f;
+        mEntries[i].alias = i;
+    }
+    return true;
+}
+
+INLINE XMVECTOR EnvironmentMap::Sample(RandomStream &rng, float &pdf) const {
+    float pick = rng.NextFloat();
+    float coin = rng.NextFloat();
+    float u1 = rng.NextFloat();
+    float u2 = rng.NextFloat();
+
+    uint32_t count = static_cast<uint32_t>(mEntries.size());
+    uint32_t index = std::min(static_cast<uint32_t>(pick * float(count)), count - 1);
+    if (coin >= mEntries[index].threshold) {
+        index = mEntries[index].alias;
+    }
+    int width = Width();
+    float u = (float(index % width) + u1) / float(width);
+    float v = (float(index / width) + u2) / float(Height());
+
+    // the inverse of DirToLatLong
+    float theta = XM_PI * (1.0f - v);
+    float phi = XM_PI * (2.0f * u - 1.0f);
+    float sinTheta = std::sin(theta);
+    pdf = SolidAnglePdf(mEntries[index].density, sinTheta);
+    return XMVectorSet(sinTheta * std::sin(phi), std::cos(theta), -sinTheta * std::cos(phi), 0.0f);
+}
+
+INLINE float EnvironmentMap::Pdf(const XMVECTOR &direction) const {
+    XMFLOAT2 uv = Dxr::DirToLatLong(direction);
+    int x = std::min(std::max(static_cast<int>(uv.x * Width()), 0), Width() - 1);
+    int y = std::min(std::max(static_cast<int>(uv.y * Height()), 0), Height() - 1);
+    float cosTheta = XMVectorGetY(XMVector3Normalize(direction));
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return SolidAnglePdf(mEntries[size_t(y) * Width() + x].density, sinTheta);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "TileScheduler.h"
+
+// First hit features of one pixel, averaged over a few of its sample positions.
+struct Feature {
+    XMFLOAT3    albedo;     // of the first material hit, 1 where the ray escaped
+    float       depth;      // distance to the first hit, MissDepth where the ray escaped
+    XMFLOAT3    normal;     // shading normal at the first hit, 0 where the ray escaped
+    float       variance;   // of the pixel's mean luminance, FLT_MAX below two samples
+};
+
+// Auxiliary outputs of a render, the guides of the Denoiser. Tiles are stored as they
+// finish, rows counted from the top of the image like FrameBuffer.
+class FeatureBuffer {
+public:
+    static constexpr float MissDepth = 1e+30f;
+
+    FeatureBuffer(int width, int height)
+    : mWidth(width)
+    , mHeight(height)
+    , mFeatures(size_t(width) * height)
+    {
+
+    }
+    ~FeatureBuffer(void) {
+
+    }
+
+    INLINE int Width(void) const { return mWidth; }
+    INLINE int Height(void) const { return mHeight; }
+    INLINE const Feature & At(int x, int y) const { return mFeatures[size_t(y) * mWidth + x]; }
+
+    INLINE void SetTile(const Tile &tile, const Feature *features) {
+        for (int y = 0; y < tile.height; ++y) {
+            std::copy(features + y * tile.width, features + (y + 1) * tile.width, &mFeatures[size_t(tile.y + y) * mWidth + tile.x]);
+        }
+    }
+
+private:
+    int                     mWidth;
+    int                     mHeight;
+    std::vector<Feature>    mFeatures;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "TileScheduler.h"
+
+// Float accumulation buffer: xyz hold the radiance sum of a pixel, w its sample count.
+// Tiles are merged in as they finish; Resolve gives the running average.
+class FrameBuffer {
+public:
+    FrameBuffer(int width, int height)
+    : mWidth(width)
+    , mHeight(height)
+    {
+        Clear();
+    }
+    ~FrameBuffer(void) {
+
+    }
+
+    INLINE int Width(void) const { return mWidth; }
+    INLINE int Height(void) const { return mHeight; }
+    INLINE const std::vector<XMFLOAT4> & Data(void) const { return mPixels; }
+
+    INLINE void Clear(void) {
+        mPixels.assign(size_t(mWidth) * mHeight, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+    }
+
+    // tile pixels carry their average radiance in xyz and their sample count in w
+    INLINE void AddTile(const Tile &tile, const XMFLOAT4 *pixels) {
+        for (int y = 0; y < tile.height; ++y) {
+            XMFLOAT4 *dst = &mPixels[size_t(tile.y + y) * mWidth + tile.x];
+            const XMFLOAT4 *src = pixels + y * tile.width;
+            for (int x = 0; x < tile.width; ++x) {
+                XMVECTOR sample = XMLoadFloat4(src + x);
+                XMVECTOR sum = XMLoadFloat4(dst + x) + XMVectorSetW(sample * src[x].w, src[x].w);
+                XMStoreFloat4(dst + x, sum);
+            }
+        }
+    }
+
+    // average radiance of a pixel, w holds the sample count
+    INLINE XMFLOAT4 Resolve(int x, int y) const {
+        XMFLOAT4 sum = mPixels[size_t(y) * mWidth + x];
+        float scale = sum.w > 0.0f ? 1.0f / sum.w : 0.0f;
+        return XMFLOAT4(sum.x * scale, sum.y * scale, sum.z * scale, sum.w);
+    }
+
+private:
+    int                     mWidth;
+    int                     mHeight;
+    std::vector<XMFLOAT4>   mPixels;
+};
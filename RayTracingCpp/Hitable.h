@@ -1,18 +1,45 @@
 #pragma once
 
 #include "Ray.h"
+#include "AABB.h"
 
-class Material;
+struct RayPacket;
 
 class Hitable {
 public:
+    // the primIndex of a hit that is not on a triangle
+    static constexpr uint32_t NoPrimitive = 0xFFFFFFFF;
+
     struct Record {
         float t;
         XMVECTOR p;
         XMVECTOR n;
-        Material *mat;
+        uint32_t matIndex;
+        // triangles only: the triangle and the barycentrics of its vertices 1 and 2,
+        // in the order of the DXR BuiltInTriangleIntersectionAttributes; NoPrimitive for
+        // any other hit
+        uint32_t primIndex;
+        float u, v;
     };
 
+    virtual ~Hitable(void) {
+
+    }
+
     virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record) = 0;
+    virtual bool BoundingBox(AABB &box) = 0;
+    // Closest hits for every ray of the packet that are nearer than its tMax. The
+    // default traces the rays one at a time; acceleration structures override it.
+    virtual void HitPacket(RayPacket &packet);
+    // Any hit between tMin and tMax, for shadow rays. Traversal may stop at the first
+    // intersection it finds; the default asks Hit for the closest one.
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
 
 };
+
+INLINE bool Hitable::Occluded(const Ray &ray, float tMin, float tMax) {
+    Record record;
+    return Hit(ray, tMin, tMax, record);
+}
+
+#include "RayPacket.h"
@@ -16,6 +16,7 @@ public:
     }
 
     virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
 
 private:
     Hitable   **mList;
@@ -37,3 +38,15 @@ INLINE bool HitableList::Hit(const Ray& ray, float tMin, float tMax, Record& rec
     return isHit;
 }
 
+
+INLINE bool HitableList::BoundingBox(AABB &box) {
+    box.Reset();
+    AABB temp;
+    for (int i = 0; i < mListSize; ++i) {
+        if (!mList[i]->BoundingBox(temp)) {
+            return false;
+        }
+        box.Merge(temp);
+    }
+    return mListSize > 0;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "TileScheduler.h"
+
+// Writes an image tile by tile in any order. Every format here has fixed size pixels,
+// so a tile row maps to a known file offset and nothing but the current tile has to be
+// kept in memory.
+class ImageWriter {
+public:
+    virtual ~ImageWriter(void) {
+
+    }
+
+    bool Open(const std::string &file, int width, int height);
+    void Close(void);
+
+    // pixels hold linear radiance in xyz, rows of tile.width pixels
+    virtual void WriteTile(const Tile &tile, const XMFLOAT4 *pixels) = 0;
+
+    // picks the format from the file extension: .ppm (binary P6), .pfm or .exr
+    static ImageWriter * Create(const std::string &file);
+
+protected:
+    virtual void WriteHeader(void) = 0;
+
+    INLINE void WriteAt(uint64_t offset, const void *data, size_t size) {
+        mStream.seekp(static_cast<std::streamoff>(offset));
+        mStream.write(static_cast<const char *>(data), size);
+    }
+
+    std::ofstream   mStream;
+    int             mWidth;
+    int             mHeight;
+    uint64_t        mDataOffset;
+};
+
+INLINE bool ImageWriter::Open(const std::string &file, int width, int height) {
+    mWidth = width;
+    mHeight = height;
+    mStream.open(file, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!mStream.is_open()) {
+        return false;
+    }
+    WriteHeader();
+    return mStream.good();
+}
+
+INLINE void ImageWriter::Close(void) {
+    if (mStream.is_open()) {
+        mStream.close();
+    }
+}
+
+// Binary P6 in display space: gamma 2 (the sqrt the ASCII writer applied) and 8 bits.
+class PPMWriter : public ImageWriter {
+public:
+    virtual void WriteTile(const Tile &tile, const XMFLOAT4 *pixels);
+
+protected:
+    virtual void WriteHeader(void);
+};
+
+INLINE void PPMWriter::WriteHeader(void) {
+    std::string header = "P6\n" + std::to_string(mWidth) + " " + std::to_string(mHeight) + "\n255\n";
+    mStream.write(header.data(), header.size());
+    mDataOffset = header.size();
+}
+
+INLINE void PPMWriter::WriteTile(const Tile &tile, const XMFLOAT4 *pixels) {
+    std::vector<uint8_t> row(size_t(tile.width) * 3);
+    for (int y = 0; y < tile.height; ++y) {
+        const XMFLOAT4 *src = pixels + y * tile.width;
+        for (int x = 0; x < tile.width; ++x) {
+            XMVECTOR col = XMVectorSaturate(XMVectorSqrt(XMLoadFloat4(src + x)));
+            row[x * 3 + 0] = uint8_t(255.0f * XMVectorGetX(col));
+            row[x * 3 + 1] = uint8_t(255.0f * XMVectorGetY(col));
+            row[x * 3 + 2] = uint8_t(255.0f * XMVectorGetZ(col));
+        }
+        WriteAt(mDataOffset + (uint64_t(tile.y + y) * mWidth + tile.x) * 3, row.data(), row.size());
+    }
+}
+
+// Portable float map, linear RGB, little endian, rows stored bottom to top.
+class PFMWriter : public ImageWriter {
+public:
+    virtual void WriteTile(const Tile &tile, const XMFLOAT4 *pixels);
+
+protected:
+    virtual void WriteHeader(void);
+};
+
+INLINE void PFMWriter::WriteHeader(void) {
+    std::string header = "PF\n" + std::to_string(mWidth) + " " + std::to_string(mHeight) + "\n-1.0\n";
+    mStream.write(header.data(), header.size());
+    mDataOffset = header.size();
+}
+
+INLINE void PFMWriter::WriteTile(const Tile &tile, const XMFLOAT4 *pixels) {
+    std::vector<XMFLOAT3> row(tile.width);
+    for (int y = 0; y < tile.height; ++y) {
+        const XMFLOAT4 *src = pixels + y * tile.width;
+        for (int x = 0; x < tile.width; ++x) {
+            row[x] = XMFLOAT3(src[x].x, src[x].y, src[x].z);
+        }
+        uint64_t line = uint64_t(mHeight - 1 - (tile.y + y));
+        WriteAt(mDataOffset + (line * mWidth + tile.x) * sizeof(XMFLOAT3), row.data(), row.size() * sizeof(XMFLOAT3));
+    }
+}
+
+// Single part scanline OpenEXR, uncompressed half float B, G, R planes, one line per
+// block. Every block has the same size, so the offset table is known up front.
+class EXRWriter : public ImageWriter {
+public:
+    virtual void WriteTile(const Tile &tile, const XMFLOAT4 *pixels);
+
+protected:
+    virtual void WriteHeader(void);
+
+private:
+    template <typename T>
+    INLINE void Append(std::vector<uint8_t> &bytes, const T &value) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+        bytes.insert(bytes.end(), p, p + sizeof(T));
+    }
+
+    INLINE void AppendAttribute(std::vector<uint8_t> &bytes, const char *name, const char *type, const std::vector<uint8_t> &value) {
+        bytes.insert(bytes.end(), name, name + strlen(name) + 1);
+        bytes.insert(bytes.end(), type, type + strlen(type) + 1);
+        Append(bytes, int32_t(value.size()));
+        bytes.insert(bytes.end(), value.begin(), value.end());
+    }
+
+    INLINE uint64_t LineSize(void) const { return 8 + uint64_t(mWidth) * 3 * sizeof(PackedVector::HALF); }
+};
+
+inline void EXRWriter::WriteHeader(void) {
+    std::vector<uint8_t> bytes;
+    Append(bytes, uint32_t(20000630)); // magic number
+    Append(bytes, uint32_t(2));        // version 2, single part scanline
+
+    std::vector<uint8_t> value;
+    static const char *channels[] = { "B", "G", "R" }; // alphabetical, as stored
+    for (const char *channel : channels) {
+        value.insert(value.end(), channel, channel + 2);
+        Append(value, int32_t(1));      // HALF
+        Append(value, uint32_t(0));     // pLinear + reserved
+        Append(value, int32_t(1));      // x sampling
+        Append(value, int32_t(1));      // y sampling
+    }
+    value.push_back(0);
+    AppendAttribute(bytes, "channels", "chlist", value);
+
+    AppendAttribute(bytes, "compression", "compression", std::vector<uint8_t>(1, 0)); // NO_COMPRESSION
+
+    value.clear();
+    Append(value, int32_t(0));
+    Append(value, int32_t(0));
+    Append(value, int32_t(mWidth - 1));
+    Append(value, int32_t(mHeight - 1));
+    AppendAttribute(bytes, "dataWindow", "box2i", value);
+    AppendAttribute(bytes, "displayWindow", "box2i", value);
+
+    AppendAttribute(bytes, "lineOrder", "lineOrder", std::vector<uint8_t>(1, 0)); // INCREASING_Y
+
+    value.clear();
+    Append(value, 1.0f);
+    AppendAttribute(bytes, "pixelAspectRatio", "float", value);
+    AppendAttribute(bytes, "screenWindowWidth", "float", value);
+
+    value.clear();
+    Append(value, 0.0f);
+    Append(value, 0.0f);
+    AppendAttribute(bytes, "screenWindowCenter", "v2f", value);
+
+    bytes.push_back(0); // end of header
+
+    // line offset table followed by the block headers (y, data size) of every line
+    mDataOffset = bytes.size() + uint64_t(mHeight) * sizeof(uint64_t);
+    for (int y = 0; y < mHeight; ++y) {
+        Append(bytes, uint64_t(mDataOffset + y * LineSize()));
+    }
+    mStream.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+
+    int32_t block[2] = { 0, int32_t(LineSize() - 8) };
+    for (int y = 0; y < mHeight; ++y) {
+        block[0] = y;
+        WriteAt(mDataOffset + y * LineSize(), block, sizeof(block));
+    }
+}
+
+INLINE void EXRWriter::WriteTile(const Tile &tile, const XMFLOAT4 *pixels) {
+    std::vector<PackedVector::HALF> plane(tile.width);
+    for (int y = 0; y < tile.height; ++y) {
+        const XMFLOAT4 *src = pixels + y * tile.width;
+        uint64_t line = mDataOffset + uint64_t(tile.y + y) * LineSize() + 8;
+        for (int c = 0; c < 3; ++c) {
+            for (int x = 0; x < tile.width; ++x) {
+                // planes are B, G, R
+                float value = (c == 0) ? src[x].z : ((c == 1) ? src[x].y : src[x].x);
+                plane[x] = PackedVector::XMConvertFloatToHalf(value);
+            }
+            uint64_t offset = line + (uint64_t(c) * mWidth + tile.x) * sizeof(PackedVector::HALF);
+            WriteAt(offset, plane.data(), plane.size() * sizeof(PackedVector::HALF));
+        }
+    }
+}
+
+INLINE ImageWriter * ImageWriter::Create(const std::string &file) {
+    std::string ext = file.size() >= 4 ? file.substr(file.size() - 4) : "";
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == ".pfm") {
+        return new PFMWriter();
+    } else if (ext == ".exr") {
+        return new EXRWriter();
+    } else if (ext == ".ppm") {
+        return new PPMWriter();
+    }
+    return nullptr;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Hitable.h"
+#include "BVHNode.h"
+
+// One placement of a bottom level structure, any Hitable built once in its own object
+// space (a BVHNode of batches, a TriangleMesh) and shared by every instance of it. A
+// ray is moved into object space instead of the geometry into world space: the
+// direction is left unnormalized by the transform, so its length converts distances
+// between the two spaces, and the normal comes back through the inverse transpose.
+class Instance : public Hitable {
+public:
+    static constexpr uint32_t KeepMaterial = UINT32_MAX;
+
+    // transform maps object to world space; material replaces the one of every hit
+    Instance(Hitable *blas, const XMMATRIX &transform, uint32_t material = KeepMaterial);
+    ~Instance(void) {
+
+    }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+private:
+    XMMATRIX    mWorldToObject;
+    AABB        mBounds;
+    Hitable    *mBLAS;
+    uint32_t    mMaterial;
+};
+
+INLINE Instance::Instance(Hitable *blas, const XMMATRIX &transform, uint32_t material)
+: mBLAS(blas)
+, mMaterial(material)
+{
+    mWorldToObject = XMMatrixInverse(nullptr, transform);
+
+    // world bounds of the eight transformed corners of the object bounds
+    AABB local;
+    if (mBLAS->BoundingBox(local)) {
+        XMVECTOR corners[2] = { local.Min(), local.Max() };
+        for (int c = 0; c < 8; ++c) {
+            XMVECTOR corner = XMVectorSet(XMVectorGetX(corners[c & 1]), XMVectorGetY(corners[(c >> 1) & 1]), XMVectorGetZ(corners[c >> 2]), 1.0f);
+            mBounds.Merge(XMVector3TransformCoord(corner, transform));
+        }
+    }
+}
+
+INLINE bool Instance::BoundingBox(AABB &box) {
+    box = mBounds;
+    return !mBounds.IsEmpty();
+}
+
+INLINE bool Instance::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    XMVECTOR direction = XMVector3TransformNormal(ray.Direction(), mWorldToObject);
+    // object space length of one world unit along the ray
+    float scale = XMVectorGetX(XMVector3Length(direction));
+    Ray local(XMVector3TransformCoord(ray.Origin(), mWorldToObject), direction);
+    if (!mBLAS->Hit(local, tMin * scale, tMax * scale, record)) {
+        return false;
+    }
+
+    record.t /= scale;
+    record.p = ray.PointAt(record.t);
+    // n * transpose(worldToObject), the rows of the 3x3 part dotted with the normal
+    XMVECTOR n = record.n;
+    record.n = XMVector3Normalize(XMVectorSet(XMVectorGetX(XMVector3Dot(n, mWorldToObject.r[0])),
+                                              XMVectorGetX(XMVector3Dot(n, mWorldToObject.r[1])),
+                                              XMVectorGetX(XMVector3Dot(n, mWorldToObject.r[2])), 0.0f));
+    if (mMaterial != KeepMaterial) {
+        record.matIndex = mMaterial;
+    }
+    return true;
+}
+
+INLINE bool Instance::Occluded(const Ray &ray, float tMin, float tMax) {
+    XMVECTOR direction = XMVector3TransformNormal(ray.Direction(), mWorldToObject);
+    float scale = XMVectorGetX(XMVector3Length(direction));
+    Ray local(XMVector3TransformCoord(ray.Origin(), mWorldToObject), direction);
+    return mBLAS->Occluded(local, tMin * scale, tMax * scale);
+}
+
+// The CPU counterpart of TopLevelAccelerationStructure: AddInstance for every
+// placement, then Build puts a BVHNode over the instances. Instances are owned, the
+// bottom level structures they point to are not.
+class TopLevelBVH : public Hitable {
+public:
+    TopLevelBVH(void) {
+
+    }
+    ~TopLevelBVH(void) {
+        mBVH.reset();
+        for (auto instance : mInstances) {
+            delete instance;
+        }
+    }
+
+    INLINE void AddInstance(Hitable *blas, const XMMATRIX &transform, uint32_t material = Instance::KeepMaterial) {
+        mInstances.push_back(new Instance(blas, transform, material));
+    }
+    INLINE int InstanceCount(void) const { return static_cast<int>(mInstances.size()); }
+
+    INLINE void Build(void) {
+        mBVH.reset(new BVHNode(mInstances.data(), static_cast<int>(mInstances.size()), 2));
+    }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual void HitPacket(RayPacket &packet);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+private:
+    std::vector<Hitable *>      mInstances;
+    std::unique_ptr<BVHNode>    mBVH;
+};
+
+INLINE bool TopLevelBVH::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    return mBVH->Hit(ray, tMin, tMax, record);
+}
+
+INLINE bool TopLevelBVH::BoundingBox(AABB &box) {
+    return mBVH->BoundingBox(box);
+}
+
+INLINE void TopLevelBVH::HitPacket(RayPacket &packet) {
+    mBVH->HitPacket(packet);
+}
+
+INLINE bool TopLevelBVH::Occluded(const Ray &ray, float tMin, float tMax) {
+    return mBVH->Occluded(ray, tMin, tMax);
+}
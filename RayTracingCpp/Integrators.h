@@ -0,0 +1,245 @@
+#pragma once
+
+#include "Ray.h"
+#include "Scene.h"
+#include "Random.h"
+#include "RayStats.h"
+
+static constexpr int maxDepth = 50;
+static constexpr int rouletteDepth = 3;
+
+INLINE XMVECTOR SkyColor(const Ray& ray) {
+    static XMVECTOR white = {1.0f, 1.0f, 1.0f, 0.0f};
+    static XMVECTOR blue = {0.5f, 0.7f, 1.0f, 0.0f};
+    XMVECTOR direction = XMVector3Normalize(ray.Direction());
+    float t = (XMVectorGetY(direction) + 1.0f) * 0.5f;
+    return white * (1.0f - t) + blue * t;
+}
+
+INLINE XMVECTOR Background(const Scene &scene, const Ray &ray) {
+    if (scene.environment) {
+        return scene.environment->Radiance(ray.Direction());
+    }
+    return scene.lights ? SkyColor(ray) * scene.lights->SkyScale() : SkyColor(ray);
+}
+
+// Power heuristic of Veach with beta = 2: the weight of a sample drawn with density a
+// that the other strategy would have drawn with density b.
+INLINE float PowerHeuristic(float a, float b) {
+    return (a * a) / (a * a + b * b);
+}
+
+// Emission of a hit. After a bounce that sampled the lights (scatterPdf > 0) a hit on a
+// registered emitter was a candidate of both strategies and only gets its MIS share;
+// scatterNormal is the normal the lights were sampled with at the origin of ray.
+INLINE XMVECTOR Emitted(const Scene &scene, const Ray &ray, const Hitable::Record &record, float scatterPdf, const XMVECTOR &scatterNormal) {
+    XMVECTOR emitted = scene.materials->Emitted(record);
+    if (scatterPdf > 0.0f && scene.lights && !XMVector3Equal(emitted, XMVectorZero())) {
+        float lightPdf = scene.lights->EmitterPdf(ray.Origin(), scatterNormal, record);
+        if (lightPdf > 0.0f) {
+            emitted *= PowerHeuristic(scatterPdf, lightPdf);
+        }
+    }
+    return emitted;
+}
+
+// Radiance of the background a path escapes to. An environment map is sampled like the
+// emitters, so after such a bounce it only gets its MIS share too.
+INLINE XMVECTOR Escaped(const Scene &scene, const Ray &ray, float scatterPdf) {
+    XMVECTOR background = Background(scene, ray);
+    if (scatterPdf > 0.0f && scene.environment) {
+        float lightPdf = scene.environment->Pdf(ray.Direction());
+        if (lightPdf > 0.0f) {
+            background *= PowerHeuristic(scatterPdf, lightPdf);
+        }
+    }
+    return background;
+}
+
+// Next event estimation at a Lambertian hit: a shadow ray to every delta light outside
+// the light tree, and to one emitter, one light of the tree and one direction of the
+// environment map, each weighted against Lambertian::Scatter drawing the same
+// direction. Returns the reflected radiance, the caller applies the path throughput.
+INLINE XMVECTOR SampleLights(const Scene &scene, const Hitable::Record &record, const Material &mat, RandomStream &rng) {
+    RayStats &stats = RayStats::Thread();
+    XMVECTOR brdf = XMLoadFloat3(&mat.albedo) * XM_1DIVPI;
+    XMVECTOR direct = XMVectorZero();
+    if (scene.environment) {
+        float pdf;
+        XMVECTOR direction = scene.environment->Sample(rng, pdf);
+        float cosine = XMVectorGetX(XMVector3Dot(record.n, direction));
+        if (pdf > 0.0f && cosine > 0.0f) {
+            ++stats.shadow;
+            if (!scene.world->Occluded(Ray(record.p, direction), 0.001f, 1e+38f)) {
+                float weight = PowerHeuristic(pdf, cosine * XM_1DIVPI);
+                direct += brdf * scene.environment->Radiance(direction) * (cosine * weight / pdf);
+            }
+        }
+    }
+    if (!scene.lights) {
+        return direct;
+    }
+
+    const LightTable &lights = *scene.lights;
+    LightSample sample;
+    for (uint32_t i = 0; i < lights.Count(); ++i) {
+        if (lights.InTree(i) || !lights.Sample(i, record.p, sample)) {
+            continue;
+        }
+        float cosine = XMVectorGetX(XMVector3Dot(record.n, sample.direction));
+        if (cosine <= 0.0f) {
+            continue;
+        }
+        ++stats.shadow;
+        if (!scene.world->Occluded(Ray(record.p, sample.direction), 0.001f, sample.distance * 0.999f)) {
+            direct += brdf * sample.radiance * cosine;
+        }
+    }
+    if (lights.EmitterCount() > 0 && lights.SampleEmitter(record.p, rng, sample)) {
+        float cosine = XMVectorGetX(XMVector3Dot(record.n, sample.direction));
+        if (cosine > 0.0f) {
+            ++stats.shadow;
+            if (!scene.world->Occluded(Ray(record.p, sample.direction), 0.001f, sample.distance * 0.999f)) {
+                float weight = PowerHeuristic(sample.pdf, cosine * XM_1DIVPI);
+                direct += brdf * sample.radiance * (cosine * weight / sample.pdf);
+            }
+        }
+    }
+    if (lights.HasTree() && lights.SampleTree(record.p, record.n, rng, sample)) {
+        float cosine = XMVectorGetX(XMVector3Dot(record.n, sample.direction));
+        if (cosine > 0.0f) {
+            ++stats.shadow;
+            if (!scene.world->Occluded(Ray(record.p, sample.direction), 0.001f, sample.distance * 0.999f)) {
+                // a delta light has its pick folded into the radiance already
+                float weight = sample.pdf > 0.0f ? PowerHeuristic(sample.pdf, cosine * XM_1DIVPI) / sample.pdf : 1.0f;
+                direct += brdf * sample.radiance * (cosine * weight);
+            }
+        }
+    }
+    return direct;
+}
+
+// At a Lambertian hit of a path through the radiance cache, after diffuseBounces such
+// hits: true when the path ends on the radiance of the cell, added to radiance; else the
+// hit is noted in vertices, to get its share of the radiance the path ends with.
+INLINE bool EndOnCache(const Scene &scene, const Hitable::Record &record, int diffuseBounces, const XMVECTOR &throughput, XMVECTOR &radiance,
+                       RadianceCache::Vertex *vertices, int &count) {
+    uint32_t cell = scene.cache->Find(record.p, record.n);
+    XMVECTOR cached;
+    if (diffuseBounces >= scene.cache->Settings().readDepth && scene.cache->Lookup(cell, cached)) {
+        radiance += throughput * cached;
+        return true;
+    }
+    if (cell != RadianceCache::InvalidCell && count < RadianceCache::MaxVertices) {
+        vertices[count++] = { throughput, radiance, cell };
+    }
+    return false;
+}
+
+// Russian roulette after rouletteDepth bounces; survivors are reweighted by 1 / p.
+// Returns false when the path ends.
+INLINE bool Roulette(int depth, XMVECTOR &throughput, RandomStream &rng) {
+    if (depth + 1 < rouletteDepth) {
+        return true;
+    }
+    float survive = std::min(std::max(XMVectorGetX(throughput), std::max(XMVectorGetY(throughput), XMVectorGetZ(throughput))), 0.95f);
+    if (rng.NextFloat() >= survive) {
+        return false;
+    }
+    throughput /= survive;
+    return true;
+}
+
+// recursive reference integrator, kept for comparison with TracePath (-recursive); it
+// does not sample lights, so it finds emitters by scattering alone and no delta lights
+inline XMVECTOR CalculateColor(const Ray& ray, const Scene &scene, int depth, RandomStream &rng) {
+    Hitable::Record record;
+    RayStats &stats = RayStats::Thread();
+    ++(depth == 0 ? stats.primary : stats.secondary);
+    if (scene.world->Hit(ray, 0.001f, 1e+38f, record)) {
+        XMVECTOR attenuation;
+        Ray scatter;
+        XMVECTOR emitted = scene.materials->Emitted(record);
+        rng.SetBounce(depth + 1);
+        if (depth < maxDepth && scene.materials->Scatter(ray, record, rng, attenuation, scatter)) {
+            return emitted + attenuation * CalculateColor(scatter, scene, depth + 1, rng);
+        } else {
+            return emitted;
+        }
+    } else {
+        return Background(scene, ray);
+    }
+}
+
+// Iterative path integrator, continuing from the first hit of the path (hit false: the
+// ray escaped). The path carries its throughput through a loop instead of returning
+// through 50 stack frames, and after a few bounces it is terminated with Russian
+// roulette on the throughput. With scene lights or an environment map every Lambertian
+// hit also samples them; with a radiance cache the path may end on it instead.
+INLINE XMVECTOR ContinuePath(const Ray &primary, bool hit, const Hitable::Record &first, const Scene &scene, int depth, RandomStream &rng) {
+    XMVECTOR throughput = {1.0f, 1.0f, 1.0f, 0.0f};
+    XMVECTOR radiance = {0.0f, 0.0f, 0.0f, 0.0f};
+    Ray ray = primary;
+    Hitable::Record record = first;
+    float scatterPdf = 0.0f;    // of ray, 0 when the bounce before did not sample lights
+    XMVECTOR scatterNormal = XMVectorZero();
+    RadianceCache::Vertex cached[RadianceCache::MaxVertices];
+    int cachedCount = 0;
+    int diffuseBounces = 0;
+    RayStats &stats = RayStats::Thread();
+    for (;;) {
+        if (!hit) {
+            radiance += throughput * Escaped(scene, ray, scatterPdf);
+            break;
+        }
+        radiance += throughput * Emitted(scene, ray, record, scatterPdf, scatterNormal);
+
+        XMVECTOR attenuation;
+        Ray scatter;
+        rng.SetBounce(depth + 1);
+        if (depth == maxDepth) {
+            break;
+        }
+        const Material &mat = scene.materials->Get(record.matIndex);
+        if (scene.cache && mat.type == LambertianMat) {
+            if (EndOnCache(scene, record, diffuseBounces, throughput, radiance, cached, cachedCount)) {
+                break;
+            }
+            ++diffuseBounces;
+        }
+        bool sampleLights = (scene.lights || scene.environment) && mat.type == LambertianMat;
+        if (sampleLights) {
+            radiance += throughput * SampleLights(scene, record, mat, rng);
+        }
+        if (!scene.materials->Scatter(ray, record, rng, attenuation, scatter)) {
+            break;
+        }
+        scatterPdf = sampleLights ? Lambertian::Pdf(record, scatter.Direction()) : 0.0f;
+        scatterNormal = record.n;
+        throughput *= attenuation;
+        if (!Roulette(depth, throughput, rng)) {
+            break;
+        }
+        ray = scatter;
+        ++depth;
+        ++stats.secondary;
+        hit = scene.world->Hit(ray, 0.001f, 1e+38f, record);
+    }
+    if (cachedCount > 0) {
+        scene.cache->Add(cached, cachedCount, radiance);
+    }
+    return radiance;
+}
+
+INLINE XMVECTOR TracePath(const Ray& primary, const Scene &scene, int depth, RandomStream &rng) {
+    Hitable::Record record;
+    RayStats &stats = RayStats::Thread();
+    ++(depth == 0 ? stats.primary : stats.secondary);
+    bool hit = scene.world->Hit(primary, 0.001f, 1e+38f, record);
+    return ContinuePath(primary, hit, record, scene, depth, rng);
+}
+
+// shading of camera rays whose first hit was found by a packet traversal
+INLINE XMVECTOR TracePathFromHit(const Ray &primary, bool hit, const Hitable::Record &record, const Scene &scene, RandomStream &rng) {
+    return ContinuePath(primary, hit, record, scene, 0, rng);
+}
@@ -1,27 +1,35 @@
 #pragma once
 
+#include "Hitable.h"
 #include "Material.h"
+#include "Random.h"
 
-class Lambertian : public Material {
+class Lambertian {
 public:
-    Lambertian(const XMVECTOR &albedo)
-    {
-        mAlbedo = albedo;
+    INLINE static Material Create(const XMVECTOR &albedo) {
+        Material mat = {};
+        XMStoreFloat3(&mat.albedo, albedo);
+        mat.type = LambertianMat;
+        return mat;
     }
-    ~Lambertian(void) {
-    
-    }
-
-    virtual bool Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter);
 
-private:
-    XMVECTOR    mAlbedo;
+    static bool Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter);
+    // solid angle density Scatter draws direction with, cos / pi
+    static float Pdf(const Hitable::Record &record, const XMVECTOR &direction);
 };
 
-INLINE bool Lambertian::Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter) {
-    XMVECTOR target = record.p + record.n + RandomInUnitSphere();
-    scatter = Ray(record.p, target - record.p);
-    attenuation = mAlbedo;
+// The normal plus a point on the unit sphere is cosine distributed about the normal,
+// so the albedo alone is the weight and Pdf is exact for light sampling.
+INLINE bool Lambertian::Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter) {
+    XMVECTOR direction = record.n + rng.OnUnitSphere();
+    if (XMVectorGetX(XMVector3LengthSq(direction)) < 1e-8f) {
+        direction = record.n;
+    }
+    scatter = Ray(record.p, direction);
+    attenuation = XMLoadFloat3(&mat.albedo);
     return true;
 }
 
+INLINE float Lambertian::Pdf(const Hitable::Record &record, const XMVECTOR &direction) {
+    return std::max(XMVectorGetX(XMVector3Dot(record.n, direction)), 0.0f) * XM_1DIVPI;
+}
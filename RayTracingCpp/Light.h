@@ -0,0 +1,29 @@
+#pragma once
+
+// light type, same order as LightType of the DXR path tracer
+enum LightType : uint32_t {
+    DirectLight,
+    PointLight,
+    SpotLight,
+    LightTypeCount
+};
+
+// Same layout as Light of the DXR path tracer (SharedTypes.h), so one list can feed
+// both. All three types are delta lights: only a shadow ray can find them.
+struct Light {
+    uint32_t    type;
+    float       openAngle;      // spot: full cone angle in radians
+    float       penumbraAngle;  // spot: width of the fade at the rim of the cone
+    float       cosOpenAngle;   // spot: cosine of half the open angle
+    XMFLOAT3    position;       // point, spot
+    XMFLOAT3    direction;      // directional: the way light travels, spot: the cone axis
+    XMFLOAT3    intensity;
+};
+
+// One light as seen from a shading point.
+struct LightSample {
+    XMVECTOR    direction;  // towards the light, normalized
+    XMVECTOR    radiance;   // arriving along direction, without the cosine
+    float       distance;   // to the light along direction
+    float       pdf;        // solid angle density, 0 for delta lights
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "Light.h"
+#include "LightTree.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "Random.h"
+
+// The lights an integrator samples explicitly: delta lights in the layout of the DXR
+// path tracer, and emissive spheres, which are also hit by scattered rays and so get
+// combined with BSDF sampling by multiple importance sampling. Emissive triangles of a
+// mesh, any number of them, are put in a LightTree along with the point and spot lights;
+// emissive geometry that is not registered here is only found by scattering.
+class LightTable {
+public:
+    static constexpr uint32_t MaxEmitters = 64;
+
+    struct Emitter {
+        XMFLOAT3    center;
+        float       radius;
+        XMFLOAT3    emission;
+        uint32_t    matIndex;
+        float       power;      // luminance of the emission
+    };
+
+    LightTable(void)
+    : mTreeLights(0)
+    , mSkyScale(1.0f)
+    {
+
+    }
+    ~LightTable(void) {
+
+    }
+
+    INLINE uint32_t Add(const Light &light) {
+        mLights.push_back(light);
+        return static_cast<uint32_t>(mLights.size() - 1);
+    }
+    uint32_t AddDirect(const XMVECTOR &direction, const XMVECTOR &intensity);
+    uint32_t AddPoint(const XMVECTOR &position, const XMVECTOR &intensity);
+    uint32_t AddSpot(const XMVECTOR &position, const XMVECTOR &direction, float openAngle, float penumbraAngle, const XMVECTOR &intensity);
+    // Sphere has to carry the emissive material mat. Past MaxEmitters it is refused and
+    // left to be found by scattering alone.
+    INLINE bool AddEmitter(const Sphere &sphere, const Material &mat) {
+        if (mEmitters.size() == MaxEmitters) {
+            return false;
+        }
+        Emitter emitter;
+        XMStoreFloat3(&emitter.center, sphere.Center());
+        emitter.radius = sphere.Radius();
+        emitter.emission = mat.emission;
+        emitter.matIndex = sphere.MatIndex();
+        emitter.power = 0.2126f * mat.emission.x + 0.7152f * mat.emission.y + 0.0722f * mat.emission.z;
+        mEmitters.push_back(emitter);
+        return true;
+    }
+
+    INLINE uint32_t Count(void) const { return static_cast<uint32_t>(mLights.size()); }
+    INLINE uint32_t EmitterCount(void) const { return static_cast<uint32_t>(mEmitters.size()); }
+    INLINE bool Empty(void) const { return mLights.empty() && mEmitters.empty() && !mTree; }
+    INLINE const Light * Data(void) const { return mLights.data(); }
+
+    // Puts the emissive triangles of scene, with the materials a TriangleMesh added from
+    // materialBase, and the point and spot lights added so far in a LightTree; false when
+    // there is nothing to put in it. Lights added later are sampled one by one.
+    bool BuildTree(const Utils::Scene &scene, uint32_t materialBase, const MaterialTable &materials);
+    INLINE bool HasTree(void) const { return mTree != nullptr; }
+    INLINE uint32_t TreeCount(void) const { return mTree ? mTree->Count() : 0; }
+    // light index is picked through the tree, not sampled by Sample on its own
+    INLINE bool InTree(uint32_t index) const { return index < mTreeLights && mLights[index].type != DirectLight; }
+
+    // scales the sky a path escapes to, dim it to let the lights dominate
+    INLINE void SetSkyScale(float scale) { mSkyScale = scale; }
+    INLINE float SkyScale(void) const { return mSkyScale; }
+
+    // light index as seen from p, false when it does not reach p
+    bool Sample(uint32_t index, const XMVECTOR &p, LightSample &sample) const;
+    // A direction from p inside the cone of one emitter, uniform in solid angle. The
+    // emitter is picked in proportion to its emission times the solid angle it covers
+    // from p, a cheap guess at its contribution; always draws three numbers from rng.
+    bool SampleEmitter(const XMVECTOR &p, RandomStream &rng, LightSample &sample) const;
+    // One light of the tree for p with normal n, picked by a bound of its contribution;
+    // an emissive triangle is sampled uniformly over its area. Delta lights come with pdf
+    // 0 and their radiance over the probability of the pick. Always draws three numbers.
+    bool SampleTree(const XMVECTOR &p, const XMVECTOR &n, RandomStream &rng, LightSample &sample) const;
+    // density SampleEmitter or SampleTree give the direction from origin, with normal n,
+    // to the hit, 0 when the hit is not on a registered emitter
+    float EmitterPdf(const XMVECTOR &origin, const XMVECTOR &n, const Hitable::Record &record) const;
+
+private:
+    // selection weight of every emitter as seen from p, returns their sum
+    float Weights(const XMVECTOR &p, float *weights) const;
+
+    // 1 - cos of the half angle of the cone the sphere subtends from a point dist2 away
+    INLINE static float ConeSize(float dist2, float radius2) {
+        float sin2Max = radius2 / dist2;
+        // rather than 1 - sqrt(1 - sin2), which cancels for small or distant lights
+        return sin2Max / (1.0f + std::sqrt(std::max(0.0f, 1.0f - sin2Max)));
+    }
+
+    std::vector<Light>          mLights;
+    std::vector<Emitter>        mEmitters;
+    std::unique_ptr<LightTree>  mTree;
+    uint32_t                    mTreeLights;    // lights there were when the tree was built
+    float                       mSkyScale;
+};
+
+INLINE uint32_t LightTable::AddDirect(const XMVECTOR &direction, const XMVECTOR &intensity) {
+    Light light = {};
+    light.type = DirectLight;
+    XMStoreFloat3(&light.direction, XMVector3Normalize(direction));
+    XMStoreFloat3(&light.intensity, intensity);
+    return Add(light);
+}
+
+INLINE uint32_t LightTable::AddPoint(const XMVECTOR &position, const XMVECTOR &intensity) {
+    Light light = {};
+    light.type = PointLight;
+    XMStoreFloat3(&light.position, position);
+    XMStoreFloat3(&light.intensity, intensity);
+    return Add(light);
+}
+
+INLINE uint32_t LightTable::AddSpot(const XMVECTOR &position, const XMVECTOR &direction, float openAngle, float penumbraAngle, const XMVECTOR &intensity) {
+    Light light = {};
+    light.type = SpotLight;
+    light.openAngle = openAngle;
+    light.penumbraAngle = penumbraAngle;
+    light.cosOpenAngle = std::cos(openAngle * 0.5f);
+    XMStoreFloat3(&light.position, position);
+    XMStoreFloat3(&light.direction, XMVector3Normalize(direction));
+    XMStoreFloat3(&light.intensity, intensity);
+    return Add(light);
+}
+
+// the falloffs of EvaluateLight in Shading.hlsli
+INLINE bool LightTable::Sample(uint32_t index, const XMVECTOR &p, LightSample &sample) const {
+    const Light &light = mLights[index];
+    XMVECTOR intensity = XMLoadFloat3(&light.intensity);
+    sample.pdf = 0.0f;
+    if (light.type == DirectLight) {
+        sample.direction = -XMLoadFloat3(&light.direction);
+        sample.radiance = intensity;
+        sample.distance = 1e+38f;
+        return true;
+    }
+
+    XMVECTOR toLight = XMLoadFloat3(&light.position) - p;
+    float dist2 = XMVectorGetX(XMVector3LengthSq(toLight));
+    if (dist2 <= 1e-5f) {
+        return false;
+    }
+    sample.distance = std::sqrt(dist2);
+    sample.direction = toLight / sample.distance;
+    // the 1e-4 keeps the falloff finite next to the light
+    float falloff = 1.0f / (1e-4f + dist2);
+    if (light.type == SpotLight) {
+        float cosTheta = -XMVectorGetX(XMVector3Dot(sample.direction, XMLoadFloat3(&light.direction)));
+        if (cosTheta < light.cosOpenAngle) {
+            return false;
+        }
+        if (light.penumbraAngle > 0.0f) {
+            float theta = std::acos(std::min(cosTheta, 1.0f));
+            falloff *= std::max(std::min((light.openAngle * 0.5f - theta) / light.penumbraAngle, 1.0f), 0.0f);
+        }
+    }
+    sample.radiance = intensity * falloff;
+    return true;
+}
+
+INLINE float LightTable::Weights(const XMVECTOR &p, float *weights) const {
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < EmitterCount(); ++i) {
+        const Emitter &emitter = mEmitters[i];
+        float dist2 = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&emitter.center) - p));
+        float radius2 = emitter.radius * emitter.radius;
+        // inside an emitter it can not be sampled
+        weights[i] = dist2 > radius2 ? emitter.power * ConeSize(dist2, radius2) : 0.0f;
+        sum += weights[i];
+    }
+    return sum;
+}
+
+INLINE bool LightTable::SampleEmitter(const XMVECTOR &p, RandomStream &rng, LightSample &sample) const {
+    float pick = rng.NextFloat();
+    float u1 = rng.NextFloat();
+    float u2 = rng.NextFloat();
+
+    float weights[MaxEmitters];
+    float sum = Weights(p, weights);
+    if (sum <= 0.0f) {
+        return false;
+    }
+    uint32_t index = 0;
+    float target = pick * sum;
+    while (index + 1 < EmitterCount() && target >= weights[index]) {
+        target -= weights[index++];
+    }
+    // rounding can walk past the last emitter with a weight
+    while (weights[index] <= 0.0f) {
+        --index;
+    }
+
+    const Emitter &emitter = mEmitters[index];
+    XMVECTOR axis = XMLoadFloat3(&emitter.center) - p;
+    float dist2 = XMVectorGetX(XMVector3LengthSq(axis));
+    float radius2 = emitter.radius * emitter.radius;
+    float dist = std::sqrt(dist2);
+    float coneSize = ConeSize(dist2, radius2);
+    float cosTheta = 1.0f - u1 * coneSize;
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = XM_2PI * u2;
+
+    // frame around the axis, Duff et al. "Building an Orthonormal Basis, Revisited"
+    XMFLOAT3 w;
+    XMStoreFloat3(&w, axis / dist);
+    float sign = std::copysign(1.0f, w.z);
+    float a = -1.0f / (sign + w.z);
+    float b = w.x * w.y * a;
+    XMVECTOR t = XMVectorSet(1.0f + sign * w.x * w.x * a, sign * b, -sign * w.x, 0.0f);
+    XMVECTOR s = XMVectorSet(b, sign + w.y * w.y * a, -w.y, 0.0f);
+
+    sample.direction = XMVector3Normalize(t * (sinTheta * std::cos(phi)) + s * (sinTheta * std::sin(phi)) + XMLoadFloat3(&w) * cosTheta);
+    // near intersection with the sphere, the ray is inside the cone so it hits
+    sample.distance = dist * cosTheta - std::sqrt(std::max(0.0f, radius2 - dist2 * sinTheta * sinTheta));
+    sample.radiance = XMLoadFloat3(&emitter.emission);
+    // weights[index] / sum to pick it, times 1 / (2 pi coneSize) in its cone
+    sample.pdf = emitter.power / (sum * XM_2PI);
+    return true;
+}
+
+INLINE bool LightTable::BuildTree(const Utils::Scene &scene, uint32_t materialBase, const MaterialTable &materials) {
+    std::unique_ptr<LightTree> tree(new LightTree());
+    if (!tree->Build(scene, materialBase, materials, mLights.data(), Count())) {
+        return false;
+    }
+    mTree = std::move(tree);
+    mTreeLights = Count();
+    return true;
+}
+
+INLINE bool LightTable::SampleTree(const XMVECTOR &p, const XMVECTOR &n, RandomStream &rng, LightSample &sample) const {
+    float pick = rng.NextFloat();
+    float u1 = rng.NextFloat();
+    float u2 = rng.NextFloat();
+
+    uint32_t index;
+    float pmf;
+    if (!mTree->Pick(p, n, pick, index, pmf) || pmf <= 0.0f) {
+        return false;
+    }
+    const LightTree::Entry &entry = mTree->Get(index);
+    if (entry.light != LightTree::InvalidLight) {
+        if (!Sample(entry.light, p, sample)) {
+            return false;
+        }
+        sample.radiance /= pmf;
+        return true;
+    }
+
+    // uniform over the triangle, its density over area turned to one over solid angle
+    float root = std::sqrt(u1);
+    XMVECTOR edge1 = XMLoadFloat3(&entry.edge1);
+    XMVECTOR edge2 = XMLoadFloat3(&entry.edge2);
+    XMVECTOR toLight = XMLoadFloat3(&entry.p0) + edge1 * (root * (1.0f - u2)) + edge2 * (root * u2) - p;
+    float dist2 = XMVectorGetX(XMVector3LengthSq(toLight));
+    if (dist2 <= 0.0f) {
+        return false;
+    }
+    sample.distance = std::sqrt(dist2);
+    sample.direction = toLight / sample.distance;
+    XMVECTOR normal = XMVector3Cross(edge1, edge2);
+    float cosLight = std::fabs(XMVectorGetX(XMVector3Dot(sample.direction, normal))) / (2.0f * entry.area);
+    if (cosLight <= 1e-6f) {
+        return false;
+    }
+    sample.radiance = XMLoadFloat3(&entry.emission);
+    sample.pdf = pmf * dist2 / (entry.area * cosLight);
+    return true;
+}
+
+INLINE float LightTable::EmitterPdf(const XMVECTOR &origin, const XMVECTOR &n, const Hitable::Record &record) const {
+    if (mTree) {
+        uint32_t index = mTree->TriangleLight(record.primIndex, record.matIndex);
+        if (index != LightTree::InvalidLight) {
+            const LightTree::Entry &entry = mTree->Get(index);
+            XMVECTOR toLight = record.p - origin;
+            float dist2 = XMVectorGetX(XMVector3LengthSq(toLight));
+            XMVECTOR normal = XMVector3Cross(XMLoadFloat3(&entry.edge1), XMLoadFloat3(&entry.edge2));
+            float cosLight = std::fabs(XMVectorGetX(XMVector3Dot(toLight, normal))) / (2.0f * entry.area * std::sqrt(dist2));
+            return cosLight > 1e-6f ? mTree->Pmf(origin, n, index) * dist2 / (entry.area * cosLight) : 0.0f;
+        }
+    }
+    for (uint32_t i = 0; i < EmitterCount(); ++i) {
+        const Emitter &emitter = mEmitters[i];
+        if (emitter.matIndex != record.matIndex) {
+            continue;
+        }
+        XMVECTOR center = XMLoadFloat3(&emitter.center);
+        float offset = XMVectorGetX(XMVector3Length(record.p - center)) - emitter.radius;
+        if (std::fabs(offset) > 1e-3f * emitter.radius) {
+            continue;
+        }
+        float weights[MaxEmitters];
+        float sum = Weights(origin, weights);
+        return weights[i] > 0.0f ? emitter.power / (sum * XM_2PI) : 0.0f;
+    }
+    return 0.0f;
+}
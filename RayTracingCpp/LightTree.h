@@ -0,0 +1,460 @@
+#pragma once
+
+#include "AABB.h"
+#include "Light.h"
+#include "MaterialTable.h"
+#include "Framework/Utils/Model.h"
+
+// Many light sampling after Conty Estevez and Kulla, "Importance Sampling of Many Lights
+// with Adaptive Tree Splitting", in the form pbrt-v4's BVHLightSampler gives it. Emissive
+// triangles and point and spot lights are bound by a BVH whose nodes also carry the power
+// below them and a cone around their normals. A shading point walks down choosing either
+// child by a bound of what it could receive from it, so a light is picked in O(log N)
+// with a probability that follows its contribution, and the probability of any light is
+// found again by the same walk. Directional lights have no place to be bound and stay
+// with the LightTable.
+class LightTree {
+public:
+    static constexpr uint32_t InvalidLight = 0xFFFFFFFF;
+
+    // a light of the tree, an emissive triangle or a light of the table
+    struct Entry {
+        uint32_t    light;      // index into the lights of Build, InvalidLight for a triangle
+        uint32_t    matIndex;
+        float       area;
+        XMFLOAT3    p0;
+        XMFLOAT3    edge1;
+        XMFLOAT3    edge2;
+        XMFLOAT3    emission;
+    };
+
+    LightTree(void) {
+
+    }
+    ~LightTree(void) {
+
+    }
+
+    // The emissive triangles of scene, as a TriangleMesh added its materials from
+    // materialBase, and the point and spot lights of lights; false when none emits.
+    // Textured emission is not sampled on the CPU, emissiveFactor is what a triangle gives.
+    bool Build(const Utils::Scene &scene, uint32_t materialBase, const MaterialTable &materials, const Light *lights, uint32_t lightCount);
+
+    INLINE uint32_t Count(void) const { return static_cast<uint32_t>(mEntries.size()); }
+    INLINE const Entry & Get(uint32_t entry) const { return mEntries[entry]; }
+    // the entry of triangle primIndex of the mesh, InvalidLight when it does not emit
+    INLINE uint32_t TriangleLight(uint32_t primIndex, uint32_t matIndex) const {
+        if (primIndex >= mTriangleLights.size() || mTriangleLights[primIndex] == InvalidLight) {
+            return InvalidLight;
+        }
+        uint32_t entry = mTriangleLights[primIndex];
+        return mEntries[entry].matIndex == matIndex ? entry : InvalidLight;
+    }
+
+    // An entry for the point p with normal n, n zero for none, picked with probability
+    // pmf; u is a uniform number. False when nothing in the tree can light p.
+    bool Pick(const XMVECTOR &p, const XMVECTOR &n, float u, uint32_t &entry, float &pmf) const;
+    // probability of Pick returning entry for p and n
+    float Pmf(const XMVECTOR &p, const XMVECTOR &n, uint32_t entry) const;
+
+private:
+    static constexpr int BucketCount = 12;
+    // past this depth nodes split at the median, so up to 2^24 lights more fit the 64
+    // choices of a trail
+    static constexpr int MedianDepth = 40;
+    static constexpr uint32_t Leaf = 1;
+    static constexpr uint32_t TwoSided = 2;
+
+    // lights bound together: the box they are in, a cone around their normals (half
+    // angle thetaO) and how far past the normals they emit (thetaE)
+    struct Bounds {
+        AABB        box;
+        XMVECTOR    axis;
+        float       cosThetaO;
+        float       cosThetaE;
+        float       power;
+        bool        twoSided;
+
+        INLINE XMVECTOR Centroid(void) const { return box.Centroid(); }
+        void Merge(const Bounds &other);
+    };
+
+    struct Node {
+        XMFLOAT3    min;
+        float       power;
+        XMFLOAT3    max;
+        float       cosThetaO;
+        XMFLOAT3    axis;
+        float       cosThetaE;
+        uint32_t    offset;     // leaf: the entry, interior: the second child, the first follows
+        uint32_t    flags;
+    };
+
+    uint32_t BuildNode(const std::vector<Bounds> &bounds, uint32_t *order, uint32_t count, uint64_t trail, int depth);
+    // the surface area orientation heuristic of a split candidate within box along axis
+    static float Cost(const Bounds &bounds, const AABB &box, int axis);
+    // bound of what p with normal n can receive from the lights of node
+    float Importance(const XMVECTOR &p, const XMVECTOR &n, const Node &node) const;
+
+    INLINE static float SafeAcos(float x) { return std::acos(std::min(std::max(x, -1.0f), 1.0f)); }
+    INLINE static float SafeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+    // cos(max(0, a - b)) from the sines and cosines of a and b
+    INLINE static float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+    }
+    INLINE static float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+    }
+
+    std::vector<Entry>      mEntries;
+    std::vector<Node>       mNodes;
+    std::vector<uint64_t>   mTrails;            // per entry, bit i: the child taken at depth i
+    std::vector<uint32_t>   mTriangleLights;    // per triangle of the mesh
+};
+
+INLINE bool LightTree::Build(const Utils::Scene &scene, uint32_t materialBase, const MaterialTable &materials, const Light *lights, uint32_t lightCount) {
+    static const XMVECTOR luminance = { 0.2126f, 0.7152f, 0.0722f, 0.0f };
+    mEntries.clear();
+    mNodes.clear();
+    mTrails.clear();
+    mTriangleLights.assign(scene.mIndices.size() / 3, InvalidLight);
+
+    std::vector<Bounds> bounds;
+    for (auto &shape : scene.mShapes) {
+        uint32_t matIndex = materialBase + shape.materialIndex;
+        const Material &mat = materials.Get(matIndex);
+        float power = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&mat.emission), luminance));
+        if (power <= 0.0f) {
+            continue;
+        }
+        uint32_t first = shape.indexOffset / 3;
+        for (uint32_t t = first; t < first + shape.indexCount / 3; ++t) {
+            const uint32_t *index = &scene.mIndices[t * 3];
+            XMVECTOR p0 = XMLoadFloat3(&scene.mVertices[index[0]].position);
+            XMVECTOR p1 = XMLoadFloat3(&scene.mVertices[index[1]].position);
+            XMVECTOR p2 = XMLoadFloat3(&scene.mVertices[index[2]].position);
+            XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+            float length = XMVectorGetX(XMVector3Length(normal));
+            if (length <= 0.0f) {
+                continue;
+            }
+            Entry entry;
+            entry.light = InvalidLight;
+            entry.matIndex = matIndex;
+            entry.area = 0.5f * length;
+            XMStoreFloat3(&entry.p0, p0);
+            XMStoreFloat3(&entry.edge1, p1 - p0);
+            XMStoreFloat3(&entry.edge2, p2 - p0);
+            entry.emission = mat.emission;
+            mTriangleLights[t] = Count();
+            mEntries.push_back(entry);
+
+            // meshes are two sided, pi L A leaves either side
+            Bounds b;
+            b.box.Merge(p0);
+            b.box.Merge(p1);
+            b.box.Merge(p2);
+            b.axis = normal / length;
+            b.cosThetaO = 1.0f;
+            b.cosThetaE = 0.0f;
+            b.power = 2.0f * XM_PI * power * entry.area;
+            b.twoSided = true;
+            bounds.push_back(b);
+        }
+    }
+    for (uint32_t i = 0; i < lightCount; ++i) {
+        const Light &light = lights[i];
+        float power = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&light.intensity), luminance));
+        if (light.type == DirectLight || power <= 0.0f) {
+            continue;
+        }
+        Entry entry = {};
+        entry.light = i;
+        entry.matIndex = InvalidLight;
+        mEntries.push_back(entry);
+
+        Bounds b;
+        b.box.Merge(XMLoadFloat3(&light.position));
+        b.twoSided = false;
+        if (light.type == SpotLight) {
+            // full intensity inside the penumbra, fading to nothing at the rim
+            float outer = light.openAngle * 0.5f;
+            float inner = std::max(outer - light.penumbraAngle, 0.0f);
+            b.axis = XMLoadFloat3(&light.direction);
+            b.cosThetaO = std::cos(inner);
+            b.cosThetaE = std::cos(outer - inner);
+            b.power = XM_2PI * (1.0f - std::cos(outer)) * power;
+        } else {
+            b.axis = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+            b.cosThetaO = -1.0f;
+            b.cosThetaE = 0.0f;
+            b.power = 4.0f * XM_PI * power;
+        }
+        bounds.push_back(b);
+    }
+    if (mEntries.empty()) {
+        return false;
+    }
+
+    mTrails.resize(mEntries.size());
+    std::vector<uint32_t> order(mEntries.size());
+    for (uint32_t i = 0; i < Count(); ++i) {
+        order[i] = i;
+    }
+    mNodes.reserve(2 * mEntries.size() - 1);
+    BuildNode(bounds, order.data(), Count(), 0, 0);
+    return true;
+}
+
+INLINE void LightTree::Bounds::Merge(const Bounds &other) {
+    // the cone around both cones, DirectionCone Union of pbrt-v4
+    XMVECTOR otherAxis = other.axis;
+    float thetaA = SafeAcos(cosThetaO);
+    float thetaB = SafeAcos(other.cosThetaO);
+    float dot = XMVectorGetX(XMVector3Dot(axis, otherAxis));
+    float thetaD = dot < 0.0f ? XM_PI - 2.0f * std::asin(std::min(XMVectorGetX(XMVector3Length(axis + otherAxis)) * 0.5f, 1.0f))
+                              : 2.0f * std::asin(std::min(XMVectorGetX(XMVector3Length(otherAxis - axis)) * 0.5f, 1.0f));
+    if (std::min(thetaD + thetaA, XM_PI) <= thetaB) {
+        axis = otherAxis;
+        cosThetaO = other.cosThetaO;
+    } else if (std::min(thetaD + thetaB, XM_PI) > thetaA) {
+        float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+        XMVECTOR turn = XMVector3Cross(axis, otherAxis);
+        float turnLength = XMVectorGetX(XMVector3Length(turn));
+        if (thetaO >= XM_PI || turnLength <= 0.0f) {
+            cosThetaO = -1.0f;
+        } else {
+            // axis turned by thetaR towards otherAxis; turn is normal to it
+            float thetaR = thetaO - thetaA;
+            axis = XMVector3Normalize(axis * std::cos(thetaR) + XMVector3Cross(turn / turnLength, axis) * std::sin(thetaR));
+            cosThetaO = std::cos(thetaO);
+        }
+    }
+    box.Merge(other.box);
+    cosThetaE = std::min(cosThetaE, other.cosThetaE);
+    power += other.power;
+    twoSided = twoSided || other.twoSided;
+}
+
+INLINE float LightTree::Cost(const Bounds &bounds, const AABB &box, int axis) {
+    float thetaO = SafeAcos(bounds.cosThetaO);
+    float thetaE = SafeAcos(bounds.cosThetaE);
+    float thetaW = std::min(thetaO + thetaE, XM_PI);
+    float sinThetaO = SafeSqrt(1.0f - bounds.cosThetaO * bounds.cosThetaO);
+    float orientation = XM_2PI * (1.0f - bounds.cosThetaO)
+                      + XM_PIDIV2 * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + bounds.cosThetaO);
+    // long thin boxes are split across their length
+    XMFLOAT3 diagonal;
+    XMStoreFloat3(&diagonal, box.Max() - box.Min());
+    float extent = (&diagonal.x)[axis];
+    float regularize = extent > 0.0f ? std::max(diagonal.x, std::max(diagonal.y, diagonal.z)) / extent : 1.0f;
+    return bounds.power * orientation * regularize * bounds.box.SurfaceArea();
+}
+
+inline uint32_t LightTree::BuildNode(const std::vector<Bounds> &bounds, uint32_t *order, uint32_t count, uint64_t trail, int depth) {
+    uint32_t index = static_cast<uint32_t>(mNodes.size());
+    mNodes.emplace_back();
+    Bounds node = bounds[order[0]];
+    AABB centroids;
+    centroids.Merge(node.Centroid());
+    for (uint32_t i = 1; i < count; ++i) {
+        node.Merge(bounds[order[i]]);
+        centroids.Merge(bounds[order[i]].Centroid());
+    }
+
+    Node &stored = mNodes[index];
+    XMStoreFloat3(&stored.min, node.box.Min());
+    XMStoreFloat3(&stored.max, node.box.Max());
+    XMStoreFloat3(&stored.axis, node.axis);
+    stored.power = node.power;
+    stored.cosThetaO = node.cosThetaO;
+    stored.cosThetaE = node.cosThetaE;
+    stored.flags = node.twoSided ? TwoSided : 0;
+    if (count == 1) {
+        stored.offset = order[0];
+        stored.flags |= Leaf;
+        mTrails[order[0]] = trail;
+        return index;
+    }
+
+    // binned over the centroids, the cheapest split of all three axes
+    XMFLOAT3 low, high;
+    XMStoreFloat3(&low, centroids.Min());
+    XMStoreFloat3(&high, centroids.Max());
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    auto BucketOf = [&](uint32_t light, int axis) {
+        float lo = (&low.x)[axis];
+        float extent = (&high.x)[axis] - lo;
+        XMFLOAT3 c;
+        XMStoreFloat3(&c, bounds[light].Centroid());
+        return std::min(static_cast<int>(BucketCount * ((&c.x)[axis] - lo) / extent), BucketCount - 1);
+    };
+    for (int axis = 0; axis < 3 && depth < MedianDepth; ++axis) {
+        if ((&high.x)[axis] <= (&low.x)[axis]) {
+            continue;
+        }
+        Bounds buckets[BucketCount];
+        bool used[BucketCount] = {};
+        for (uint32_t i = 0; i < count; ++i) {
+            int b = BucketOf(order[i], axis);
+            if (used[b]) {
+                buckets[b].Merge(bounds[order[i]]);
+            } else {
+                buckets[b] = bounds[order[i]];
+                used[b] = true;
+            }
+        }
+        // costs of everything above each split, swept from the top
+        float above[BucketCount];
+        Bounds sweep;
+        bool any = false;
+        for (int b = BucketCount - 1; b > 0; --b) {
+            if (used[b]) {
+                if (any) {
+                    sweep.Merge(buckets[b]);
+                } else {
+                    sweep = buckets[b];
+                    any = true;
+                }
+            }
+            above[b] = any ? Cost(sweep, node.box, axis) : -1.0f;
+        }
+        any = false;
+        for (int b = 0; b < BucketCount - 1; ++b) {
+            if (used[b]) {
+                if (any) {
+                    sweep.Merge(buckets[b]);
+                } else {
+                    sweep = buckets[b];
+                    any = true;
+                }
+            }
+            if (!any || above[b + 1] < 0.0f) {
+                continue;
+            }
+            float cost = Cost(sweep, node.box, axis) + above[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    uint32_t half = 0;
+    if (bestAxis >= 0) {
+        half = static_cast<uint32_t>(std::partition(order, order + count, [&](uint32_t light) { return BucketOf(light, bestAxis) <= bestSplit; }) - order);
+    }
+    if (half == 0 || half == count) {
+        // nothing to tell them apart by, or deep enough to keep the depth bounded
+        XMFLOAT3 extent;
+        XMStoreFloat3(&extent, centroids.Max() - centroids.Min());
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        half = count / 2;
+        std::nth_element(order, order + half, order + count, [&](uint32_t a, uint32_t b) {
+            return XMVectorGetByIndex(bounds[a].Centroid(), axis) < XMVectorGetByIndex(bounds[b].Centroid(), axis);
+        });
+    }
+    BuildNode(bounds, order, half, trail, depth + 1);
+    uint32_t second = BuildNode(bounds, order + half, count - half, trail | (uint64_t(1) << depth), depth + 1);
+    mNodes[index].offset = second;
+    return index;
+}
+
+INLINE float LightTree::Importance(const XMVECTOR &p, const XMVECTOR &n, const Node &node) const {
+    XMVECTOR min = XMLoadFloat3(&node.min);
+    XMVECTOR max = XMLoadFloat3(&node.max);
+    XMVECTOR center = (min + max) * 0.5f;
+    XMVECTOR toPoint = p - center;
+    float dist2 = XMVectorGetX(XMVector3LengthSq(toPoint));
+    float radius2 = XMVectorGetX(XMVector3LengthSq(max - center));
+    // not closer than the size of the box, lights in it may be anywhere
+    float falloff2 = std::max(dist2, std::sqrt(radius2));
+    if (falloff2 <= 0.0f) {
+        return 0.0f;
+    }
+    XMVECTOR wi = dist2 > 0.0f ? toPoint / std::sqrt(dist2) : XMVectorZero();
+
+    float cosThetaW = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&node.axis), wi));
+    if (node.flags & TwoSided) {
+        cosThetaW = std::fabs(cosThetaW);
+    }
+    float sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+    // half angle of the cone the bounding sphere of the box fills as seen from p
+    float cosThetaB = dist2 > radius2 ? SafeSqrt(1.0f - radius2 / dist2) : -1.0f;
+    float sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+    float sinThetaO = SafeSqrt(1.0f - node.cosThetaO * node.cosThetaO);
+
+    // the smallest angle between p and a normal of the cone, over the whole box
+    float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosThetaO);
+    float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosThetaO);
+    float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= node.cosThetaE) {
+        return 0.0f;
+    }
+    float importance = node.power * cosThetaP / falloff2;
+    if (!XMVector3Equal(n, XMVectorZero())) {
+        float cosThetaI = std::fabs(XMVectorGetX(XMVector3Dot(wi, n)));
+        float sinThetaI = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+        importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+    return std::max(importance, 0.0f);
+}
+
+INLINE bool LightTree::Pick(const XMVECTOR &p, const XMVECTOR &n, float u, uint32_t &entry, float &pmf) const {
+    if (mNodes.empty()) {
+        return false;
+    }
+    uint32_t index = 0;
+    pmf = 1.0f;
+    for (;;) {
+        const Node &node = mNodes[index];
+        if (node.flags & Leaf) {
+            entry = node.offset;
+            return true;
+        }
+        float first = Importance(p, n, mNodes[index + 1]);
+        float second = Importance(p, n, mNodes[node.offset]);
+        if (first <= 0.0f && second <= 0.0f) {
+            return false;
+        }
+        // u is stretched over the child taken, to serve the next level
+        float p0 = first / (first + second);
+        if (u < p0) {
+            index = index + 1;
+            pmf *= p0;
+            u = std::min(u / p0, 0.99999994f);
+        } else {
+            index = node.offset;
+            pmf *= 1.0f - p0;
+            u = std::min((u - p0) / (1.0f - p0), 0.99999994f);
+        }
+    }
+}
+
+INLINE float LightTree::Pmf(const XMVECTOR &p, const XMVECTOR &n, uint32_t entry) const {
+    uint64_t trail = mTrails[entry];
+    uint32_t index = 0;
+    float pmf = 1.0f;
+    for (;;) {
+        const Node &node = mNodes[index];
+        if (node.flags & Leaf) {
+            return pmf;
+        }
+        float first = Importance(p, n, mNodes[index + 1]);
+        float second = Importance(p, n, mNodes[node.offset]);
+        if (first <= 0.0f && second <= 0.0f) {
+            return 0.0f;
+        }
+        if (trail & 1) {
+            pmf *= second / (first + second);
+            index = node.offset;
+        } else {
+            pmf *= first / (first + second);
+            index = index + 1;
+        }
+        trail >>= 1;
+    }
+}
@@ -1,136 +1,354 @@
 
 #include "pch.h"
-#include "Ray.h"
-#include "Sphere.h"
-#include "HitableList.h"
-#include "Camera.h"
-#include "Lambertian.h"
-#include "Metal.h"
-#include "Dielectric.h"
+#include "Integrators.h"
+#include "SceneSetup.h"
+#include "TileRenderer.h"
+#include "ImageWriter.h"
+#include "AsyncImageWriter.h"
+#include "Benchmark.h"
+#include "DXRRenderer.h"
+#include "Denoiser.h"
 
 static constexpr int nx = 600;
 static constexpr int ny = 400;
 static constexpr int ns = 100;
-static constexpr int maxDepth = 50;
-
-XMVECTOR CalculateColor(const Ray& ray, Hitable *world, int depth) {
-    static XMVECTOR white = {1.0f, 1.0f, 1.0f, 0.0f};
-    static XMVECTOR blue = {0.5f, 0.7f, 1.0f, 0.0f};
-    Hitable::Record record;
-    if (world->Hit(ray, 0.001f, 1e+38f, record)) {
-        XMVECTOR attenuation;
-        Ray scatter;
-        if (depth < maxDepth && record.mat->Scatter(ray, record, attenuation, scatter)) {
-            return attenuation * CalculateColor(scatter, world, depth + 1);
-        } else {
-            return { 0.0f, 0.0f, 0.0f };
+static constexpr int tileSize = 32;
+
+// Renders a model with the CPU port of the DXR path tracer: ns accumulated frames of
+// one sample per pixel, as PtExample renders them with the camera held still.
+static int RenderDXR(const std::string &modelFile, int threadCount, ImageWriter &output) {
+    std::unique_ptr<Utils::Scene> model(Utils::Model::LoadFromFile(modelFile.c_str()));
+    if (!model) {
+        std::cerr << "Can not load " << modelFile << std::endl;
+        return 1;
+    }
+    std::unique_ptr<DXRScene> scene(DXRScene::Create(*model));
+    std::cout << "Loaded " << modelFile << ": " << scene->TriangleCount() << " triangles, " << scene->GeometryCount() << " geometries\n";
+
+    DXRRenderer renderer(*scene, nx, ny, tileSize, threadCount);
+    renderer.FrameScene();
+    renderer.Accumulate(ns);
+
+    // the linear average, the post pass of the GPU is left to the writer
+    std::vector<XMFLOAT4> pixels(size_t(nx) * ny);
+    for (int y = 0; y < ny; ++y) {
+        for (int x = 0; x < nx; ++x) {
+            XMFLOAT4 sum = renderer.RenderTarget(x, y);
+            pixels[size_t(y) * nx + x] = XMFLOAT4(sum.x / sum.w, sum.y / sum.w, sum.z / sum.w, 1.0f);
         }
-    } else {
-        XMVECTOR direction = XMVector3Normalize(ray.Direction());
-        float t = (XMVectorGetY(direction) + 1.0f) * 0.5f;
-        return white * (1.0f - t) + blue * t;
     }
+    Tile image = { 0, 0, 0, 0, nx, ny };
+    output.WriteTile(image, pixels.data());
+
+    const RayStats &rays = renderer.Rays();
+    std::cout << ns << " frames on " << renderer.ThreadCount() << " threads: " << renderer.RenderSeconds() << " s, "
+              << (rays.primary + rays.secondary) / renderer.RenderSeconds() / 1e6 << " Mrays/s\n";
+    return 0;
 }
 
-void RandomScene(std::vector<Hitable *> &hitables, std::vector<Material *> &materials) {
-    Material *mat;
-    Hitable *obj;
-
-    {
-        mat = new Lambertian({ 0.5f, 0.5f, 0.5f });
-        obj = new Sphere({ 0.0f, -1000.0f, 0.0f }, 1000.0f, mat);
-        hitables.push_back(obj);
-        materials.push_back(mat);
-    }
-
-    for (int a = -11; a < 11; ++a) {
-        for (int b = -11; b < 11; ++b) {
-            float chooseMat = RandomUnit();
-            XMVECTOR center = { float(a) + 0.9f * RandomUnit(), 0.2f, float(b) + 0.9f * RandomUnit() };
-            XMVECTOR x = { 4.0f, 0.2f, 0.0f };
-            if (XMVectorGetX(XMVector3Length(center - x)) > 0.9f) {
-                if (chooseMat < 0.8f) { // lambertian
-                    mat = new Lambertian({ RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit() });
-                } else if (chooseMat < 0.95f) { // metal
-                    mat = new Metal({ 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()) }, 0.5f * RandomUnit());
-                } else { // glass
-                    mat = new Dielectric(1.5f);
-                }
-                obj = new Sphere(center, 0.2f, mat);
-                hitables.push_back(obj);
-                materials.push_back(mat);
+int main(int argc, char *argv[]) {
+    int threadCount = 0; // 0: one per hardware thread
+    std::string file("output.ppm"); // .ppm, or linear .pfm / .exr
+    float targetError = 0.0f; // > 0: adaptive sampling with ns as the average budget
+    std::string modelFile; // a mesh loaded through Utils::Model instead of the sphere scene
+    int instances = 0; // > 0: that many instanced props instead of the sphere scene
+    bool lit = false; // the sphere scene at night, lit by sampled lights
+    std::string envFile; // a lat-long HDR lighting the scene instead of the sky gradient
+    int cacheDepth = 0; // > 0: paths end on the radiance cache after that many diffuse bounces
+    SamplerType sampler = IndependentSampler; // independent, stratified, sobol or bluenoise
+    TileRenderer::ShadeFunc shade = TracePath;
+    bool packets = false; // camera rays of 4x4 pixel blocks traced together
+    bool wavefront = false; // bounces of large path batches run stage by stage
+    bool dxr = false; // the model through the CPU port of the DXR path tracer
+    int samples = ns; // spp, or the average budget when adaptive
+    bool denoise = false; // the frame filtered with its first hit features before it is written
+    BVHBuildType build = SAHBuild; // sah, parallel, treelet or morton, best trees to fastest builds
+    double budget = 0.0; // > 0: progressive passes until the next one would run over, seconds
+    float noise = 0.0f; // > 0: progressive passes until the mean relative error is down to it
+    std::string checkpointFile; // progressive, resumed from and saved to after every pass
+    bool sppGiven = false; // caps progressive passes, which otherwise only stop at budget or noise
+    int workers = 0; // > 0: the frame rendered by that many worker processes
+    int jobSamples = 0; // samples of a pixel per distributed job, 0: all of a tile in one job
+    bool scaling = false; // the distributed frame rendered by 1 up to workers workers
+    std::string workerBoard; // a worker process, rendering the jobs of that board
+    int workerSlot = 0;
+    std::string bench; // bvh, bvh8, refit or build: a BVHBenchmark instead of a render
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threadCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-recursive") == 0) {
+            shade = CalculateColor;
+        } else if (strcmp(argv[i], "-packets") == 0) {
+            packets = true;
+        } else if (strcmp(argv[i], "-wavefront") == 0) {
+            wavefront = true;
+        } else if (strcmp(argv[i], "-adaptive") == 0 && i + 1 < argc) {
+            targetError = float(atof(argv[++i]));
+        } else if (strcmp(argv[i], "-sampler") == 0 && i + 1 < argc) {
+            if (!SamplerSettings::Parse(argv[++i], sampler)) {
+                std::cerr << "Unknown sampler: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-model") == 0 && i + 1 < argc) {
+            modelFile = argv[++i];
+        } else if (strcmp(argv[i], "-dxr") == 0) {
+            dxr = true;
+        } else if (strcmp(argv[i], "-spp") == 0 && i + 1 < argc) {
+            samples = std::max(atoi(argv[++i]), 1);
+            sppGiven = true;
+        } else if (strcmp(argv[i], "-denoise") == 0) {
+            denoise = true;
+        } else if (strcmp(argv[i], "-bvh") == 0 && i + 1 < argc) {
+            if (!BVHBuildSettings::Parse(argv[++i], build)) {
+                std::cerr << "Unknown BVH build: " << argv[i] << std::endl;
+                return 1;
             }
+        } else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-noise") == 0 && i + 1 < argc) {
+            noise = float(atof(argv[++i]));
+        } else if (strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) {
+            checkpointFile = argv[++i];
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-job-spp") == 0 && i + 1 < argc) {
+            jobSamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-scaling") == 0) {
+            scaling = true;
+        } else if (strcmp(argv[i], "-worker") == 0 && i + 2 < argc) {
+            workerBoard = argv[++i];
+            workerSlot = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-env") == 0 && i + 1 < argc) {
+            envFile = argv[++i];
+        } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+            cacheDepth = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "-lit") == 0) {
+            lit = true;
+        } else if (strcmp(argv[i], "-instances") == 0 && i + 1 < argc) {
+            instances = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            file = argv[++i];
+        } else if (strcmp(argv[i], "-bench-bvh") == 0) {
+            bench = "bvh";
+        } else if (strcmp(argv[i], "-bench-bvh8") == 0) {
+            bench = "bvh8";
+        } else if (strcmp(argv[i], "-bench-refit") == 0) {
+            bench = "refit";
+        } else if (strcmp(argv[i], "-bench-build") == 0) {
+            bench = "build";
         }
     }
 
-    {
-        mat = new Dielectric(1.5f);
-        obj = new Sphere({ 0.0f, 1.0f, 0.0f }, 1.0f, mat);
-        hitables.push_back(obj);
-        materials.push_back(mat);
+    if (!bench.empty()) {
+        BVHBenchmark benchmark;
+        if (bench == "bvh8") {
+            benchmark.RunWide(std::cout);
+        } else if (bench == "refit") {
+            benchmark.RunRefit(std::cout);
+        } else if (bench == "build") {
+            benchmark.RunBuild(std::cout, threadCount);
+        } else {
+            benchmark.Run(std::cout);
+        }
+        return 0;
     }
 
-    {
-        mat = new Lambertian({ 0.4f, 0.2f, 0.1f });
-        obj = new Sphere({ -4.0f, 1.0f, 0.0f }, 1.0f, mat);
-        hitables.push_back(obj);
-        materials.push_back(mat);
+    bool progressive = budget > 0.0 || noise > 0.0f || !checkpointFile.empty();
+    if (workers > 0 && (progressive || denoise || targetError > 0.0f || dxr)) {
+        std::cerr << "-workers renders a fixed spp frame, without -budget, -noise, -checkpoint, -denoise, -adaptive or -dxr" << std::endl;
+        return 1;
+    }
+    // what the cache gives a pixel depends on what other threads cached before, the workers
+    // would not merge into one frame nor would a resumed render go on with the same samples
+    if (cacheDepth > 0 && (workers > 0 || !checkpointFile.empty())) {
+        std::cerr << "-cache renders are not repeatable, they can not use -workers or -checkpoint" << std::endl;
+        return 1;
     }
 
-    {
-        mat = new Metal({ 0.7f, 0.6f, 0.5f }, 0.0f);
-        obj = new Sphere({ 4.0f, 1.0f, 0.0f }, 1.0f, mat);
-        hitables.push_back(obj);
-        materials.push_back(mat);
+    std::unique_ptr<ImageWriter> output;
+    if (workerBoard.empty()) {
+        output.reset(ImageWriter::Create(file));
+        if (!output) {
+            std::cerr << "Unknown output format: " << file << std::endl;
+            return 1;
+        }
+        if (!output->Open(file, nx, ny)) {
+            std::cerr << "Can not open " << file << std::endl;
+            return 1;
+        }
+    } else {
+        // the coordinator reports for its workers
+        std::cout.setstate(std::ios::failbit);
     }
-}
 
-int main(int argc, char *argv[]) {
-    std::vector<Material *> materials;
-    std::vector<Hitable *> hitables;
-    RandomScene(hitables, materials);
-    HitableList world(hitables.data(), static_cast<int>(hitables.size()));
-
-    XMVECTOR lookFrom = {13.0f, 2.0f, 3.0f, 0.0f};
-    XMVECTOR lookAt = {0.0f, 0.0f, 0.0f, 0.0f};
-    Camera camera(lookFrom, lookAt, {0.0f, 1.0f, 0.0f, 0.0f}, XM_PIDIV4 * 0.5f, float(nx) / float(ny), 0.1f, 10.0f);
-
-    std::stringstream ss;
-    ss << "P3\n" << nx << " " << ny << "\n255\n";
-    for (int j = ny - 1; j >= 0; --j) {
-        for (int i = 0; i < nx; ++i) {
-            XMVECTOR col = {0.0f, 0.0f, 0.0f};
-            for (int s = 0; s < ns; ++s) {
-                float u = (i + RandomUnit() - 0.5f) / float(nx);
-                float v = (j + RandomUnit() - 0.5f) / float(ny);
-                col += CalculateColor(camera.GenRay(u, v), &world, 0);
-            }
-            col /= float(ns);
-            // gamma correct
-            col = XMVectorSqrt(col);
-            int ir = int(255.0f * XMVectorGetX(col));
-            int ig = int(255.0f * XMVectorGetY(col));
-            int ib = int(255.0f * XMVectorGetZ(col));
-            ss << ir << " " << ig << " " << ib << "\n";
+    if (dxr) {
+        if (modelFile.empty()) {
+            std::cerr << "-dxr needs a -model" << std::endl;
+            return 1;
         }
+        int result = RenderDXR(modelFile, threadCount, *output);
+        output->Close();
+        return result;
     }
 
-    for (auto material : materials) {
-        delete material;
+    SceneSetup setup;
+    setup.SetBVHBuild(BVHBuildSettings::Create(build, threadCount));
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    if (instances > 0) {
+        setup.InstancedProps(instances);
+        std::cout << "Instanced " << instances << " props: " << setup.PrimitiveCount() << " spheres\n";
+    } else if (modelFile.empty() && lit) {
+        setup.LitSpheres();
+    } else if (modelFile.empty()) {
+        setup.RandomSpheres();
+    } else if (setup.LoadModel(modelFile, float(nx) / float(ny))) {
+        std::chrono::duration<double, std::milli> loadMs = std::chrono::high_resolution_clock::now() - loadStart;
+        std::cout << "Loaded " << modelFile << ": " << setup.PrimitiveCount() << " triangles, " << BVHBuildSettings::Name(build) << " BVH, "
+                  << setup.Lights().TreeCount() << " lights in the light tree, " << loadMs.count() << " ms\n";
+    } else {
+        std::cerr << "Can not load " << modelFile << std::endl;
+        return 1;
+    }
+    if (!envFile.empty()) {
+        std::unique_ptr<Utils::Image> image(Utils::Image::CreateFromFile(envFile.c_str(), false));
+        EnvironmentMap *environment = image ? EnvironmentMap::Create(*image) : nullptr;
+        if (!environment) {
+            std::cerr << "Can not use environment " << envFile << std::endl;
+            return 1;
+        }
+        setup.SetEnvironment(environment);
+        std::cout << "Environment " << envFile << ": " << environment->Width() << " x " << environment->Height() << ", "
+                  << environment->ByteSize() << " byte alias table\n";
+    }
+    if (cacheDepth > 0) {
+        RadianceCacheSettings settings = RadianceCacheSettings::Create(cacheDepth);
+        setup.SetRadianceCache(new RadianceCache(settings), ny);
+        std::cout << "Radiance cache: " << (1u << settings.capacityLog2) << " cells, paths end on it after " << cacheDepth << " diffuse bounces\n";
     }
-    materials.clear();
+    Scene scene = setup.View();
+    Camera camera = setup.MakeCamera(float(nx) / float(ny));
 
-    for (auto hitable : hitables) {
-        delete hitable;
+    TileRenderer renderer(nx, ny, samples, tileSize, threadCount);
+    if (targetError > 0.0f) {
+        renderer.SetAdaptive(AdaptiveSettings::Create(samples, targetError));
     }
-    hitables.clear();
+    // without a budget or noise target the passes stop at the spp
+    int maxSamples = (sppGiven || (budget <= 0.0 && noise <= 0.0f)) ? samples : 0;
+    ProgressiveSettings passes = ProgressiveSettings::Create(budget, noise, maxSamples);
+    // a stratified pattern per pass, whatever the number of passes in the end
+    renderer.SetSampler(SamplerSettings::Create(sampler, progressive ? passes.passSamples : samples));
+    // the recursive integrator always traces its own camera rays
+    if (packets && shade == TracePath) {
+        renderer.SetPacketShade(TracePathFromHit);
+    }
+    renderer.SetWavefront(wavefront && shade == TracePath);
+    // everything that changes what a sample of a pixel is
+    std::ostringstream options;
+    options << modelFile << '|' << instances << '|' << lit << '|' << (shade == TracePath);
+    if (!envFile.empty()) {
+        options << '|' << envFile;
+    }
+    if (cacheDepth > 0) {
+        options << "|cache" << cacheDepth;
+    }
+    if (!workerBoard.empty()) {
+        JobBoard board;
+        if (!board.Open(workerBoard, nx, ny, renderer.Sampler(), options.str())) {
+            std::cerr << "Can not open job board " << workerBoard << ", it is gone or of another render" << std::endl;
+            return 1;
+        }
+        renderer.RenderJobs(scene, camera, shade, board, static_cast<uint32_t>(workerSlot));
+        return 0;
+    }
+    if (denoise || progressive || workers > 0) {
+        // the filter, the passes and the jobs need the whole frame, it is written once at the end
+        FrameBuffer frame(nx, ny);
+        FeatureBuffer features(nx, ny);
+        if (denoise) {
+            renderer.SetFeatures(&features);
+        }
+        if (progressive) {
+            RenderCheckpoint checkpoint;
+            if (!checkpointFile.empty() && !checkpoint.Open(checkpointFile, nx, ny, renderer.Sampler(), options.str())) {
+                std::cerr << "Can not use checkpoint " << checkpointFile << ", it can not be created or is of another render" << std::endl;
+                return 1;
+            }
+            TileRenderer::ProgressiveStats stats = renderer.RenderProgressive(scene, camera, shade, passes, checkpointFile.empty() ? nullptr : &checkpoint, frame);
+            std::cout << "Progressive: " << stats.passes << " passes (" << stats.resumedPasses << " resumed), " << stats.samples << " spp, mean relative error "
+                      << stats.meanError << ", stopped by " << stats.stoppedBy << " after " << stats.seconds << " s (" << stats.totalSeconds << " s over all runs)\n";
+        } else if (workers > 0) {
+            JobBoard board;
+            std::ostringstream name;
+            name << "Local\\RayTracingCpp.Jobs." << GetCurrentProcessId();
+            if (!board.Create(name.str(), nx, ny, tileSize, samples, jobSamples, renderer.Sampler(), options.str())) {
+                std::cerr << "Can not create job board " << name.str() << std::endl;
+                return 1;
+            }
+            // the workers set the same scene up from the same options
+            std::ostringstream arguments;
+            for (int i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+                    ++i;
+                } else if (strcmp(argv[i], "-scaling") != 0) {
+                    arguments << " \"" << argv[i] << '"';
+                }
+            }
+            RenderCoordinator coordinator(arguments.str());
+            // the same threads per worker at every worker count, so scaling compares processes
+            int threads = threadCount > 0 ? threadCount : std::max(static_cast<int>(std::thread::hardware_concurrency()) / workers, 1);
+            double oneWorker = 0.0;
+            for (int count = scaling ? 1 : workers; count <= workers; ++count) {
+                frame.Clear();
+                RenderCoordinator::Stats stats;
+                if (!coordinator.Render(board, count, threads, frame, stats)) {
+                    std::cerr << "Distributed render failed, the workers kept dying" << std::endl;
+                    return 1;
+                }
+                oneWorker = (count == 1) ? stats.seconds : oneWorker;
+                std::cout << "Distributed: " << stats.workers << " workers x " << stats.threads << " threads, " << stats.jobs << " jobs, "
+                          << stats.reissued << " reissued, " << stats.restarts << " restarts, " << stats.seconds << " s, " << stats.jobSeconds << " s in jobs";
+                if (oneWorker > 0.0) {
+                    std::cout << ", speedup " << oneWorker / stats.seconds << ", efficiency " << oneWorker / (stats.seconds * count);
+                }
+                std::cout << '\n';
+            }
+        } else {
+            renderer.Render(scene, camera, shade, &frame);
+        }
+
+        std::vector<XMFLOAT4> pixels;
+        if (denoise) {
+            Denoiser denoiser(nx, ny, renderer.ThreadCount());
+            auto start = std::chrono::high_resolution_clock::now();
+            denoiser.Run(frame, features, pixels);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            std::cout << "Denoised in " << elapsed.count() << " ms\n";
+        } else {
+            pixels.resize(size_t(nx) * ny);
+            for (int y = 0; y < ny; ++y) {
+                for (int x = 0; x < nx; ++x) {
+                    pixels[size_t(y) * nx + x] = frame.Resolve(x, y);
+                }
+            }
+        }
 
-    // write to file
-    std::string file("output.ppm");
-    std::ofstream ofs;
-    ofs.open(file);
-    ofs << ss.str();
-    ofs.close();
+        Tile image = { 0, 0, 0, 0, nx, ny };
+        output->WriteTile(image, pixels.data());
+    } else {
+        // tiles go to disk as they finish, the frame is never held in memory as a whole
+        AsyncImageWriter writer(output.get(), 2 * renderer.ThreadCount());
+        renderer.Render(scene, camera, shade, nullptr, &writer);
+        writer.Finish();
+    }
+    output->Close();
+    if (scene.cache) {
+        std::cout << "Radiance cache: " << scene.cache->Occupied() << " cells in use\n";
+    }
+    // the tile stats of a progressive render are of its last pass only, the workers keep theirs
+    if (!progressive && workers == 0) {
+        renderer.PrintTimings(std::cout);
+        renderer.WriteTileTimings("output_tiles.csv");
+    }
 
     return 0;
 }
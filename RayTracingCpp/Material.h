@@ -1,9 +1,19 @@
 #pragma once
 
-#include "Hitable.h"
-#include "Ray.h"
+// material type, same order as MatType of the DXR path tracer
+enum MaterialType : uint32_t {
+    LambertianMat,
+    MetalMat,
+    DielectricMat,
+    MaterialTypeCount
+};
 
-class Material {
-public:
-    virtual bool Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter) = 0;
+// Plain data record, materials live by value in a MaterialTable and hits refer to
+// them by index. Unused fields of a type are zero.
+struct Material {
+    XMFLOAT3    albedo;     // dielectric: transmission tint
+    uint32_t    type;
+    XMFLOAT3    emission;   // any type, as emissiveColor of the DXR path tracer
+    float       fuzz;       // metal
+    float       refIdx;     // dielectric
 };
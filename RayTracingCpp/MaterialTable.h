@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Material.h"
+#include "Lambertian.h"
+#include "Metal.h"
+#include "Dielectric.h"
+
+// Owns every material of a scene in one contiguous array. Scattering dispatches on the
+// type tag with a switch, so the hot path has no indirect call and no pointer chase,
+// and the table can be shared read only by all render threads or written out as is.
+class MaterialTable {
+public:
+    MaterialTable(void) {
+
+    }
+    ~MaterialTable(void) {
+
+    }
+
+    INLINE uint32_t Add(const Material &mat) {
+        mMaterials.push_back(mat);
+        return static_cast<uint32_t>(mMaterials.size() - 1);
+    }
+
+    INLINE uint32_t Count(void) const { return static_cast<uint32_t>(mMaterials.size()); }
+    INLINE const Material & Get(uint32_t index) const { return mMaterials[index]; }
+    INLINE const Material * Data(void) const { return mMaterials.data(); }
+
+    bool Scatter(const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter) const;
+
+    INLINE XMVECTOR Emitted(const Hitable::Record &record) const {
+        return XMLoadFloat3(&mMaterials[record.matIndex].emission);
+    }
+    // surface color at the hit, the albedo guide of the Denoiser
+    INLINE XMVECTOR Albedo(const Hitable::Record &record) const {
+        return XMLoadFloat3(&mMaterials[record.matIndex].albedo);
+    }
+
+private:
+    std::vector<Material> mMaterials;
+};
+
+INLINE bool MaterialTable::Scatter(const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter) const {
+    const Material &mat = mMaterials[record.matIndex];
+    switch (mat.type) {
+        case LambertianMat: return Lambertian::Scatter(mat, in, record, rng, attenuation, scatter);
+        case MetalMat:      return Metal::Scatter(mat, in, record, rng, attenuation, scatter);
+        case DielectricMat: return Dielectric::Scatter(mat, in, record, rng, attenuation, scatter);
+        default:            return false;
+    }
+}
@@ -1,29 +1,25 @@
 #pragma once
 
+#include "Hitable.h"
 #include "Material.h"
+#include "Random.h"
 
-class Metal : public Material {
+class Metal {
 public:
-    Metal(const XMVECTOR &albedo, float fuzz)
-    {
-        mAlbedo = albedo;
-        mFuzz = std::max(std::min(fuzz, 1.0f), 0.0f);
+    INLINE static Material Create(const XMVECTOR &albedo, float fuzz) {
+        Material mat = {};
+        XMStoreFloat3(&mat.albedo, albedo);
+        mat.type = MetalMat;
+        mat.fuzz = std::max(std::min(fuzz, 1.0f), 0.0f);
+        return mat;
     }
-    ~Metal(void) {
-    
-    }
-
-    virtual bool Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter);
 
-private:
-    XMVECTOR    mAlbedo;
-    float       mFuzz;
+    static bool Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter);
 };
 
-bool Metal::Scatter(const Ray &in, const Hitable::Record &record, XMVECTOR &attenuation, Ray &scatter) {
+INLINE bool Metal::Scatter(const Material &mat, const Ray &in, const Hitable::Record &record, RandomStream &rng, XMVECTOR &attenuation, Ray &scatter) {
     XMVECTOR reflected = XMVector3Reflect(in.Direction(), record.n);
-    scatter = Ray(record.p, reflected + (RandomInUnitSphere() * mFuzz));
-    attenuation = mAlbedo;
+    scatter = Ray(record.p, reflected + (rng.InUnitSphere() * mat.fuzz));
+    attenuation = XMLoadFloat3(&mat.albedo);
     return (XMVectorGetX(XMVector3Dot(scatter.Direction(), record.n)) > 0.0f);
 }
-
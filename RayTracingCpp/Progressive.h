@@ -0,0 +1,186 @@
+#pragma once
+
+#include "AdaptiveSampler.h"
+#include "Sampler.h"
+
+// When a progressive render stops. It adds passSamples to every pixel per pass until
+// the time budget would be overrun by another pass, the mean relative error of the
+// image is at targetError or the pixels have maxSamples; a limit of 0 is no limit.
+struct ProgressiveSettings {
+    int     passSamples;
+    double  timeBudget;     // seconds of this run, resumed runs get their own
+    float   targetError;
+    int     maxSamples;
+
+    INLINE static ProgressiveSettings Create(double timeBudget, float targetError, int maxSamples = 0, int passSamples = 4) {
+        ProgressiveSettings settings;
+        settings.passSamples = std::max(passSamples, 1);
+        settings.timeBudget = timeBudget;
+        settings.targetError = targetError;
+        settings.maxSamples = maxSamples;
+        return settings;
+    }
+};
+
+// FNV-1a of whatever tells renders apart, such as the options that set the scene up
+INLINE uint64_t HashScene(const std::string &scene) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : scene) {
+        hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// The accumulation of a progressive render in a memory-mapped file: a header and two
+// copies of the per pixel estimates. Save writes the copy that is not current, flushes
+// it and only then flips the header over to it, so a job killed at any point leaves
+// the last whole pass behind. The estimates are all the sampler state there is, every
+// RandomStream is a function of the settings, the pixel and its sample count, so a
+// resumed render draws exactly the samples the interrupted one would have.
+class RenderCheckpoint {
+public:
+    RenderCheckpoint(void)
+    : mFile(INVALID_HANDLE_VALUE)
+    , mMapping(nullptr)
+    , mView(nullptr)
+    , mPixelCount(0)
+    {
+
+    }
+    ~RenderCheckpoint(void) {
+        Close();
+    }
+
+    // Maps file, or creates it for a fresh render. An existing file must be of the same
+    // size, sampler and scene, it is never overwritten with a different render; scene
+    // is whatever tells renders apart, such as the options that set the scene up.
+    bool Open(const std::string &file, int width, int height, const SamplerSettings &sampler, const std::string &scene);
+    void Close(void);
+
+    INLINE uint32_t Passes(void) const { return mView ? Head().passes[Head().current] : 0; }
+    // render time of every run so far
+    INLINE double Seconds(void) const { return mView ? Head().seconds[Head().current] : 0.0; }
+
+    void Load(std::vector<PixelEstimate> &estimates) const;
+    void Save(const std::vector<PixelEstimate> &estimates, uint32_t passes, double seconds);
+
+private:
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t HeaderSize = 128;
+
+    struct Header {
+        char        magic[8];
+        uint32_t    version;
+        int32_t     width;
+        int32_t     height;
+        uint32_t    sampler;
+        uint32_t    samplesPerPixel;
+        uint32_t    seed;
+        uint32_t    current;    // 0 or 1, the copy that is whole
+        uint32_t    passes[2];  // completed, per copy
+        double      seconds[2];
+        uint64_t    scene;      // HashScene of the scene string
+    };
+    static_assert(sizeof(Header) <= HeaderSize, "checkpoint header too large");
+    static_assert(std::is_trivially_copyable<PixelEstimate>::value, "estimates are copied as bytes");
+
+    INLINE Header & Head(void) const { return *static_cast<Header *>(mView); }
+    INLINE PixelEstimate * Estimates(uint32_t copy) const {
+        return reinterpret_cast<PixelEstimate *>(static_cast<char *>(mView) + HeaderSize) + copy * mPixelCount;
+    }
+
+    HANDLE      mFile;
+    HANDLE      mMapping;
+    void        *mView;
+    size_t      mPixelCount;
+};
+
+INLINE bool RenderCheckpoint::Open(const std::string &file, int width, int height, const SamplerSettings &sampler, const std::string &scene) {
+    static const char magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', 0, 0 };
+    Close();
+    uint64_t sceneHash = HashScene(scene);
+    mPixelCount = size_t(width) * height;
+    uint64_t bytes = HeaderSize + 2 * mPixelCount * sizeof(PixelEstimate);
+
+    mFile = CreateFileA(file.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size)) {
+        Close();
+        return false;
+    }
+    bool fresh = (size.QuadPart == 0);
+    if (!fresh && uint64_t(size.QuadPart) != bytes) {
+        Close();
+        return false;
+    }
+
+    // a new file grows to the size of the mapping, zero filled: empty estimates
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, DWORD(bytes >> 32), DWORD(bytes), nullptr);
+    mView = mMapping ? MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, size_t(bytes)) : nullptr;
+    if (!mView) {
+        Close();
+        return false;
+    }
+
+    Header &header = Head();
+    if (fresh) {
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = Version;
+        header.width = width;
+        header.height = height;
+        header.sampler = sampler.type;
+        header.samplesPerPixel = sampler.samplesPerPixel;
+        header.seed = sampler.seed;
+        header.current = 0;
+        header.passes[0] = header.passes[1] = 0;
+        header.seconds[0] = header.seconds[1] = 0.0;
+        header.scene = sceneHash;
+        FlushViewOfFile(mView, HeaderSize);
+        return true;
+    }
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != Version || header.width != width || header.height != height ||
+        header.sampler != sampler.type || header.samplesPerPixel != sampler.samplesPerPixel || header.seed != sampler.seed || header.scene != sceneHash || header.current > 1) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+INLINE void RenderCheckpoint::Close(void) {
+    if (mView) {
+        FlushViewOfFile(mView, 0);
+        UnmapViewOfFile(mView);
+        mView = nullptr;
+    }
+    if (mMapping) {
+        CloseHandle(mMapping);
+        mMapping = nullptr;
+    }
+    if (mFile != INVALID_HANDLE_VALUE) {
+        FlushFileBuffers(mFile);
+        CloseHandle(mFile);
+        mFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+INLINE void RenderCheckpoint::Load(std::vector<PixelEstimate> &estimates) const {
+    estimates.resize(mPixelCount);
+    memcpy(estimates.data(), Estimates(Head().current), mPixelCount * sizeof(PixelEstimate));
+}
+
+INLINE void RenderCheckpoint::Save(const std::vector<PixelEstimate> &estimates, uint32_t passes, double seconds) {
+    uint32_t next = 1 - Head().current;
+    memcpy(Estimates(next), estimates.data(), mPixelCount * sizeof(PixelEstimate));
+    FlushViewOfFile(Estimates(next), mPixelCount * sizeof(PixelEstimate));
+    FlushFileBuffers(mFile);
+
+    Header &header = Head();
+    header.passes[next] = passes;
+    header.seconds[next] = seconds;
+    header.current = next;
+    FlushViewOfFile(mView, HeaderSize);
+    FlushFileBuffers(mFile);
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+// How paths use a RadianceCache and when its cells are trusted. A cell is read once a
+// path has made readDepth diffuse bounces; it is trusted after minSamples when the
+// standard error of its mean luminance is within maxError of the mean, with the sample
+// count taken as at most maxSamples, so a cell that is noisy by nature (a caustic, light
+// leaking across it) never becomes trusted just by piling samples up.
+struct RadianceCacheSettings {
+    int         readDepth;
+    float       cellPixels;     // cell size, in pixels at the distance of the cell
+    uint32_t    capacityLog2;   // cells in the table
+    uint32_t    minSamples;
+    uint32_t    maxSamples;
+    float       maxError;
+    uint32_t    maxAge;         // passes or waves without a write before a cell expires
+
+    INLINE static RadianceCacheSettings Create(int readDepth = 1, float cellPixels = 8.0f, uint32_t capacityLog2 = 20) {
+        RadianceCacheSettings settings;
+        settings.readDepth = std::max(readDepth, 1);
+        settings.cellPixels = cellPixels;
+        settings.capacityLog2 = std::min(std::max(capacityLog2, 10u), 28u);
+        settings.minSamples = 64;
+        settings.maxSamples = 1024;
+        settings.maxError = 0.2f;
+        settings.maxAge = 8;
+        return settings;
+    }
+};
+
+// A world space radiance cache hashed like Binder et al., "Fast Path Space Filtering by
+// Jittered Spatial Hashing" (without the jitter) and laid out like NVIDIA's SHaRC: an
+// open addressed table of cells keyed by a quantized position and the dominant axis of
+// the normal, the cells growing with their distance to the camera. Paths note the
+// Lambertian hits they make and, once they end, give each its share of the path
+// radiance: the light that left it over the throughput that reached it. Every thread
+// adds into the cells with atomic fixed point sums, no lock is taken. A later path ends
+// on a trusted cell instead of bouncing on, which shortens paths a lot in diffuse
+// interiors, at the bias of a cell's average standing for every point in it. What a
+// pixel gets depends on what other threads cached before, so a render with the cache is
+// not repeatable.
+class RadianceCache {
+public:
+    static constexpr uint32_t InvalidCell = 0xFFFFFFFF;
+    // the first hits of a path that feed the cache
+    static constexpr int MaxVertices = 4;
+
+    // a Lambertian hit of a path, waiting for the path to end
+    struct Vertex {
+        XMVECTOR    throughput;     // reaching the hit
+        XMVECTOR    radiance;       // of the path up to and with the emission of the hit
+        uint32_t    cell;
+    };
+
+    RadianceCache(const RadianceCacheSettings &settings);
+    ~RadianceCache(void) {
+
+    }
+
+    INLINE const RadianceCacheSettings & Settings(void) const { return mSettings; }
+    // where the camera is and the angle one of its pixels covers
+    INLINE void SetCamera(const XMVECTOR &position, float pixelAngle) {
+        mCamera = position;
+        mFootprint = mSettings.cellPixels * pixelAngle;
+    }
+    // cells in use after the last Update
+    INLINE uint32_t Occupied(void) const { return mOccupied; }
+
+    // the cell of p with normal n, claimed when it is new; InvalidCell when the table is
+    // too full around it
+    uint32_t Find(const XMVECTOR &p, const XMVECTOR &n);
+    // the radiance cell reflects, false when the cell is not to be trusted yet
+    bool Lookup(uint32_t cell, XMVECTOR &radiance) const;
+    // gives vertices of a path their share of the radiance it ended with
+    void Add(const Vertex *vertices, int count, const XMVECTOR &radiance);
+    // Between passes or waves of samples, with no path running: expires the cells no path
+    // wrote for maxAge passes and those still not trusted after maxSamples.
+    void Update(void);
+
+private:
+    // samples are clamped so one firefly can not hold a cell
+    static constexpr float MaxRadiance = 256.0f;
+    static constexpr double RadianceScale = 1048576.0;
+    static constexpr double SquareScale = 65536.0;
+    static constexpr int MaxProbes = 8;
+    static constexpr uint64_t KeyUsed = uint64_t(1) << 63;
+
+    struct Cell {
+        std::atomic<uint64_t>   key;        // 0 for a free cell
+        std::atomic<uint64_t>   sum[3];     // fixed point radiance
+        std::atomic<uint64_t>   squares;    // fixed point luminance squared
+        std::atomic<uint32_t>   count;
+        std::atomic<uint32_t>   pass;       // of the last write
+    };
+
+    uint64_t Key(const XMVECTOR &p, const XMVECTOR &n) const;
+    bool Trusted(const Cell &cell, XMVECTOR *radiance) const;
+    void Clear(Cell &cell);
+
+    // the finalizer of SplitMix64
+    INLINE static uint64_t Mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    RadianceCacheSettings       mSettings;
+    std::unique_ptr<Cell[]>     mCells;
+    uint32_t                    mMask;
+    uint32_t                    mPass;
+    uint32_t                    mOccupied;
+    XMVECTOR                    mCamera;
+    float                       mFootprint;     // cell size over the distance to the camera
+};
+
+INLINE RadianceCache::RadianceCache(const RadianceCacheSettings &settings)
+: mSettings(settings)
+, mCells(new Cell[size_t(1) << settings.capacityLog2])
+, mMask((1u << settings.capacityLog2) - 1)
+, mPass(0)
+, mOccupied(0)
+, mFootprint(0.01f)
+{
+    mCamera = XMVectorZero();
+    for (uint32_t i = 0; i <= mMask; ++i) {
+        Clear(mCells[i]);
+        mCells[i].key.store(0, std::memory_order_relaxed);
+    }
+}
+
+INLINE uint64_t RadianceCache::Key(const XMVECTOR &p, const XMVECTOR &n) const {
+    // cells of a power of two size, about cellPixels pixels where they are
+    float size = std::max(XMVectorGetX(XMVector3Length(p - mCamera)) * mFootprint, 1e-6f);
+    int level = std::min(std::max(static_cast<int>(std::floor(std::log2(size))), -32), 31);
+    XMFLOAT3 cell;
+    XMStoreFloat3(&cell, XMVectorFloor(p * std::ldexp(1.0f, -level)));
+    XMFLOAT3 normal;
+    XMStoreFloat3(&normal, n);
+    XMFLOAT3 magnitude(std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z));
+    int axis = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+    uint64_t side = (&normal.x)[axis] < 0.0f ? 1 : 0;
+
+    // 18 bits a coordinate, wrapping far out, then 3 of the normal and 6 of the level
+    auto Coordinate = [](float c) { return uint64_t(int64_t(c)) & 0x3FFFF; };
+    return KeyUsed | (uint64_t(level + 32) << 57) | (uint64_t(axis * 2 + side) << 54)
+         | (Coordinate(cell.z) << 36) | (Coordinate(cell.y) << 18) | Coordinate(cell.x);
+}
+
+INLINE uint32_t RadianceCache::Find(const XMVECTOR &p, const XMVECTOR &n) {
+    uint64_t key = Key(p, n);
+    uint32_t slot = static_cast<uint32_t>(Mix(key)) & mMask;
+    for (int i = 0; i < MaxProbes; ++i, slot = (slot + 1) & mMask) {
+        uint64_t stored = mCells[slot].key.load(std::memory_order_acquire);
+        if (stored == key) {
+            return slot;
+        }
+        if (stored == 0) {
+            // another thread may claim it first, for this key or another
+            if (mCells[slot].key.compare_exchange_strong(stored, key, std::memory_order_acq_rel) || stored == key) {
+                return slot;
+            }
+        }
+    }
+    return InvalidCell;
+}
+
+INLINE bool RadianceCache::Trusted(const Cell &cell, XMVECTOR *radiance) const {
+    uint32_t count = cell.count.load(std::memory_order_relaxed);
+    if (count < mSettings.minSamples) {
+        return false;
+    }
+    double scale = 1.0 / (RadianceScale * count);
+    XMVECTOR mean = XMVectorSet(float(cell.sum[0].load(std::memory_order_relaxed) * scale), float(cell.sum[1].load(std::memory_order_relaxed) * scale),
+                                float(cell.sum[2].load(std::memory_order_relaxed) * scale), 0.0f);
+    float luminance = XMVectorGetX(XMVector3Dot(mean, XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f)));
+    float variance = float(cell.squares.load(std::memory_order_relaxed) / (SquareScale * count)) - luminance * luminance;
+    // the squared standard error against the squared tolerance, both over the samples
+    float error = mSettings.maxError * luminance;
+    if (variance > error * error * float(std::min(count, mSettings.maxSamples))) {
+        return false;
+    }
+    if (radiance) {
+        *radiance = mean;
+    }
+    return true;
+}
+
+INLINE bool RadianceCache::Lookup(uint32_t cell, XMVECTOR &radiance) const {
+    return cell != InvalidCell && Trusted(mCells[cell], &radiance);
+}
+
+INLINE void RadianceCache::Add(const Vertex *vertices, int count, const XMVECTOR &radiance) {
+    static const XMVECTOR luminance = { 0.2126f, 0.7152f, 0.0722f, 0.0f };
+    for (int i = 0; i < count; ++i) {
+        const Vertex &vertex = vertices[i];
+        // a channel the path carried nothing of tells nothing about the cell
+        if (!XMVector3Greater(vertex.throughput, XMVectorZero())) {
+            continue;
+        }
+        XMVECTOR reflected = XMVectorClamp((radiance - vertex.radiance) / vertex.throughput, XMVectorZero(), XMVectorReplicate(MaxRadiance));
+        XMFLOAT3 value;
+        XMStoreFloat3(&value, reflected);
+        float lum = XMVectorGetX(XMVector3Dot(reflected, luminance));
+
+        Cell &cell = mCells[vertex.cell];
+        cell.sum[0].fetch_add(uint64_t(value.x * RadianceScale + 0.5), std::memory_order_relaxed);
+        cell.sum[1].fetch_add(uint64_t(value.y * RadianceScale + 0.5), std::memory_order_relaxed);
+        cell.sum[2].fetch_add(uint64_t(value.z * RadianceScale + 0.5), std::memory_order_relaxed);
+        cell.squares.fetch_add(uint64_t(double(lum) * lum * SquareScale + 0.5), std::memory_order_relaxed);
+        cell.count.fetch_add(1, std::memory_order_relaxed);
+        cell.pass.store(mPass, std::memory_order_relaxed);
+    }
+}
+
+INLINE void RadianceCache::Clear(Cell &cell) {
+    for (auto &sum : cell.sum) {
+        sum.store(0, std::memory_order_relaxed);
+    }
+    cell.squares.store(0, std::memory_order_relaxed);
+    cell.count.store(0, std::memory_order_relaxed);
+    cell.pass.store(mPass, std::memory_order_relaxed);
+}
+
+INLINE void RadianceCache::Update(void) {
+    ++mPass;
+    mOccupied = 0;
+    for (uint32_t i = 0; i <= mMask; ++i) {
+        Cell &cell = mCells[i];
+        if (cell.key.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        // a freed cell can cut the probe run of a later one, which then ages out too
+        bool stale = mPass - cell.pass.load(std::memory_order_relaxed) > mSettings.maxAge;
+        bool noisy = cell.count.load(std::memory_order_relaxed) >= mSettings.maxSamples && !Trusted(cell, nullptr);
+        if (stale || noisy) {
+            Clear(cell);
+            cell.key.store(0, std::memory_order_relaxed);
+        } else {
+            ++mOccupied;
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "Sampler.h"
+
+// Counter based random numbers. Every value is a pure function of (pixel, sample,
+// bounce, dimension), hashed with PCG4D ("Hash Functions for GPU Rendering", Jarzynski
+// and Olano 2020), so any thread reproduces exactly the same stream for a sample and
+// a parallel render is bit identical to a serial one. The low discrepancy samplers
+// keep that property; they only change what a (bounce, dimension) slot is filled with.
+class RandomStream {
+public:
+    RandomStream(uint32_t pixel, uint32_t sample, uint32_t seed = 0)
+    : mType(IndependentSampler)
+    , mPixel(pixel)
+    , mSample(sample)
+    , mSeed(seed)
+    , mX(0)
+    , mY(0)
+    , mSampleCount(1)
+    , mBlueNoise(nullptr)
+    , mBounce(0)
+    , mCounter(0)
+    , mCached(0)
+    {
+
+    }
+    // stream of pixel 0, sample 0; a placeholder to assign a real stream to
+    RandomStream(void)
+    : RandomStream(0, 0)
+    {
+
+    }
+    // x and y only matter to the blue noise sampler, pixel keys all the others
+    RandomStream(const SamplerSettings &settings, uint32_t x, uint32_t y, uint32_t pixel, uint32_t sample)
+    : mType(settings.type)
+    , mPixel(pixel)
+    , mSample(sample)
+    , mSeed(settings.seed)
+    , mX(x)
+    , mY(y)
+    , mSampleCount(settings.samplesPerPixel)
+    , mBlueNoise(settings.blueNoise)
+    , mBounce(0)
+    , mCounter(0)
+    , mCached(0)
+    {
+
+    }
+    ~RandomStream(void) {
+
+    }
+
+    // restarts the dimension counter, every bounce draws from its own sub stream
+    INLINE void SetBounce(uint32_t bounce) {
+        mBounce = bounce;
+        mCounter = 0;
+        mCached = 0;
+    }
+
+    INLINE uint32_t Bounce(void) const { return mBounce; }
+
+    // [0.0 ~ 1.0)
+    INLINE float NextFloat(void) {
+        if (mCached == 0) {
+            Refill(mCounter++);
+            mCached = 4;
+        }
+        return mValues[4 - mCached--];
+    }
+
+    // polar mapping, inside the unit disk on the xy plane
+    INLINE XMVECTOR InUnitDisk(void) {
+        float r = std::sqrt(NextFloat());
+        float phi = XM_2PI * NextFloat();
+        return { r * std::cos(phi), r * std::sin(phi), 0.0f, 0.0f };
+    }
+
+    // uniform direction, on the unit sphere
+    INLINE XMVECTOR OnUnitSphere(void) {
+        float z = 1.0f - 2.0f * NextFloat();
+        float phi = XM_2PI * NextFloat();
+        float s = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        return { s * std::cos(phi), s * std::sin(phi), z, 0.0f };
+    }
+
+    // uniform direction scaled by the cube root of a uniform radius, inside the unit ball
+    INLINE XMVECTOR InUnitSphere(void) {
+        float z = 1.0f - 2.0f * NextFloat();
+        float phi = XM_2PI * NextFloat();
+        float r = std::cbrt(NextFloat());
+        float s = std::sqrt(std::max(0.0f, 1.0f - z * z)) * r;
+        return { s * std::cos(phi), s * std::sin(phi), z * r, 0.0f };
+    }
+
+    INLINE static void Hash(uint32_t x, uint32_t y, uint32_t z, uint32_t w, uint32_t out[4]) {
+        x = x * 1664525u + 1013904223u;
+        y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u;
+        w = w * 1664525u + 1013904223u;
+
+        x += y * w; y += z * x; z += x * y; w += y * z;
+        x ^= x >> 16; y ^= y >> 16; z ^= z >> 16; w ^= w >> 16;
+        x += y * w; y += z * x; z += x * y; w += y * z;
+
+        out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+    }
+
+private:
+    // fills the four dimensions of a group
+    void Refill(uint32_t group);
+
+    INLINE static float ToFloat(uint32_t bits) {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    SamplerType             mType;
+    uint32_t                mPixel;
+    uint32_t                mSample;
+    uint32_t                mSeed;
+    uint32_t                mX;
+    uint32_t                mY;
+    uint32_t                mSampleCount;
+    const BlueNoiseTile    *mBlueNoise;
+    uint32_t                mBounce;
+    uint32_t                mCounter;
+    uint32_t                mCached;
+    float                   mValues[4];
+};
+
+INLINE void RandomStream::Refill(uint32_t group) {
+    uint32_t bits[4];
+    switch (mType) {
+    case StratifiedSampler: {
+        // two independently permuted 2D patterns, sample indices past the pattern size
+        // start another pattern
+        uint32_t pattern = mSample / mSampleCount;
+        Hash(mPixel, mBounce, group, mSeed ^ (pattern << 8), bits);
+        LowDiscrepancy::MultiJittered(mSample % mSampleCount, mSampleCount, bits[0], mValues);
+        LowDiscrepancy::MultiJittered(mSample % mSampleCount, mSampleCount, bits[1], mValues + 2);
+        return;
+    }
+    case SobolSampler:
+        Hash(mPixel, mBounce, group, mSeed, bits);
+        LowDiscrepancy::ScrambledSobol4D(mSample, bits[0], true, bits);
+        break;
+    case BlueNoiseSampler: {
+        // every pixel walks the same sequence, a blue noise Cranley-Patterson rotation
+        // per pixel and dimension keeps each estimate unbiased and their errors apart
+        uint32_t offsets[4];
+        Hash(mBounce, group, mSeed, 0x9e3779b9u, offsets);
+        LowDiscrepancy::ScrambledSobol4D(mSample, offsets[0], false, bits);
+        for (int d = 0; d < 4; ++d) {
+            uint32_t shift = LowDiscrepancy::Mix(offsets[d] + d);
+            float value = ToFloat(bits[d]) + mBlueNoise->At(mX + (shift & 0xffff), mY + (shift >> 16));
+            mValues[d] = value >= 1.0f ? value - 1.0f : value;
+        }
+        return;
+    }
+    default:
+        Hash(mPixel, mSample, mBounce, (mSeed << 16) ^ group, bits);
+        break;
+    }
+    for (int d = 0; d < 4; ++d) {
+        mValues[d] = ToFloat(bits[d]);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Hitable.h"
+
+// Up to MaxSize rays traced through the acceleration structure together, such as the
+// camera rays of a 4 x 4 pixel block. Prepare bounds the whole packet with intervals
+// of origins and inverse directions, which lets a traversal reject a box for all rays
+// at once with interval arithmetic instead of testing them one by one.
+struct RayPacket {
+    static constexpr int MaxSize = 16;
+
+    int                 count;
+    float               tMin;
+    Ray                 rays[MaxSize];
+    float               tMax[MaxSize];      // in: the farthest distance, out: the closest hit
+    bool                hit[MaxSize];
+    Hitable::Record     records[MaxSize];
+
+    // set up by Prepare
+    XMVECTOR            invDirs[MaxSize];
+    XMVECTOR            originMin, originMax;
+    XMVECTOR            invDirMin, invDirMax;
+    float               farthest;
+    bool                coherent;           // one direction sign per axis, no zero components
+
+    INLINE void Clear(float minDistance) {
+        count = 0;
+        tMin = minDistance;
+    }
+
+    INLINE void Add(const Ray &ray, float maxDistance) {
+        rays[count] = ray;
+        tMax[count] = maxDistance;
+        hit[count] = false;
+        ++count;
+    }
+
+    INLINE void Prepare(void) {
+        originMin = originMax = rays[0].Origin();
+        invDirMin = invDirMax = XMVectorReciprocal(rays[0].Direction());
+        farthest = tMax[0];
+        for (int r = 0; r < count; ++r) {
+            invDirs[r] = XMVectorReciprocal(rays[r].Direction());
+            originMin = XMVectorMin(originMin, rays[r].Origin());
+            originMax = XMVectorMax(originMax, rays[r].Origin());
+            invDirMin = XMVectorMin(invDirMin, invDirs[r]);
+            invDirMax = XMVectorMax(invDirMax, invDirs[r]);
+            farthest = std::max(farthest, tMax[r]);
+        }
+        XMVECTOR zero = XMVectorZero();
+        XMVECTOR sameSign = XMVectorOrInt(XMVectorGreater(invDirMin, zero), XMVectorLess(invDirMax, zero));
+        coherent = XMVector3EqualInt(sameSign, XMVectorTrueInt()) && !XMVector3IsInfinite(invDirMin) && !XMVector3IsInfinite(invDirMax);
+    }
+
+    // Conservative box test for the whole packet, only valid when coherent. Every ray
+    // enters the box no earlier than the lower bound of (near plane - origin) * invDir
+    // over the intervals and leaves no later than the upper bound for the far plane, so
+    // when the latest entry bound comes after the earliest exit bound no ray can hit.
+    INLINE bool MayHit(const XMVECTOR &min, const XMVECTOR &max) const {
+        XMVECTOR positive = XMVectorGreater(invDirMin, XMVectorZero());
+        XMVECTOR nearPlane = XMVectorSelect(max, min, positive);
+        XMVECTOR farPlane = XMVectorSelect(min, max, positive);
+
+        XMVECTOR a0 = nearPlane - originMax;
+        XMVECTOR a1 = nearPlane - originMin;
+        XMVECTOR entry = XMVectorMin(XMVectorMin(a0 * invDirMin, a0 * invDirMax), XMVectorMin(a1 * invDirMin, a1 * invDirMax));
+        XMVECTOR b0 = farPlane - originMax;
+        XMVECTOR b1 = farPlane - originMin;
+        // the same widening as AABB::Hit
+        XMVECTOR exit = XMVectorMax(XMVectorMax(b0 * invDirMin, b0 * invDirMax), XMVectorMax(b1 * invDirMin, b1 * invDirMax)) * 1.0000004f;
+
+        float tEntry = std::max(tMin, std::max(XMVectorGetX(entry), std::max(XMVectorGetY(entry), XMVectorGetZ(entry))));
+        float tExit = std::min(farthest, std::min(XMVectorGetX(exit), std::min(XMVectorGetY(exit), XMVectorGetZ(exit))));
+        return tEntry <= tExit;
+    }
+};
+
+INLINE void Hitable::HitPacket(RayPacket &packet) {
+    Record record;
+    for (int r = 0; r < packet.count; ++r) {
+        if (Hit(packet.rays[r], packet.tMin, packet.tMax[r], record)) {
+            packet.hit[r] = true;
+            packet.tMax[r] = record.t;
+            packet.records[r] = record;
+        }
+    }
+}
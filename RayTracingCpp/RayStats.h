@@ -0,0 +1,14 @@
+#pragma once
+
+// Rays traced by the current thread. Integrators bump the counters, the renderer folds
+// every worker's totals into its report, so counting costs no shared cache line.
+struct RayStats {
+    uint64_t primary;
+    uint64_t secondary;
+    uint64_t shadow;
+
+    INLINE static RayStats & Thread(void) {
+        thread_local RayStats stats = {};
+        return stats;
+    }
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+// Sample sequences a RandomStream can draw from. Dimensions are consumed in groups of
+// four: group 0 of bounce 0 is the pixel jitter and the lens position, every later
+// bounce starts its own groups, so each decision of a path owns its dimensions.
+enum SamplerType : uint32_t {
+    IndependentSampler,     // PCG4D hash, white noise
+    StratifiedSampler,      // correlated multi-jittered pairs, needs the spp up front
+    SobolSampler,           // shuffled Owen scrambled Sobol, progressive
+    BlueNoiseSampler,       // one Sobol sequence for the frame, dithered per pixel
+    SamplerTypeCount
+};
+
+// Integer hashes and sequences the samplers are built from. All of them are pure
+// functions of their arguments, like the PCG4D stream.
+class LowDiscrepancy {
+public:
+    INLINE static uint32_t ReverseBits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    // PCG output permutation, turns a counter into a seed
+    INLINE static uint32_t Mix(uint32_t x) {
+        x = x * 747796405u + 2891336453u;
+        x = ((x >> ((x >> 28) + 4)) ^ x) * 277803737u;
+        return (x >> 22) ^ x;
+    }
+
+    // Nested uniform (Owen) scrambling as a hash of the reversed bits: flipping a bit
+    // only ever depends on the bits above it. The hash is the Laine-Karras permutation
+    // with the constants of "Practical Hash-based Owen Scrambling" (Burley 2020).
+    INLINE static uint32_t OwenScramble(uint32_t x, uint32_t seed) {
+        x = ReverseBits(x);
+        x ^= x * 0x3d20adeau;
+        x += seed;
+        x *= (seed >> 16) | 1u;
+        x ^= x * 0x05526c56u;
+        x ^= x * 0x53a22864u;
+        return ReverseBits(x);
+    }
+
+    // first four Sobol dimensions, Joe-Kuo direction numbers
+    INLINE static void Sobol4D(uint32_t index, uint32_t out[4]) {
+        static const uint32_t directions[4][32] = {
+            { 0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000, 0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000, 0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100, 0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001 },
+            { 0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000, 0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000, 0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00, 0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff },
+            { 0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000, 0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000, 0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500, 0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555 },
+            { 0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000, 0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000, 0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00, 0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093 },
+        };
+        out[0] = out[1] = out[2] = out[3] = 0;
+        for (int bit = 0; index != 0; index >>= 1, ++bit) {
+            if (index & 1) {
+                out[0] ^= directions[0][bit];
+                out[1] ^= directions[1][bit];
+                out[2] ^= directions[2][bit];
+                out[3] ^= directions[3][bit];
+            }
+        }
+    }
+
+    // Burley's padding: the index is Owen scrambled too, which shuffles the order of the
+    // points per pixel and group, so groups are decorrelated without higher dimensions
+    INLINE static void ScrambledSobol4D(uint32_t index, uint32_t seed, bool shuffle, uint32_t out[4]) {
+        Sobol4D(shuffle ? OwenScramble(index, seed) : index, out);
+        for (uint32_t d = 0; d < 4; ++d) {
+            out[d] = OwenScramble(out[d], Mix(seed + d + 1));
+        }
+    }
+
+    // Kensler's hash permutation of [0, l), "Correlated Multi-Jittered Sampling" (2013)
+    INLINE static uint32_t Permute(uint32_t i, uint32_t l, uint32_t p) {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p;             i *= 0xe170893du;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;        i *= 0x0929eb3fu;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;  i *= 1u | p >> 27;
+                                i *= 0x6935fa69u;
+            i ^= (i & w) >> 11; i *= 0x74dcb303u;
+            i ^= (i & w) >> 2;  i *= 0x9e501cc3u;
+            i ^= (i & w) >> 2;  i *= 0xc860a3dfu;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    INLINE static float Jitter(uint32_t i, uint32_t p) {
+        i ^= p;
+        i ^= i >> 17;
+        i ^= i >> 10;       i *= 0xb36534e5u;
+        i ^= i >> 12;
+        i ^= i >> 21;       i *= 0x93fc4795u;
+        i ^= 0xdf6e307fu;
+        i ^= i >> 17;       i *= 1u | p >> 18;
+        return std::min((i >> 8) * (1.0f / 16777216.0f), 0.99999994f);
+    }
+
+    // Sample s of a pattern of n points, stratified on an m x (n / m) grid and in both
+    // 1D projections. s must be below n.
+    INLINE static void MultiJittered(uint32_t s, uint32_t n, uint32_t p, float out[2]) {
+        uint32_t m = std::max(static_cast<uint32_t>(std::sqrt(float(n))), 1u);
+        uint32_t rows = (n + m - 1) / m;
+        s = Permute(s, n, p * 0x51633e2du);
+        uint32_t sx = Permute(s % m, m, p * 0x68bc21ebu);
+        uint32_t sy = Permute(s / m, rows, p * 0x02e5be93u);
+        float jx = Jitter(s, p * 0x967a889bu);
+        float jy = Jitter(s, p * 0x368cc8b7u);
+        out[0] = std::min((s % m + (sy + jx) / rows) / m, 0.99999994f);
+        out[1] = std::min((s / m + (sx + jy) / m) / rows, 0.99999994f);
+    }
+};
+
+// Tileable 64 x 64 blue noise ranks made with the void and cluster method (Ulichney
+// 1993), generated once on first use. Neighbouring texels hold values far apart, so
+// offsets taken from it turn per pixel error into high frequency noise the eye
+// averages out ("Blue-noise Dithered Sampling", Georgiev and Fajardo 2016).
+class BlueNoiseTile {
+public:
+    static constexpr int Size = 64;
+
+    INLINE float At(uint32_t x, uint32_t y) const { return mValues[(y % Size) * Size + (x % Size)]; }
+
+    INLINE static const BlueNoiseTile & Shared(void) {
+        static const BlueNoiseTile tile;
+        return tile;
+    }
+
+private:
+    BlueNoiseTile(void);
+
+    float mValues[Size * Size];
+};
+
+INLINE BlueNoiseTile::BlueNoiseTile(void) {
+    static constexpr int count = Size * Size;
+    static constexpr float sigma = 1.5f;
+
+    // toroidal gaussian splat, energy[i] is the filtered density of the set pixels
+    std::vector<float> kernel(count);
+    for (int y = 0; y < Size; ++y) {
+        for (int x = 0; x < Size; ++x) {
+            float dx = float(std::min(x, Size - x));
+            float dy = float(std::min(y, Size - y));
+            kernel[y * Size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto Splat = [&](int p, float sign) {
+        int px = p % Size, py = p / Size;
+        for (int y = 0; y < Size; ++y) {
+            const float *row = &kernel[((y - py + Size) % Size) * Size];
+            for (int x = 0; x < Size; ++x) {
+                energy[y * Size + x] += sign * row[(x - px + Size) % Size];
+            }
+        }
+    };
+    // tightest cluster among the set pixels, largest void among the empty ones
+    auto Extreme = [&](uint8_t set) {
+        int best = -1;
+        for (int i = 0; i < count; ++i) {
+            if (pattern[i] == set && (best < 0 || (set ? energy[i] > energy[best] : energy[i] < energy[best]))) {
+                best = i;
+            }
+        }
+        return best;
+    };
+
+    // random initial points, then swap cluster pixels into voids until nothing moves
+    int initial = count / 10;
+    for (uint32_t i = 0, placed = 0; placed < uint32_t(initial); ++i) {
+        int p = static_cast<int>(LowDiscrepancy::Mix(i) % count);
+        if (!pattern[p]) {
+            pattern[p] = 1;
+            Splat(p, 1.0f);
+            ++placed;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        int cluster = Extreme(1);
+        pattern[cluster] = 0;
+        Splat(cluster, -1.0f);
+        int hole = Extreme(0);
+        pattern[hole] = 1;
+        Splat(hole, 1.0f);
+        if (hole == cluster) {
+            break;
+        }
+    }
+    std::vector<uint8_t> prototype = pattern;
+    std::vector<float> prototypeEnergy = energy;
+
+    // ranks below the initial count come from taking the prototype apart
+    std::vector<int> rank(count);
+    for (int r = initial - 1; r >= 0; --r) {
+        int cluster = Extreme(1);
+        pattern[cluster] = 0;
+        Splat(cluster, -1.0f);
+        rank[cluster] = r;
+    }
+    // the rest from filling its voids one at a time
+    pattern = prototype;
+    energy = prototypeEnergy;
+    for (int r = initial; r < count; ++r) {
+        int hole = Extreme(0);
+        pattern[hole] = 1;
+        Splat(hole, 1.0f);
+        rank[hole] = r;
+    }
+    for (int i = 0; i < count; ++i) {
+        mValues[i] = (rank[i] + 0.5f) / float(count);
+    }
+}
+
+// What TileRenderer hands to every RandomStream it creates.
+struct SamplerSettings {
+    SamplerType             type;
+    uint32_t                samplesPerPixel;    // pattern size of the stratified sampler
+    uint32_t                seed;
+    const BlueNoiseTile    *blueNoise;
+
+    INLINE static SamplerSettings Create(SamplerType type, int samplesPerPixel, uint32_t seed = 0) {
+        SamplerSettings settings;
+        settings.type = type;
+        settings.samplesPerPixel = static_cast<uint32_t>(std::max(samplesPerPixel, 1));
+        settings.seed = seed;
+        // built here so the first tile does not pay for it
+        settings.blueNoise = (type == BlueNoiseSampler) ? &BlueNoiseTile::Shared() : nullptr;
+        return settings;
+    }
+
+    INLINE static const char * Name(SamplerType type) {
+        static const char *names[] = { "independent", "stratified", "sobol", "bluenoise" };
+        return type < SamplerTypeCount ? names[type] : "unknown";
+    }
+
+    INLINE static bool Parse(const char *name, SamplerType &type) {
+        for (uint32_t t = 0; t < SamplerTypeCount; ++t) {
+            if (strcmp(name, Name(SamplerType(t))) == 0) {
+                type = SamplerType(t);
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Hitable.h"
+#include "MaterialTable.h"
+#include "LightTable.h"
+#include "EnvironmentMap.h"
+#include "RadianceCache.h"
+
+// Everything an integrator needs to shade a path.
+struct Scene {
+    Hitable                 *world;
+    MaterialTable           *materials;
+    LightTable              *lights;        // nullptr: no explicit light sampling
+    const EnvironmentMap    *environment;   // nullptr: the sky gradient, found by scattering alone
+    RadianceCache           *cache;         // nullptr: every path runs to its end
+};
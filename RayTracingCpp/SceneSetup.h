@@ -0,0 +1,290 @@
+#pragma once
+
+#include "Sphere.h"
+#include "SphereBatch.h"
+#include "BVHNode.h"
+#include "TriangleMesh.h"
+#include "Instance.h"
+#include "Camera.h"
+#include "MaterialTable.h"
+#include "Scene.h"
+
+// Owns the geometry, materials and camera placement of one of the built in scenes, so
+// the renderer and the benchmark set them up the same way.
+class SceneSetup {
+public:
+    SceneSetup(void)
+    : mPrimitiveCount(0)
+    , mVFov(XM_PIDIV4 * 0.5f)
+    , mAperture(0.1f)
+    , mFocalLength(10.0f)
+    , mBVHBuild(BVHBuildSettings::Create())
+    {
+        mLookFrom = XMVectorSet(13.0f, 2.0f, 3.0f, 0.0f);
+        mLookAt = XMVectorZero();
+    }
+    ~SceneSetup(void) {
+        mWorld.reset();
+        mBottomLevels.clear();
+        for (auto batch : mBatches) {
+            delete batch;
+        }
+        for (auto sphere : mSpheres) {
+            delete sphere;
+        }
+    }
+
+    INLINE Scene View(void) { return { mWorld.get(), &mMaterials, mLights.Empty() ? nullptr : &mLights, mEnvironment.get(), mCache.get() }; }
+    INLINE Camera MakeCamera(float aspect) const {
+        return Camera(mLookFrom, mLookAt, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), mVFov, aspect, mAperture, mFocalLength);
+    }
+    INLINE int PrimitiveCount(void) const { return mPrimitiveCount; }
+    INLINE const LightTable & Lights(void) const { return mLights; }
+    // how the sphere and model trees are built, set before the scene
+    INLINE void SetBVHBuild(const BVHBuildSettings &settings) { mBVHBuild = settings; }
+    // lights any of the scenes with a lat-long map instead of the sky gradient, owned
+    INLINE void SetEnvironment(EnvironmentMap *environment) { mEnvironment.reset(environment); }
+    // lets paths end on a radiance cache, owned; set after the scene, its cells are
+    // sized by the pixels of an image height rows high
+    INLINE void SetRadianceCache(RadianceCache *cache, int height) {
+        mCache.reset(cache);
+        if (cache) {
+            cache->SetCamera(mLookFrom, 2.0f * std::tan(mVFov * 0.5f) / float(height));
+        }
+    }
+
+    // the final scene of "Ray Tracing in One Weekend"
+    void RandomSpheres(void);
+    // the same spheres at night: a dim sky, moonlight, a point and a spot light and three
+    // small emissive spheres, the case for explicit light sampling
+    void LitSpheres(void);
+    // side * side small spheres on a ground plane, sharing a palette of materials
+    void SphereField(int side);
+    // a Utils::Model file framed by a pinhole camera in front of its +z face, its
+    // emissive triangles sampled through a light tree
+    bool LoadModel(const std::string &file, float aspect);
+    // count copies of one small sphere tree, scaled and turned at random, placed through
+    // a TopLevelBVH; the tree is built once whatever the count
+    void InstancedProps(int count);
+
+private:
+    void BuildSpheres(void);
+    void AddRandomSpheres(void);
+
+    MaterialTable               mMaterials;
+    LightTable                  mLights;
+    std::unique_ptr<EnvironmentMap>   mEnvironment;
+    std::unique_ptr<RadianceCache>    mCache;
+    std::vector<Sphere *>       mSpheres;
+    std::vector<Hitable *>      mBatches;
+    std::unique_ptr<Hitable>    mWorld;
+    std::vector<std::unique_ptr<Hitable>>   mBottomLevels;
+    int                         mPrimitiveCount;
+
+    XMVECTOR                    mLookFrom;
+    XMVECTOR                    mLookAt;
+    float                       mVFov;
+    float                       mAperture;
+    float                       mFocalLength;
+    BVHBuildSettings            mBVHBuild;
+};
+
+INLINE void SceneSetup::BuildSpheres(void) {
+    SphereBatch::Partition(mSpheres.data(), static_cast<int>(mSpheres.size()), SIMD_WIDTH, mBatches);
+    mWorld.reset(new BVHNode(mBatches.data(), static_cast<int>(mBatches.size()), 4, mBVHBuild));
+    mPrimitiveCount = static_cast<int>(mSpheres.size());
+}
+
+INLINE void SceneSetup::RandomSpheres(void) {
+    AddRandomSpheres();
+    BuildSpheres();
+}
+
+INLINE void SceneSetup::LitSpheres(void) {
+    AddRandomSpheres();
+
+    mLights.SetSkyScale(0.02f);
+    mLights.AddDirect({ -0.3f, -1.0f, -0.5f }, { 0.12f, 0.14f, 0.2f });
+    mLights.AddPoint({ 0.0f, 3.0f, 3.0f }, { 6.0f, 5.0f, 4.0f });
+    mLights.AddSpot({ -4.0f, 5.0f, 2.0f }, { 0.0f, -4.0f, -2.0f }, XMConvertToRadians(40.0f), XMConvertToRadians(8.0f), { 30.0f, 28.0f, 24.0f });
+
+    // lanterns floating over the small spheres
+    static const XMFLOAT3 lanterns[] = { { 2.0f, 1.6f, 2.0f }, { -2.0f, 1.6f, -1.5f }, { 7.0f, 1.6f, 1.0f } };
+    Material lantern = Lambertian::Create({ 0.8f, 0.8f, 0.8f });
+    lantern.emission = XMFLOAT3(12.0f, 9.0f, 5.0f);
+    uint32_t mat = mMaterials.Add(lantern);
+    for (auto &center : lanterns) {
+        Sphere *obj = new Sphere(XMLoadFloat3(&center), 0.2f, mat);
+        mSpheres.push_back(obj);
+        mLights.AddEmitter(*obj, lantern);
+    }
+
+    BuildSpheres();
+}
+
+INLINE void SceneSetup::AddRandomSpheres(void) {
+    // the scene layout is not part of any pixel's sample stream, a fixed seed engine keeps it stable
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> dist(0.0f);
+    auto RandomUnit = [&engine, &dist](void) { return dist(engine); };
+
+    uint32_t mat;
+    Sphere *obj;
+
+    {
+        mat = mMaterials.Add(Lambertian::Create({ 0.5f, 0.5f, 0.5f }));
+        obj = new Sphere({ 0.0f, -1000.0f, 0.0f }, 1000.0f, mat);
+        mSpheres.push_back(obj);
+    }
+
+    for (int a = -11; a < 11; ++a) {
+        for (int b = -11; b < 11; ++b) {
+            float chooseMat = RandomUnit();
+            XMVECTOR center = { float(a) + 0.9f * RandomUnit(), 0.2f, float(b) + 0.9f * RandomUnit() };
+            XMVECTOR x = { 4.0f, 0.2f, 0.0f };
+            if (XMVectorGetX(XMVector3Length(center - x)) > 0.9f) {
+                if (chooseMat < 0.8f) { // lambertian
+                    mat = mMaterials.Add(Lambertian::Create({ RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit() }));
+                } else if (chooseMat < 0.95f) { // metal
+                    mat = mMaterials.Add(Metal::Create({ 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()) }, 0.5f * RandomUnit()));
+                } else { // glass
+                    mat = mMaterials.Add(Dielectric::Create(1.5f));
+                }
+                obj = new Sphere(center, 0.2f, mat);
+                mSpheres.push_back(obj);
+            }
+        }
+    }
+
+    {
+        mat = mMaterials.Add(Dielectric::Create(1.5f));
+        obj = new Sphere({ 0.0f, 1.0f, 0.0f }, 1.0f, mat);
+        mSpheres.push_back(obj);
+    }
+
+    {
+        mat = mMaterials.Add(Lambertian::Create({ 0.4f, 0.2f, 0.1f }));
+        obj = new Sphere({ -4.0f, 1.0f, 0.0f }, 1.0f, mat);
+        mSpheres.push_back(obj);
+    }
+
+    {
+        mat = mMaterials.Add(Metal::Create({ 0.7f, 0.6f, 0.5f }, 0.0f));
+        obj = new Sphere({ 4.0f, 1.0f, 0.0f }, 1.0f, mat);
+        mSpheres.push_back(obj);
+    }
+}
+
+INLINE void SceneSetup::SphereField(int side) {
+    std::mt19937 engine(11);
+    std::uniform_real_distribution<float> dist(0.0f);
+    auto RandomUnit = [&engine, &dist](void) { return dist(engine); };
+
+    static constexpr int PaletteSize = 64;
+    uint32_t palette = mMaterials.Count();
+    for (int i = 0; i < PaletteSize; ++i) {
+        float chooseMat = RandomUnit();
+        if (chooseMat < 0.8f) {
+            mMaterials.Add(Lambertian::Create({ RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit(), RandomUnit() * RandomUnit() }));
+        } else if (chooseMat < 0.95f) {
+            mMaterials.Add(Metal::Create({ 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()), 0.5f * (1.0f + RandomUnit()) }, 0.5f * RandomUnit()));
+        } else {
+            mMaterials.Add(Dielectric::Create(1.5f));
+        }
+    }
+
+    uint32_t ground = mMaterials.Add(Lambertian::Create({ 0.5f, 0.5f, 0.5f }));
+    mSpheres.reserve(size_t(side) * side + 1);
+    mSpheres.push_back(new Sphere({ 0.0f, -100000.0f, 0.0f }, 100000.0f, ground));
+    for (int a = -side / 2; a < side - side / 2; ++a) {
+        for (int b = -side / 2; b < side - side / 2; ++b) {
+            XMVECTOR center = { float(a) + 0.9f * RandomUnit(), 0.2f, float(b) + 0.9f * RandomUnit() };
+            mSpheres.push_back(new Sphere(center, 0.2f, palette + static_cast<uint32_t>(RandomUnit() * PaletteSize) % PaletteSize));
+        }
+    }
+
+    BuildSpheres();
+    mLookFrom = XMVectorSet(30.0f, 8.0f, 30.0f, 0.0f);
+    mLookAt = XMVectorZero();
+    mVFov = XM_PIDIV4;
+    mAperture = 0.0f;
+    mFocalLength = 40.0f;
+}
+
+INLINE bool SceneSetup::LoadModel(const std::string &file, float aspect) {
+    std::unique_ptr<Utils::Scene> model(Utils::Model::LoadFromFile(file.c_str()));
+    if (!model) {
+        return false;
+    }
+    uint32_t materialBase = TriangleMesh::AddMaterials(*model, mMaterials);
+    TriangleMesh *mesh = new TriangleMesh(*model, materialBase, 2, mBVHBuild);
+    mWorld.reset(mesh);
+    mPrimitiveCount = mesh->TriangleCount();
+    // emissive triangles become lights of the tree, sampled at every Lambertian hit
+    mLights.BuildTree(*model, materialBase, mMaterials);
+
+    AABB bounds;
+    mesh->BoundingBox(bounds);
+    XMVECTOR extent = (bounds.Max() - bounds.Min()) * 0.5f;
+    mVFov = XM_PIDIV4;
+    mAperture = 0.0f;
+    mFocalLength = XMVectorGetZ(extent) + 1.05f * std::max(XMVectorGetY(extent), XMVectorGetX(extent) / aspect) / std::tan(mVFov * 0.5f);
+    mLookAt = bounds.Centroid();
+    mLookFrom = mLookAt + XMVectorSet(0.0f, 0.0f, mFocalLength, 0.0f);
+    return true;
+}
+
+INLINE void SceneSetup::InstancedProps(int count) {
+    std::mt19937 engine(7);
+    std::uniform_real_distribution<float> dist(0.0f);
+    auto RandomUnit = [&engine, &dist](void) { return dist(engine); };
+
+    // the prop in object space: a trunk of small spheres under a canopy of larger ones
+    uint32_t bark = mMaterials.Add(Lambertian::Create({ 0.4f, 0.25f, 0.1f }));
+    uint32_t leaves = mMaterials.Add(Lambertian::Create({ 0.15f, 0.5f, 0.1f }));
+    uint32_t fruit = mMaterials.Add(Metal::Create({ 0.9f, 0.6f, 0.2f }, 0.1f));
+    size_t propBegin = mSpheres.size();
+    for (int i = 0; i < 8; ++i) {
+        mSpheres.push_back(new Sphere({ 0.0f, 0.05f + 0.09f * i, 0.0f }, 0.08f, bark));
+    }
+    for (int i = 0; i < 32; ++i) {
+        float z = 1.0f - 2.0f * RandomUnit();
+        float phi = XM_2PI * RandomUnit();
+        float r = 0.3f * std::cbrt(RandomUnit());
+        float s = std::sqrt(std::max(0.0f, 1.0f - z * z)) * r;
+        XMVECTOR center = { s * std::cos(phi), 0.95f + z * r, s * std::sin(phi) };
+        mSpheres.push_back(new Sphere(center, i % 8 == 0 ? 0.06f : 0.14f, i % 8 == 0 ? fruit : leaves));
+    }
+    int propSize = static_cast<int>(mSpheres.size() - propBegin);
+    size_t batchBegin = mBatches.size();
+    SphereBatch::Partition(mSpheres.data() + propBegin, propSize, SIMD_WIDTH, mBatches);
+    BVHNode *prop = new BVHNode(mBatches.data() + batchBegin, static_cast<int>(mBatches.size() - batchBegin));
+    mBottomLevels.emplace_back(prop);
+
+    uint32_t ground = mMaterials.Add(Lambertian::Create({ 0.5f, 0.5f, 0.5f }));
+    mSpheres.push_back(new Sphere({ 0.0f, -100000.0f, 0.0f }, 100000.0f, ground));
+    batchBegin = mBatches.size();
+    SphereBatch::Partition(&mSpheres.back(), 1, SIMD_WIDTH, mBatches);
+    BVHNode *floor = new BVHNode(mBatches.data() + batchBegin, 1);
+    mBottomLevels.emplace_back(floor);
+
+    TopLevelBVH *world = new TopLevelBVH();
+    world->AddInstance(floor, XMMatrixIdentity());
+    int side = std::max(static_cast<int>(std::ceil(std::sqrt(float(count)))), 1);
+    for (int i = 0; i < count; ++i) {
+        float x = float(i % side - side / 2) + 0.5f * RandomUnit();
+        float z = float(i / side - side / 2) + 0.5f * RandomUnit();
+        float scale = 0.7f + 0.6f * RandomUnit();
+        XMMATRIX transform = XMMatrixScaling(scale, scale, scale) * XMMatrixRotationRollPitchYaw(0.0f, XM_2PI * RandomUnit(), 0.0f) * XMMatrixTranslation(x, 0.0f, z);
+        world->AddInstance(prop, transform);
+    }
+    world->Build();
+    mWorld.reset(world);
+    mPrimitiveCount = propSize * count + 1;
+
+    mLookFrom = XMVectorSet(0.3f * side + 2.0f, 0.08f * side + 1.5f, 0.3f * side + 2.0f, 0.0f);
+    mLookAt = XMVectorSet(0.0f, 0.5f, 0.0f, 0.0f);
+    mVFov = XM_PIDIV4;
+    mAperture = 0.0f;
+    mFocalLength = 10.0f;
+}
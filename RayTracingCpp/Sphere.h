@@ -2,13 +2,11 @@
 
 #include "Hitable.h"
 
-class Material;
-
 class Sphere : public Hitable {
 public:
-    Sphere(const XMVECTOR& center, float radius, Material *material)
+    Sphere(const XMVECTOR& center, float radius, uint32_t matIndex)
     : mRadius(radius)
-    , mMaterial(material)
+    , mMatIndex(matIndex)
     {
         mCenter = center;
     }
@@ -18,21 +16,26 @@ public:
 
     INLINE XMVECTOR Center(void) const { return mCenter; }
     INLINE float Radius(void) const { return mRadius; }
+    INLINE uint32_t MatIndex(void) const { return mMatIndex; }
+    // moves the sphere, a BVH over it needs a Refit afterwards
+    INLINE void SetCenter(const XMVECTOR &center) { mCenter = center; }
 
     void RecordHit(const Ray& ray, float t, Record& record);
     virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
 
 private:
     XMVECTOR    mCenter;
     float       mRadius;
-    Material   *mMaterial;
+    uint32_t    mMatIndex;
 };
 
 INLINE void Sphere::RecordHit(const Ray& ray, float t, Record& record) {
     record.t = t;
     record.p = ray.PointAt(t);
     record.n = XMVector3Normalize(record.p - mCenter);
-    record.mat = mMaterial;
+    record.matIndex = mMatIndex;
+    record.primIndex = NoPrimitive;
 }
 
 INLINE bool Sphere::Hit(const Ray& ray, float tMin, float tMax, Record& record) {
@@ -57,3 +60,9 @@ INLINE bool Sphere::Hit(const Ray& ray, float tMin, float tMax, Record& record)
     return false;
 }
 
+
+INLINE bool Sphere::BoundingBox(AABB &box) {
+    XMVECTOR extent = { mRadius, mRadius, mRadius, 0.0f };
+    box = AABB(mCenter - extent, mCenter + extent);
+    return true;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "Hitable.h"
+#include "Sphere.h"
+#include "SIMD.h"
+
+// A small group of spheres stored as structure of arrays and intersected SIMD_WIDTH
+// at a time. The loop only tracks the nearest t and its index per lane; the hit
+// point, normal and material are resolved once for the winner.
+class SphereBatch : public Hitable {
+public:
+    SphereBatch(Sphere **spheres, int count);
+    ~SphereBatch(void) {
+
+    }
+
+    INLINE int Count(void) const { return mCount; }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+    // Splits spheres at the centroid median of the longest axis until every group fits
+    // in batchSize, so each batch is spatially compact and makes a dense BVH leaf.
+    static void Partition(Sphere **spheres, int count, int batchSize, std::vector<Hitable *> &batches);
+
+private:
+    std::vector<float>      mCenterX;   // padded to a multiple of SIMD_WIDTH
+    std::vector<float>      mCenterY;
+    std::vector<float>      mCenterZ;
+    std::vector<float>      mRadius2;
+    std::vector<float>      mRadius;
+    std::vector<uint32_t>   mMatIndices;
+    int                     mCount;
+    AABB                    mBounds;
+};
+
+INLINE SphereBatch::SphereBatch(Sphere **spheres, int count)
+: mCount(count)
+{
+    int padded = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    // padding lanes get an infinitely negative squared radius, their discriminant is never positive
+    mCenterX.resize(padded, 0.0f);
+    mCenterY.resize(padded, 0.0f);
+    mCenterZ.resize(padded, 0.0f);
+    mRadius2.resize(padded, -INFINITY);
+    mRadius.resize(count);
+    mMatIndices.resize(count);
+
+    AABB box;
+    for (int i = 0; i < count; ++i) {
+        XMVECTOR center = spheres[i]->Center();
+        float radius = spheres[i]->Radius();
+        mCenterX[i] = XMVectorGetX(center);
+        mCenterY[i] = XMVectorGetY(center);
+        mCenterZ[i] = XMVectorGetZ(center);
+        mRadius2[i] = radius * radius;
+        mRadius[i] = radius;
+        mMatIndices[i] = spheres[i]->MatIndex();
+        spheres[i]->BoundingBox(box);
+        mBounds.Merge(box);
+    }
+}
+
+INLINE bool SphereBatch::BoundingBox(AABB &box) {
+    box = mBounds;
+    return mCount > 0;
+}
+
+INLINE bool SphereBatch::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    XMVECTOR origin = ray.Origin();
+    XMVECTOR direction = ray.Direction();
+    SIMDFloat ox = SIMDSet1(XMVectorGetX(origin));
+    SIMDFloat oy = SIMDSet1(XMVectorGetY(origin));
+    SIMDFloat oz = SIMDSet1(XMVectorGetZ(origin));
+    SIMDFloat dx = SIMDSet1(XMVectorGetX(direction));
+    SIMDFloat dy = SIMDSet1(XMVectorGetY(direction));
+    SIMDFloat dz = SIMDSet1(XMVectorGetZ(direction));
+    SIMDFloat tLow = SIMDSet1(tMin);
+    SIMDFloat zero = SIMDSet1(0.0f);
+
+    SIMDFloat bestT = SIMDSet1(tMax);
+    SIMDFloat bestIndex = SIMDSet1(-1.0f);
+    SIMDFloat index = SIMDLaneIndex();
+    SIMDFloat step = SIMDSet1(float(SIMD_WIDTH));
+
+    int padded = static_cast<int>(mRadius2.size());
+    for (int i = 0; i < padded; i += SIMD_WIDTH) {
+        SIMDFloat ocx = SIMDSub(ox, SIMDLoad(&mCenterX[i]));
+        SIMDFloat ocy = SIMDSub(oy, SIMDLoad(&mCenterY[i]));
+        SIMDFloat ocz = SIMDSub(oz, SIMDLoad(&mCenterZ[i]));
+        // ray directions are normalized, so the quadratic's a term is 1
+        SIMDFloat b = SIMDAdd(SIMDAdd(SIMDMul(dx, ocx), SIMDMul(dy, ocy)), SIMDMul(dz, ocz));
+        // r^2 - |oc - b * d|^2 rather than b^2 - c, it does not cancel catastrophically far from the sphere
+        SIMDFloat lx = SIMDSub(ocx, SIMDMul(b, dx));
+        SIMDFloat ly = SIMDSub(ocy, SIMDMul(b, dy));
+        SIMDFloat lz = SIMDSub(ocz, SIMDMul(b, dz));
+        SIMDFloat l2 = SIMDAdd(SIMDAdd(SIMDMul(lx, lx), SIMDMul(ly, ly)), SIMDMul(lz, lz));
+        SIMDFloat discriminant = SIMDSub(SIMDLoad(&mRadius2[i]), l2);
+        SIMDFloat valid = SIMDGreater(discriminant, zero);
+        if (SIMDMask(valid)) {
+            SIMDFloat root = SIMDSqrt(SIMDMax(discriminant, zero));
+            SIMDFloat t0 = SIMDSub(SIMDSub(zero, b), root);
+            SIMDFloat t1 = SIMDAdd(SIMDSub(zero, b), root);
+            // take the near root when it is in range, the far root otherwise
+            SIMDFloat hit0 = SIMDAnd(valid, SIMDAnd(SIMDGreater(t0, tLow), SIMDLess(t0, bestT)));
+            SIMDFloat hit1 = SIMDAnd(valid, SIMDAnd(SIMDGreater(t1, tLow), SIMDLess(t1, bestT)));
+            SIMDFloat t = SIMDSelect(t1, t0, hit0);
+            SIMDFloat hit = SIMDOr(hit0, hit1);
+            bestT = SIMDSelect(bestT, t, hit);
+            bestIndex = SIMDSelect(bestIndex, index, hit);
+        }
+        index = SIMDAdd(index, step);
+    }
+
+    float laneT[SIMD_WIDTH], laneIndex[SIMD_WIDTH];
+    SIMDStore(laneT, bestT);
+    SIMDStore(laneIndex, bestIndex);
+    int winner = -1;
+    float closetHit = tMax;
+    for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+        if (laneIndex[lane] >= 0.0f && laneT[lane] < closetHit) {
+            closetHit = laneT[lane];
+            winner = int(laneIndex[lane]);
+        }
+    }
+    if (winner < 0) {
+        return false;
+    }
+
+    XMVECTOR center = { mCenterX[winner], mCenterY[winner], mCenterZ[winner], 0.0f };
+    record.t = closetHit;
+    record.p = ray.PointAt(closetHit);
+    record.n = (record.p - center) / mRadius[winner];
+    record.matIndex = mMatIndices[winner];
+    record.primIndex = NoPrimitive;
+    return true;
+}
+
+// the kernel of Hit without the nearest hit bookkeeping, any lane in range ends it
+INLINE bool SphereBatch::Occluded(const Ray &ray, float tMin, float tMax) {
+    XMVECTOR origin = ray.Origin();
+    XMVECTOR direction = ray.Direction();
+    SIMDFloat ox = SIMDSet1(XMVectorGetX(origin));
+    SIMDFloat oy = SIMDSet1(XMVectorGetY(origin));
+    SIMDFloat oz = SIMDSet1(XMVectorGetZ(origin));
+    SIMDFloat dx = SIMDSet1(XMVectorGetX(direction));
+    SIMDFloat dy = SIMDSet1(XMVectorGetY(direction));
+    SIMDFloat dz = SIMDSet1(XMVectorGetZ(direction));
+    SIMDFloat tLow = SIMDSet1(tMin);
+    SIMDFloat tHigh = SIMDSet1(tMax);
+    SIMDFloat zero = SIMDSet1(0.0f);
+
+    int padded = static_cast<int>(mRadius2.size());
+    for (int i = 0; i < padded; i += SIMD_WIDTH) {
+        SIMDFloat ocx = SIMDSub(ox, SIMDLoad(&mCenterX[i]));
+        SIMDFloat ocy = SIMDSub(oy, SIMDLoad(&mCenterY[i]));
+        SIMDFloat ocz = SIMDSub(oz, SIMDLoad(&mCenterZ[i]));
+        SIMDFloat b = SIMDAdd(SIMDAdd(SIMDMul(dx, ocx), SIMDMul(dy, ocy)), SIMDMul(dz, ocz));
+        SIMDFloat lx = SIMDSub(ocx, SIMDMul(b, dx));
+        SIMDFloat ly = SIMDSub(ocy, SIMDMul(b, dy));
+        SIMDFloat lz = SIMDSub(ocz, SIMDMul(b, dz));
+        SIMDFloat l2 = SIMDAdd(SIMDAdd(SIMDMul(lx, lx), SIMDMul(ly, ly)), SIMDMul(lz, lz));
+        SIMDFloat discriminant = SIMDSub(SIMDLoad(&mRadius2[i]), l2);
+        SIMDFloat valid = SIMDGreater(discriminant, zero);
+        if (SIMDMask(valid)) {
+            SIMDFloat root = SIMDSqrt(SIMDMax(discriminant, zero));
+            SIMDFloat t0 = SIMDSub(SIMDSub(zero, b), root);
+            SIMDFloat t1 = SIMDAdd(SIMDSub(zero, b), root);
+            SIMDFloat hit0 = SIMDAnd(SIMDGreater(t0, tLow), SIMDLess(t0, tHigh));
+            SIMDFloat hit1 = SIMDAnd(SIMDGreater(t1, tLow), SIMDLess(t1, tHigh));
+            if (SIMDMask(SIMDAnd(valid, SIMDOr(hit0, hit1)))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+inline void SphereBatch::Partition(Sphere **spheres, int count, int batchSize, std::vector<Hitable *> &batches) {
+    if (count <= 0) {
+        return;
+    }
+    if (count <= batchSize) {
+        batches.push_back(new SphereBatch(spheres, count));
+        return;
+    }
+
+    AABB centroids;
+    for (int i = 0; i < count; ++i) {
+        centroids.Merge(spheres[i]->Center());
+    }
+    XMVECTOR extent = centroids.Max() - centroids.Min();
+    int axis = 0;
+    if (XMVectorGetY(extent) > XMVectorGetByIndex(extent, axis)) { axis = 1; }
+    if (XMVectorGetZ(extent) > XMVectorGetByIndex(extent, axis)) { axis = 2; }
+
+    // split on a multiple of batchSize so only the last batch can be partially filled
+    int mid = (count / batchSize + 1) / 2 * batchSize;
+    std::nth_element(spheres, spheres + mid, spheres + count, [axis](Sphere *a, Sphere *b) {
+        return XMVectorGetByIndex(a->Center(), axis) < XMVectorGetByIndex(b->Center(), axis);
+    });
+    Partition(spheres, mid, batchSize, batches);
+    Partition(spheres + mid, count - mid, batchSize, batches);
+}
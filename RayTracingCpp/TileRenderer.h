@@ -0,0 +1,653 @@
+#pragma once
+
+#include "Ray.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Random.h"
+#include "TileScheduler.h"
+#include "FrameBuffer.h"
+#include "AsyncImageWriter.h"
+#include "AdaptiveSampler.h"
+#include "RayStats.h"
+#include "Wavefront.h"
+#include "FeatureBuffer.h"
+#include "Progressive.h"
+#include "Distributed.h"
+
+// Renders an image with a pool of worker threads pulling tiles from a TileScheduler.
+// Every worker shades into its own tile buffer and only hands it on once the tile is
+// finished, so threads do not fight over cache lines while tracing. A finished tile is
+// merged into the optional FrameBuffer and queued on the optional AsyncImageWriter.
+// With a FeatureBuffer set, the first hit features of every tile are stored there too.
+// RenderProgressive runs the same tiles pass after pass over one accumulation of pixel
+// estimates, each pass picking up the sample sequence of a pixel where it stopped. A
+// scene with a radiance cache is rendered the same way in waves of a few samples, the
+// cache expiring its cells between them while no path runs.
+// RenderJobs makes the renderer a worker of a distributed frame, its threads taking the
+// jobs of a JobBoard instead of the tiles of a scheduler.
+class TileRenderer {
+public:
+    typedef XMVECTOR (*ShadeFunc)(const Ray &ray, const Scene &scene, int depth, RandomStream &rng);
+    // shades a camera ray whose first hit is already known
+    typedef XMVECTOR (*ShadeHitFunc)(const Ray &ray, bool hit, const Hitable::Record &record, const Scene &scene, RandomStream &rng);
+
+    struct TileStat {
+        int     index;
+        int     x, y;
+        int     worker;
+        bool    stolen;
+        double  ms;
+        int64_t samples;
+        double  errorSum;   // relative error summed over the pixels of the tile
+        float   errorMax;
+        int     converged;  // pixels at or below the target error
+    };
+
+    struct ProgressiveStats {
+        int         passes;         // rendered by this run
+        int         resumedPasses;  // found in the checkpoint
+        int         samples;        // per pixel, over all runs
+        double      seconds;        // of this run
+        double      totalSeconds;   // over all runs
+        float       meanError;      // mean relative error of the image
+        const char  *stoppedBy;     // "time", "noise" or "samples"
+    };
+
+    TileRenderer(int width, int height, int samples, int tileSize = 32, int threadCount = 0);
+    ~TileRenderer(void) {
+
+    }
+
+    INLINE int Width(void) const { return mWidth; }
+    INLINE int Height(void) const { return mHeight; }
+    INLINE int ThreadCount(void) const { return mThreadCount; }
+    INLINE double RenderSeconds(void) const { return mRenderSeconds; }
+    INLINE const std::vector<TileStat> & TileStats(void) const { return mTileStats; }
+    // rays traced by the last Render, as counted by the integrator
+    INLINE const RayStats & Rays(void) const { return mRays; }
+    int64_t TotalSamples(void) const;
+
+    // samples is the average per pixel budget; Fixed() spends exactly that on every pixel
+    INLINE void SetAdaptive(const AdaptiveSettings &settings) { mAdaptive = settings; }
+    // the sequence the pixel, lens and bounce decisions draw from, independent by default
+    INLINE void SetSampler(const SamplerSettings &settings) { mSampler = settings; }
+    INLINE const SamplerSettings & Sampler(void) const { return mSampler; }
+    // Traces the camera rays of the first pass as packets of PacketWidth x PacketHeight
+    // neighbouring pixels and hands their hits to shade; nullptr traces ray by ray. The
+    // image is the same either way.
+    INLINE void SetPacketShade(ShadeHitFunc shade) { mPacketShade = shade; }
+    // Runs the first pass through a WavefrontTracer per worker instead of the shade
+    // function, always with the iterative integrator. Takes precedence over packets.
+    INLINE void SetWavefront(bool wavefront) { mWavefront = wavefront; }
+    // Fills features with the albedo, normal and depth of the first hit, averaged over
+    // the positions of the first FeatureSamples samples of every pixel, and the variance
+    // of its estimate. nullptr, the default, traces no feature rays.
+    INLINE void SetFeatures(FeatureBuffer *features) { mFeatures = features; }
+
+    // With a radiance cache in scene the samples are taken in waves of CacheWaveSamples
+    // over an accumulation of the whole image; only the last one takes the adaptive
+    // samples and the features and hands the tiles on.
+    void Render(const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame = nullptr, AsyncImageWriter *writer = nullptr);
+    // Renders passes of settings.passSamples per pixel until one of the limits of settings
+    // is reached, then adds the image to frame. A checkpoint is resumed from and saved
+    // after every pass, the radiance cache of scene expires its cells between passes. The
+    // adaptive settings are not used, tile stats are of the last pass.
+    ProgressiveStats RenderProgressive(const Scene &scene, Camera &camera, ShadeFunc shade, const ProgressiveSettings &settings,
+                                       RenderCheckpoint *checkpoint, FrameBuffer &frame);
+    // Renders jobs of board as its worker until the coordinator stops it. The tile size
+    // and the sample ranges are those of the board, the adaptive settings are not used.
+    void RenderJobs(const Scene &scene, Camera &camera, ShadeFunc shade, JobBoard &board, uint32_t worker);
+
+    void PrintTimings(std::ostream &os) const;
+    void WriteTileTimings(const std::string &file) const;
+
+private:
+    // every tile once, by the worker threads
+    void RenderPass(const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame, AsyncImageWriter *writer);
+    void WorkerMain(int worker, TileScheduler &scheduler, const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame, AsyncImageWriter *writer);
+    void JobWorkerMain(JobBoard &board, uint32_t worker, const Scene &scene, Camera &camera, ShadeFunc shade);
+    void RenderTile(const Tile &tile, const Scene &scene, Camera &camera, ShadeFunc shade, XMFLOAT4 *buffer, PixelEstimate *estimates, WavefrontTracer *wavefront, TileStat &stat);
+    // samples [first, first + count) of every pixel of the tile, by wavefront, packets or pixel
+    void SampleRange(const Tile &tile, const Scene &scene, Camera &camera, ShadeFunc shade, int first, int count, PixelEstimate *estimates, WavefrontTracer *wavefront);
+    void SamplePixel(int i, int j, const Scene &scene, Camera &camera, ShadeFunc shade, int first, int count, PixelEstimate &estimate);
+    // every pixel of the tile has first samples already
+    void SamplePackets(const Tile &tile, const Scene &scene, Camera &camera, int first, int count, PixelEstimate *estimates);
+    void SampleWavefront(const Tile &tile, const Scene &scene, Camera &camera, int first, int count, PixelEstimate *estimates, WavefrontTracer &wavefront);
+    void SampleFeatures(const Tile &tile, const Scene &scene, Camera &camera, const PixelEstimate *estimates, Feature *features);
+
+    static constexpr int    PacketWidth = 4;
+    static constexpr int    PacketHeight = 4;
+    static constexpr int    FeatureSamples = 4;
+    // as many as a progressive pass takes, the cache ages its cells by waves or passes
+    static constexpr int    CacheWaveSamples = 4;
+
+    int                     mWidth;
+    int                     mHeight;
+    int                     mSamples;
+    int                     mTileSize;
+    int                     mThreadCount;
+    double                  mRenderSeconds;
+    AdaptiveSettings        mAdaptive;
+    SamplerSettings         mSampler;
+    ShadeHitFunc            mPacketShade;
+    bool                    mWavefront;
+    FeatureBuffer           *mFeatures;
+    // the whole image while RenderProgressive runs, tiles start from it and go back to it
+    std::vector<PixelEstimate>  *mAccumulation;
+    int                     mPassSamples;
+    // the waves of a cache render before the last one, and the last that completes the image
+    bool                    mEarlyWave;
+    bool                    mLastWave;
+    RayStats                mRays;
+    std::vector<RayStats>   mWorkerRays;
+    std::vector<TileStat>   mTileStats;
+};
+
+INLINE TileRenderer::TileRenderer(int width, int height, int samples, int tileSize, int threadCount)
+: mWidth(width)
+, mHeight(height)
+, mSamples(samples)
+, mTileSize(tileSize)
+, mThreadCount(threadCount)
+, mRenderSeconds(0.0)
+, mAdaptive(AdaptiveSettings::Fixed())
+, mSampler(SamplerSettings::Create(IndependentSampler, samples))
+, mPacketShade(nullptr)
+, mWavefront(false)
+, mFeatures(nullptr)
+, mAccumulation(nullptr)
+, mPassSamples(0)
+, mEarlyWave(false)
+, mLastWave(false)
+{
+    if (mThreadCount <= 0) {
+        mThreadCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+}
+
+INLINE void TileRenderer::Render(const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame, AsyncImageWriter *writer) {
+    if (!scene.cache) {
+        RenderPass(scene, camera, shade, frame, writer);
+        return;
+    }
+
+    // the samples of every pixel are drawn in order, so the waves sample what one pass would
+    std::vector<PixelEstimate> estimates(size_t(mWidth) * mHeight);
+    std::vector<double> tileMs;
+    RayStats rays = {};
+    int firstPass = mAdaptive.enabled ? mAdaptive.minSamples : mSamples;
+    auto start = std::chrono::high_resolution_clock::now();
+    mAccumulation = &estimates;
+    for (int first = 0; first < firstPass; first += CacheWaveSamples) {
+        mPassSamples = std::min(CacheWaveSamples, firstPass - first);
+        mLastWave = first + mPassSamples >= firstPass;
+        mEarlyWave = !mLastWave;
+        RenderPass(scene, camera, shade, mLastWave ? frame : nullptr, mLastWave ? writer : nullptr);
+        scene.cache->Update();
+
+        tileMs.resize(mTileStats.size());
+        for (size_t t = 0; t < mTileStats.size(); ++t) {
+            tileMs[t] += mTileStats[t].ms;
+        }
+        rays.primary += mRays.primary;
+        rays.secondary += mRays.secondary;
+        rays.shadow += mRays.shadow;
+    }
+    mAccumulation = nullptr;
+    mLastWave = false;
+
+    // the stats of the last wave, with the time of all of them
+    for (size_t t = 0; t < mTileStats.size(); ++t) {
+        mTileStats[t].ms = tileMs[t];
+    }
+    mRays = rays;
+    mRenderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+INLINE void TileRenderer::RenderPass(const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame, AsyncImageWriter *writer) {
+    TileScheduler scheduler(mWidth, mHeight, mTileSize, mThreadCount);
+    mTileStats.clear();
+    mTileStats.resize(scheduler.TileCount());
+    mWorkerRays.assign(mThreadCount, RayStats());
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    threads.reserve(mThreadCount);
+    for (int w = 0; w < mThreadCount; ++w) {
+        threads.emplace_back(&TileRenderer::WorkerMain, this, w, std::ref(scheduler), std::cref(scene), std::ref(camera), shade, frame, writer);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    mRenderSeconds = elapsed.count();
+
+    mRays = RayStats();
+    for (auto &rays : mWorkerRays) {
+        mRays.primary += rays.primary;
+        mRays.secondary += rays.secondary;
+        mRays.shadow += rays.shadow;
+    }
+}
+
+INLINE TileRenderer::ProgressiveStats TileRenderer::RenderProgressive(const Scene &scene, Camera &camera, ShadeFunc shade, const ProgressiveSettings &settings,
+                                                                      RenderCheckpoint *checkpoint, FrameBuffer &frame) {
+    std::vector<PixelEstimate> estimates(size_t(mWidth) * mHeight);
+    ProgressiveStats stats = { 0, 0, 0, 0.0, 0.0, FLT_MAX, "samples" };
+    double previousSeconds = 0.0;
+    if (checkpoint) {
+        checkpoint->Load(estimates);
+        stats.resumedPasses = static_cast<int>(checkpoint->Passes());
+        previousSeconds = checkpoint->Seconds();
+    }
+
+    auto MeanError = [&estimates]() {
+        double sum = 0.0;
+        for (const PixelEstimate &estimate : estimates) {
+            sum += estimate.RelativeError();
+        }
+        return static_cast<float>(sum / estimates.size());
+    };
+
+    mAccumulation = &estimates;
+    mPassSamples = settings.passSamples;
+    auto start = std::chrono::high_resolution_clock::now();
+    double passSeconds = 0.0;
+    int passes = stats.resumedPasses;
+    for (;;) {
+        // the passes so far stand for the next one
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        stats.meanError = MeanError();
+        if (settings.targetError > 0.0f && stats.meanError <= settings.targetError) {
+            stats.stoppedBy = "noise";
+            break;
+        }
+        if (settings.maxSamples > 0 && estimates[0].Count() >= settings.maxSamples) {
+            stats.stoppedBy = "samples";
+            break;
+        }
+        if (settings.timeBudget > 0.0 && elapsed.count() + passSeconds > settings.timeBudget) {
+            stats.stoppedBy = "time";
+            break;
+        }
+
+        RenderPass(scene, camera, shade, nullptr, nullptr);
+        if (scene.cache) {
+            scene.cache->Update();
+        }
+        passSeconds = mRenderSeconds;
+        ++passes;
+        ++stats.passes;
+        if (checkpoint) {
+            elapsed = std::chrono::high_resolution_clock::now() - start;
+            checkpoint->Save(estimates, static_cast<uint32_t>(passes), previousSeconds + elapsed.count());
+        }
+    }
+    mAccumulation = nullptr;
+
+    stats.samples = estimates[0].Count();
+    stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    stats.totalSeconds = previousSeconds + stats.seconds;
+
+    std::vector<XMFLOAT4> row(mWidth);
+    for (int y = 0; y < mHeight; ++y) {
+        for (int x = 0; x < mWidth; ++x) {
+            const PixelEstimate &estimate = estimates[size_t(y) * mWidth + x];
+            XMStoreFloat4(&row[x], XMVectorSetW(estimate.Mean(), float(estimate.Count())));
+        }
+        Tile tile = { 0, 0, 0, y, mWidth, 1 };
+        frame.AddTile(tile, row.data());
+    }
+    return stats;
+}
+
+INLINE void TileRenderer::RenderJobs(const Scene &scene, Camera &camera, ShadeFunc shade, JobBoard &board, uint32_t worker) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    threads.reserve(mThreadCount);
+    for (int t = 0; t < mThreadCount; ++t) {
+        threads.emplace_back(&TileRenderer::JobWorkerMain, this, std::ref(board), worker, std::cref(scene), std::ref(camera), shade);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    mRenderSeconds = elapsed.count();
+}
+
+INLINE void TileRenderer::JobWorkerMain(JobBoard &board, uint32_t worker, const Scene &scene, Camera &camera, ShadeFunc shade) {
+    size_t tilePixels = size_t(board.TileSize()) * board.TileSize();
+    std::vector<PixelEstimate> estimates(tilePixels);
+    std::unique_ptr<WavefrontTracer> wavefront(mWavefront ? new WavefrontTracer() : nullptr);
+
+    int index;
+    for (;;) {
+        if (!board.Claim(worker, index)) {
+            // the jobs left may still be put back by a worker that dies
+            if (board.Stopped()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        const JobBoard::Job &job = board.At(index);
+        int pixelCount = job.tile.width * job.tile.height;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::fill(estimates.begin(), estimates.begin() + pixelCount, PixelEstimate());
+        SampleRange(job.tile, scene, camera, shade, job.first, job.count, estimates.data(), wavefront.get());
+        XMFLOAT4 *results = board.Results(index);
+        for (int p = 0; p < pixelCount; ++p) {
+            XMStoreFloat4(results + p, XMVectorSetW(estimates[p].Mean(), float(estimates[p].Count())));
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        board.Finish(worker, index, elapsed.count());
+    }
+}
+
+INLINE void TileRenderer::WorkerMain(int worker, TileScheduler &scheduler, const Scene &scene, Camera &camera, ShadeFunc shade, FrameBuffer *frame, AsyncImageWriter *writer) {
+    // allocated by the worker itself so the pages are local to the thread that uses them
+    std::vector<XMFLOAT4> buffer(size_t(mTileSize) * mTileSize);
+    std::vector<PixelEstimate> estimates(size_t(mTileSize) * mTileSize);
+    std::unique_ptr<WavefrontTracer> wavefront(mWavefront ? new WavefrontTracer() : nullptr);
+    std::vector<Feature> features(mFeatures ? size_t(mTileSize) * mTileSize : 0);
+    RayStats before = RayStats::Thread();
+
+    Tile tile;
+    while (scheduler.Next(worker, tile)) {
+        // every tile index is owned by exactly one worker
+        TileStat &stat = mTileStats[tile.index];
+
+        auto start = std::chrono::high_resolution_clock::now();
+        RenderTile(tile, scene, camera, shade, buffer.data(), estimates.data(), wavefront.get(), stat);
+        if (mFeatures && !mEarlyWave) {
+            SampleFeatures(tile, scene, camera, estimates.data(), features.data());
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        // tiles never overlap, merging needs no lock
+        if (frame) {
+            frame->AddTile(tile, buffer.data());
+        }
+        if (writer) {
+            writer->Submit(tile, buffer.data());
+        }
+        if (mFeatures && !mEarlyWave) {
+            mFeatures->SetTile(tile, features.data());
+        }
+        if (mAccumulation) {
+            for (int y = 0; y < tile.height; ++y) {
+                const PixelEstimate *row = estimates.data() + y * tile.width;
+                std::copy(row, row + tile.width, mAccumulation->begin() + (size_t(tile.y + y) * mWidth + tile.x));
+            }
+        }
+
+        stat.index = tile.index;
+        stat.x = tile.x;
+        stat.y = tile.y;
+        stat.worker = worker;
+        stat.stolen = (tile.owner != worker);
+        stat.ms = elapsed.count();
+    }
+
+    const RayStats &after = RayStats::Thread();
+    mWorkerRays[worker].primary = after.primary - before.primary;
+    mWorkerRays[worker].secondary = after.secondary - before.secondary;
+    mWorkerRays[worker].shadow = after.shadow - before.shadow;
+}
+
+INLINE void TileRenderer::SampleRange(const Tile &tile, const Scene &scene, Camera &camera, ShadeFunc shade, int first, int count, PixelEstimate *estimates, WavefrontTracer *wavefront) {
+    if (wavefront) {
+        SampleWavefront(tile, scene, camera, first, count, estimates, *wavefront);
+    } else if (mPacketShade) {
+        SamplePackets(tile, scene, camera, first, count, estimates);
+    } else {
+        for (int y = 0; y < tile.height; ++y) {
+            int j = mHeight - 1 - (tile.y + y);
+            for (int x = 0; x < tile.width; ++x) {
+                SamplePixel(tile.x + x, j, scene, camera, shade, first, count, estimates[y * tile.width + x]);
+            }
+        }
+    }
+}
+
+INLINE void TileRenderer::SamplePixel(int i, int j, const Scene &scene, Camera &camera, ShadeFunc shade, int first, int count, PixelEstimate &estimate) {
+    uint32_t row = static_cast<uint32_t>(mHeight - 1 - j);
+    uint32_t pixel = row * mWidth + i;
+    for (int s = first; s < first + count; ++s) {
+        // the stream depends on pixel and sample only, so tiles can run in any order on any thread
+        RandomStream rng(mSampler, static_cast<uint32_t>(i), row, pixel, static_cast<uint32_t>(s));
+        float u = (i + rng.NextFloat() - 0.5f) / float(mWidth);
+        float v = (j + rng.NextFloat() - 0.5f) / float(mHeight);
+        estimate.Add(shade(camera.GenRay(u, v, rng), scene, 0, rng));
+    }
+}
+
+INLINE void TileRenderer::SamplePackets(const Tile &tile, const Scene &scene, Camera &camera, int first, int count, PixelEstimate *estimates) {
+    static_assert(PacketWidth * PacketHeight <= RayPacket::MaxSize, "packet block too large");
+    RayStats &stats = RayStats::Thread();
+    RayPacket packet;
+    for (int by = 0; by < tile.height; by += PacketHeight) {
+        for (int bx = 0; bx < tile.width; bx += PacketWidth) {
+            int width = std::min(PacketWidth, tile.width - bx);
+            int height = std::min(PacketHeight, tile.height - by);
+            // every pixel is at the same sample, s is the next one of all of them
+            for (int s = first; s < first + count; ++s) {
+                // the same streams SamplePixel would create, in the same order per pixel
+                RandomStream streams[PacketWidth * PacketHeight];
+                packet.Clear(0.001f);
+                for (int y = 0; y < height; ++y) {
+                    uint32_t row = static_cast<uint32_t>(tile.y + by + y);
+                    int j = mHeight - 1 - int(row);
+                    for (int x = 0; x < width; ++x) {
+                        int i = tile.x + bx + x;
+                        RandomStream &rng = streams[packet.count];
+                        rng = RandomStream(mSampler, static_cast<uint32_t>(i), row, row * mWidth + i, static_cast<uint32_t>(s));
+                        float u = (i + rng.NextFloat() - 0.5f) / float(mWidth);
+                        float v = (j + rng.NextFloat() - 0.5f) / float(mHeight);
+                        packet.Add(camera.GenRay(u, v, rng), 1e+38f);
+                    }
+                }
+                scene.world->HitPacket(packet);
+                stats.primary += packet.count;
+
+                for (int r = 0; r < packet.count; ++r) {
+                    PixelEstimate &estimate = estimates[(by + r / width) * tile.width + bx + r % width];
+                    estimate.Add(mPacketShade(packet.rays[r], packet.hit[r], packet.records[r], scene, streams[r]));
+                }
+            }
+        }
+    }
+}
+
+INLINE void TileRenderer::SampleWavefront(const Tile &tile, const Scene &scene, Camera &camera, int first, int count, PixelEstimate *estimates, WavefrontTracer &wavefront) {
+    int pixelCount = tile.width * tile.height;
+    // paths are queued sample by sample and resolved in queue order, so every pixel
+    // still receives its samples in order
+    auto Flush = [&]() {
+        wavefront.Trace(scene);
+        for (uint32_t path = 0; path < wavefront.Count(); ++path) {
+            estimates[wavefront.Tag(path)].Add(wavefront.Radiance(path));
+        }
+        wavefront.Clear();
+    };
+    for (int s = first; s < first + count; ++s) {
+        for (int p = 0; p < pixelCount; ++p) {
+            if (wavefront.Full()) {
+                Flush();
+            }
+            int i = tile.x + p % tile.width;
+            uint32_t row = static_cast<uint32_t>(tile.y + p / tile.width);
+            int j = mHeight - 1 - int(row);
+            RandomStream rng(mSampler, static_cast<uint32_t>(i), row, row * mWidth + i, static_cast<uint32_t>(s));
+            float u = (i + rng.NextFloat() - 0.5f) / float(mWidth);
+            float v = (j + rng.NextFloat() - 0.5f) / float(mHeight);
+            Ray ray = camera.GenRay(u, v, rng);
+            wavefront.AddPath(ray, rng, static_cast<uint32_t>(p));
+        }
+    }
+    Flush();
+}
+
+INLINE void TileRenderer::SampleFeatures(const Tile &tile, const Scene &scene, Camera &camera, const PixelEstimate *estimates, Feature *features) {
+    RayStats &stats = RayStats::Thread();
+    int count = std::min(FeatureSamples, mSamples);
+    for (int y = 0; y < tile.height; ++y) {
+        uint32_t row = static_cast<uint32_t>(tile.y + y);
+        int j = mHeight - 1 - int(row);
+        for (int x = 0; x < tile.width; ++x) {
+            int i = tile.x + x;
+            XMVECTOR albedo = XMVectorZero();
+            XMVECTOR normal = XMVectorZero();
+            float depth = 0.0f;
+            for (int s = 0; s < count; ++s) {
+                // the camera ray of sample s, as SamplePixel generates it
+                RandomStream rng(mSampler, static_cast<uint32_t>(i), row, row * mWidth + i, static_cast<uint32_t>(s));
+                float u = (i + rng.NextFloat() - 0.5f) / float(mWidth);
+                float v = (j + rng.NextFloat() - 0.5f) / float(mHeight);
+                Ray ray = camera.GenRay(u, v, rng);
+                Hitable::Record record;
+                if (scene.world->Hit(ray, 0.001f, 1e+38f, record)) {
+                    XMVECTOR n = XMVector3Normalize(record.n);
+                    // facing the camera, both sides of a surface are the same surface
+                    normal += XMVectorGetX(XMVector3Dot(n, ray.Direction())) > 0.0f ? -n : n;
+                    albedo += scene.materials->Albedo(record);
+                    depth += record.t;
+                } else {
+                    albedo += XMVectorSplatOne();
+                    depth += FeatureBuffer::MissDepth;
+                }
+            }
+            stats.primary += count;
+
+            Feature &feature = features[y * tile.width + x];
+            float scale = 1.0f / float(count);
+            XMStoreFloat3(&feature.albedo, albedo * scale);
+            XMStoreFloat3(&feature.normal, normal * scale);
+            feature.depth = depth * scale;
+            feature.variance = estimates[y * tile.width + x].Variance();
+        }
+    }
+}
+
+INLINE void TileRenderer::RenderTile(const Tile &tile, const Scene &scene, Camera &camera, ShadeFunc shade, XMFLOAT4 *buffer, PixelEstimate *estimates, WavefrontTracer *wavefront, TileStat &stat) {
+    int pixelCount = tile.width * tile.height;
+    bool adaptive = mAdaptive.enabled && (!mAccumulation || mLastWave);
+    int firstPass = adaptive ? mAdaptive.minSamples : mSamples;
+    int first = 0;
+    if (mAccumulation) {
+        for (int y = 0; y < tile.height; ++y) {
+            auto row = mAccumulation->begin() + (size_t(tile.y + y) * mWidth + tile.x);
+            std::copy(row, row + tile.width, estimates + y * tile.width);
+        }
+        firstPass = mPassSamples;
+        first = estimates[0].Count();
+    } else {
+        std::fill(estimates, estimates + pixelCount, PixelEstimate());
+    }
+
+    SampleRange(tile, scene, camera, shade, first, firstPass, estimates, wavefront);
+    // the last wave of a cache render counts the waves before it too
+    int64_t spent = int64_t(mLastWave ? first + firstPass : firstPass) * pixelCount;
+
+    if (adaptive) {
+        int64_t budget = int64_t(mSamples) * pixelCount;
+        bool active = true;
+        while (active && spent < budget) {
+            active = false;
+            for (int y = 0; y < tile.height && spent < budget; ++y) {
+                int j = mHeight - 1 - (tile.y + y);
+                for (int x = 0; x < tile.width && spent < budget; ++x) {
+                    PixelEstimate &estimate = estimates[y * tile.width + x];
+                    if (estimate.Count() >= mAdaptive.maxSamples || estimate.RelativeError() <= mAdaptive.targetError) {
+                        continue;
+                    }
+                    int count = static_cast<int>(std::min<int64_t>(std::min(mAdaptive.batchSamples, mAdaptive.maxSamples - estimate.Count()), budget - spent));
+                    SamplePixel(tile.x + x, j, scene, camera, shade, estimate.Count(), count, estimate);
+                    spent += count;
+                    active = true;
+                }
+            }
+        }
+    }
+
+    stat.samples = spent;
+    stat.errorSum = 0.0;
+    stat.errorMax = 0.0f;
+    stat.converged = 0;
+    for (int p = 0; p < pixelCount; ++p) {
+        const PixelEstimate &estimate = estimates[p];
+        float error = estimate.RelativeError();
+        stat.errorSum += error;
+        stat.errorMax = std::max(stat.errorMax, error);
+        stat.converged += (error <= mAdaptive.targetError) ? 1 : 0;
+        // average radiance in xyz, sample count in w
+        XMStoreFloat4(buffer + p, XMVectorSetW(estimate.Mean(), float(estimate.Count())));
+    }
+}
+
+INLINE int64_t TileRenderer::TotalSamples(void) const {
+    int64_t samples = 0;
+    for (auto &stat : mTileStats) {
+        samples += stat.samples;
+    }
+    return samples;
+}
+
+INLINE void TileRenderer::PrintTimings(std::ostream &os) const {
+    if (mTileStats.empty()) {
+        return;
+    }
+
+    double minMs = mTileStats[0].ms, maxMs = 0.0, sumMs = 0.0;
+    int stolen = 0, converged = 0;
+    int64_t samples = 0;
+    double errorSum = 0.0;
+    float errorMax = 0.0f;
+    std::vector<double> busy(mThreadCount, 0.0);
+    std::vector<int> count(mThreadCount, 0);
+    for (auto &stat : mTileStats) {
+        minMs = std::min(minMs, stat.ms);
+        maxMs = std::max(maxMs, stat.ms);
+        sumMs += stat.ms;
+        stolen += stat.stolen ? 1 : 0;
+        samples += stat.samples;
+        errorSum += stat.errorSum;
+        errorMax = std::max(errorMax, stat.errorMax);
+        converged += stat.converged;
+        busy[stat.worker] += stat.ms;
+        count[stat.worker] += 1;
+    }
+    double avgMs = sumMs / mTileStats.size();
+    double maxBusy = *std::max_element(busy.begin(), busy.end());
+    double avgBusy = sumMs / mThreadCount;
+
+    double pixels = double(mWidth) * mHeight;
+
+    os << "Rendered " << mWidth << "x" << mHeight << " @ " << mSamples << " spp" << (mAdaptive.enabled ? " (adaptive)" : "")
+       << ", " << SamplerSettings::Name(mSampler.type) << " sampler in " << mRenderSeconds << " s with " << mThreadCount << " threads, " << mTileStats.size() << " tiles (" << stolen << " stolen)\n";
+    os << "Samples: " << samples << " (" << samples / pixels << " per pixel), Samples/sec: " << samples / mRenderSeconds << "\n";
+    os << "Rays/sec: primary " << mRays.primary / mRenderSeconds << ", secondary " << mRays.secondary / mRenderSeconds << ", shadow " << mRays.shadow / mRenderSeconds << "\n";
+    os << "Relative error: mean " << errorSum / pixels << ", max " << errorMax;
+    if (mAdaptive.enabled) {
+        os << ", " << 100.0 * converged / pixels << "% of pixels at target " << mAdaptive.targetError;
+    }
+    os << "\n";
+    os << "Tile ms: min " << minMs << ", avg " << avgMs << ", max " << maxMs << " (max/avg " << maxMs / avgMs << ")\n";
+    os << "Worker busy imbalance (max/avg): " << (avgBusy > 0.0 ? maxBusy / avgBusy : 1.0) << "\n";
+    for (int w = 0; w < mThreadCount; ++w) {
+        os << "  worker " << w << ": " << count[w] << " tiles, " << busy[w] << " ms\n";
+    }
+}
+
+INLINE void TileRenderer::WriteTileTimings(const std::string &file) const {
+    std::ofstream ofs(file);
+    ofs << "index,x,y,worker,stolen,ms,samples,mean_error,max_error\n";
+    for (auto &stat : mTileStats) {
+        int pixels = std::min(mTileSize, mWidth - stat.x) * std::min(mTileSize, mHeight - stat.y);
+        ofs << stat.index << "," << stat.x << "," << stat.y << "," << stat.worker << "," << (stat.stolen ? 1 : 0) << "," << stat.ms << ","
+            << stat.samples << "," << stat.errorSum / pixels << "," << stat.errorMax << "\n";
+    }
+}
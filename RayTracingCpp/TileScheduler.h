@@ -0,0 +1,109 @@
+#pragma once
+
+struct Tile {
+    int index;
+    int owner;          // worker whose queue the tile was first assigned to
+    int x, y;           // top-left pixel, rows counted from the top of the image
+    int width, height;
+};
+
+// Splits an image into square tiles and hands them out to workers. Every worker
+// starts with a contiguous run of tiles in its own queue (good locality) and steals
+// from the back of the other queues once it runs dry, so expensive regions such as
+// the glass spheres do not leave the rest of the pool idle at the end of a frame.
+class TileScheduler {
+public:
+    TileScheduler(int imageWidth, int imageHeight, int tileSize, int workerCount);
+    ~TileScheduler(void) {
+
+    }
+
+    INLINE int TileCount(void) const { return mTileCount; }
+    INLINE int WorkerCount(void) const { return static_cast<int>(mQueues.size()); }
+
+    // Thread safe. Returns false when every queue is empty.
+    bool Next(int worker, Tile &tile);
+
+private:
+    // Tiles are coarse work items (thousands of rays each), so a mutex per queue is
+    // never contended enough to justify a lock-free deque.
+    // Aligned so two workers never bounce the same cache line between cores.
+    struct alignas(64) Queue {
+        std::mutex          lock;
+        std::deque<Tile>    tiles;
+    };
+
+    bool PopFront(Queue &queue, Tile &tile);
+    bool PopBack(Queue &queue, Tile &tile);
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    int                                 mTileCount;
+};
+
+INLINE TileScheduler::TileScheduler(int imageWidth, int imageHeight, int tileSize, int workerCount)
+: mTileCount(0)
+{
+    workerCount = std::max(workerCount, 1);
+    tileSize = std::max(tileSize, 1);
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < imageHeight; y += tileSize) {
+        for (int x = 0; x < imageWidth; x += tileSize) {
+            Tile tile;
+            tile.index = static_cast<int>(tiles.size());
+            tile.owner = 0;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min(tileSize, imageWidth - x);
+            tile.height = std::min(tileSize, imageHeight - y);
+            tiles.push_back(tile);
+        }
+    }
+    mTileCount = static_cast<int>(tiles.size());
+
+    mQueues.resize(workerCount);
+    for (int w = 0; w < workerCount; ++w) {
+        mQueues[w] = std::make_unique<Queue>();
+        int begin = static_cast<int>(int64_t(mTileCount) * w / workerCount);
+        int end = static_cast<int>(int64_t(mTileCount) * (w + 1) / workerCount);
+        for (int i = begin; i < end; ++i) {
+            tiles[i].owner = w;
+            mQueues[w]->tiles.push_back(tiles[i]);
+        }
+    }
+}
+
+INLINE bool TileScheduler::PopFront(Queue &queue, Tile &tile) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tiles.empty()) {
+        return false;
+    }
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+INLINE bool TileScheduler::PopBack(Queue &queue, Tile &tile) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tiles.empty()) {
+        return false;
+    }
+    tile = queue.tiles.back();
+    queue.tiles.pop_back();
+    return true;
+}
+
+INLINE bool TileScheduler::Next(int worker, Tile &tile) {
+    if (PopFront(*mQueues[worker], tile)) {
+        return true;
+    }
+
+    // steal from the far end of the victim's run, it is the work the victim would reach last
+    int count = WorkerCount();
+    for (int i = 1; i < count; ++i) {
+        if (PopBack(*mQueues[(worker + i) % count], tile)) {
+            return true;
+        }
+    }
+    return false;
+}
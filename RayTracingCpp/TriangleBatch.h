@@ -0,0 +1,250 @@
+#pragma once
+
+#include "Hitable.h"
+#include "SIMD.h"
+
+// Shading data of a mesh, shared by all of its batches and only touched for the
+// winning triangle of a hit.
+struct TriangleAttributes {
+    std::vector<XMFLOAT3>   normals;    // per vertex
+    std::vector<uint32_t>   indices;    // three per triangle
+    std::vector<uint32_t>   materials;  // per triangle, index into the MaterialTable
+    // Per triangle, nonzero: a hit on it only counts once anyHit accepts it, like the
+    // any hit shader of a DXR geometry that is not opaque. Empty: everything is opaque.
+    std::vector<uint8_t>    alphaTested;
+    bool                  (*anyHit)(const void *context, uint32_t triangle, float u, float v) = nullptr;
+    const void             *anyHitContext = nullptr;
+    // Hit skips triangles seen from behind, RAY_FLAG_CULL_BACK_FACING_TRIANGLES with the
+    // DXR default winding (clockwise from the ray origin is the front). Occluded never culls.
+    bool                    cullBackFaces = false;
+};
+
+// Up to SIMD_WIDTH triangles with their vertices stored as structure of arrays and
+// intersected all at once with the watertight test of Woop, Benthin and Wald ("Watertight
+// Ray/Triangle Intersection", JCGT 2013). The ray is sheared so it runs along +z, and
+// the edge functions are evaluated in 2D. A ray through a shared edge or vertex hits
+// at least one of the triangles, so closed meshes do not leak light through cracks.
+class TriangleBatch : public Hitable {
+public:
+    TriangleBatch(const TriangleAttributes *attributes, const XMFLOAT3 *positions, const uint32_t *triangles, int count);
+    ~TriangleBatch(void) {
+
+    }
+
+    INLINE int Count(void) const { return mCount; }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+    // Splits triangles at the centroid median of the longest axis until every group fits
+    // in one batch. positions are indexed by attributes->indices.
+    static void Partition(const TriangleAttributes *attributes, const XMFLOAT3 *positions, uint32_t *triangles, int count, std::vector<Hitable *> &batches);
+
+private:
+    // lane mask of the triangles hit between tMin and tMax, with their t and scaled barycentrics
+    int Intersect(const Ray &ray, float tMin, float tMax, bool cull, SIMDFloat &t, SIMDFloat &u, SIMDFloat &v, SIMDFloat &det) const;
+
+    float                       mVertices[3][3][SIMD_WIDTH];    // [vertex][axis][lane]
+    uint32_t                    mTriangles[SIMD_WIDTH];
+    int                         mCount;
+    int                         mAlphaTested;   // lane mask
+    AABB                        mBounds;
+    const TriangleAttributes   *mAttributes;
+};
+
+INLINE TriangleBatch::TriangleBatch(const TriangleAttributes *attributes, const XMFLOAT3 *positions, const uint32_t *triangles, int count)
+: mCount(std::min(count, SIMD_WIDTH))
+, mAlphaTested(0)
+, mAttributes(attributes)
+{
+    for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+        mTriangles[lane] = lane < mCount ? triangles[lane] : 0;
+        if (lane < mCount && !attributes->alphaTested.empty() && attributes->alphaTested[triangles[lane]]) {
+            mAlphaTested |= 1 << lane;
+        }
+        for (int v = 0; v < 3; ++v) {
+            // NaN padding fails the t range test of the kernel
+            XMFLOAT3 p = lane < mCount ? positions[attributes->indices[triangles[lane] * 3 + v]] : XMFLOAT3(NAN, NAN, NAN);
+            mVertices[v][0][lane] = p.x;
+            mVertices[v][1][lane] = p.y;
+            mVertices[v][2][lane] = p.z;
+            if (lane < mCount) {
+                mBounds.Merge(XMLoadFloat3(&p));
+            }
+        }
+    }
+}
+
+INLINE bool TriangleBatch::BoundingBox(AABB &box) {
+    box = mBounds;
+    return mCount > 0;
+}
+
+INLINE int TriangleBatch::Intersect(const Ray &ray, float tMin, float tMax, bool cull, SIMDFloat &t, SIMDFloat &u, SIMDFloat &v, SIMDFloat &det) const {
+    XMFLOAT3 org, dir;
+    XMStoreFloat3(&org, ray.Origin());
+    XMStoreFloat3(&dir, ray.Direction());
+    const float *o = &org.x;
+    const float *d = &dir.x;
+
+    // shear to the dominant axis, swapping x and y keeps the winding when it points down
+    int kz = std::fabs(d[0]) > std::fabs(d[1]) ? (std::fabs(d[0]) > std::fabs(d[2]) ? 0 : 2) : (std::fabs(d[1]) > std::fabs(d[2]) ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (d[kz] < 0.0f) {
+        std::swap(kx, ky);
+    }
+    SIMDFloat sx = SIMDSet1(d[kx] / d[kz]);
+    SIMDFloat sy = SIMDSet1(d[ky] / d[kz]);
+    SIMDFloat sz = SIMDSet1(1.0f / d[kz]);
+    SIMDFloat ox = SIMDSet1(o[kx]);
+    SIMDFloat oy = SIMDSet1(o[ky]);
+    SIMDFloat oz = SIMDSet1(o[kz]);
+
+    SIMDFloat px[3], py[3], pz[3];
+    for (int v = 0; v < 3; ++v) {
+        SIMDFloat z = SIMDSub(SIMDLoad(mVertices[v][kz]), oz);
+        px[v] = SIMDSub(SIMDSub(SIMDLoad(mVertices[v][kx]), ox), SIMDMul(sx, z));
+        py[v] = SIMDSub(SIMDSub(SIMDLoad(mVertices[v][ky]), oy), SIMDMul(sy, z));
+        pz[v] = SIMDMul(sz, z);
+    }
+
+    // scaled barycentrics, U weights vertex 0
+    u = SIMDSub(SIMDMul(px[2], py[1]), SIMDMul(py[2], px[1]));
+    v = SIMDSub(SIMDMul(px[0], py[2]), SIMDMul(py[0], px[2]));
+    SIMDFloat w = SIMDSub(SIMDMul(px[1], py[0]), SIMDMul(py[1], px[0]));
+
+    // inside when the edge functions do not disagree in sign, zeros count for both sides
+    SIMDFloat zero = SIMDSet1(0.0f);
+    SIMDFloat negative = SIMDOr(SIMDOr(SIMDLess(u, zero), SIMDLess(v, zero)), SIMDLess(w, zero));
+    SIMDFloat positive = SIMDOr(SIMDOr(SIMDGreater(u, zero), SIMDGreater(v, zero)), SIMDGreater(w, zero));
+    det = SIMDAdd(SIMDAdd(u, v), w);
+    SIMDFloat dist = SIMDAdd(SIMDAdd(SIMDMul(u, pz[0]), SIMDMul(v, pz[1])), SIMDMul(w, pz[2]));
+    // a zero determinant gives an infinite or NaN t, which fails both range tests
+    t = SIMDDiv(dist, det);
+    SIMDFloat hit = SIMDAndNot(SIMDAnd(negative, positive), SIMDAnd(SIMDGreater(t, SIMDSet1(tMin)), SIMDLess(t, SIMDSet1(tMax))));
+    // the determinant is positive for triangles the ray sees from the front
+    if (cull) {
+        hit = SIMDAnd(hit, SIMDGreater(det, zero));
+    }
+    return SIMDMask(hit);
+}
+
+INLINE bool TriangleBatch::Occluded(const Ray &ray, float tMin, float tMax) {
+    SIMDFloat t, u, v, det;
+    int mask = Intersect(ray, tMin, tMax, false, t, u, v, det);
+    if ((mask & ~mAlphaTested) != 0 || mask == 0) {
+        return mask != 0;
+    }
+
+    float laneU[SIMD_WIDTH], laneV[SIMD_WIDTH], laneDet[SIMD_WIDTH];
+    SIMDStore(laneU, u);
+    SIMDStore(laneV, v);
+    SIMDStore(laneDet, det);
+    for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+        if (mask & (1 << lane)) {
+            float b1 = laneV[lane] / laneDet[lane];
+            float b2 = 1.0f - laneU[lane] / laneDet[lane] - b1;
+            if (mAttributes->anyHit(mAttributes->anyHitContext, mTriangles[lane], b1, b2)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+INLINE bool TriangleBatch::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    SIMDFloat t, u, v, det;
+    int mask = Intersect(ray, tMin, tMax, mAttributes->cullBackFaces, t, u, v, det);
+    if (mask == 0) {
+        return false;
+    }
+
+    float laneT[SIMD_WIDTH], laneU[SIMD_WIDTH], laneV[SIMD_WIDTH], laneDet[SIMD_WIDTH];
+    SIMDStore(laneT, t);
+    SIMDStore(laneU, u);
+    SIMDStore(laneV, v);
+    SIMDStore(laneDet, det);
+    int winner;
+    float closetHit, b0, b1, b2;
+    // nearest first, alpha tested triangles the any hit rejects drop out and the next one is tried
+    for (;;) {
+        winner = -1;
+        closetHit = tMax;
+        for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+            if ((mask & (1 << lane)) && laneT[lane] < closetHit) {
+                closetHit = laneT[lane];
+                winner = lane;
+            }
+        }
+        if (winner < 0) {
+            return false;
+        }
+        b0 = laneU[winner] / laneDet[winner];
+        b1 = laneV[winner] / laneDet[winner];
+        b2 = 1.0f - b0 - b1;
+        if (!(mAlphaTested & (1 << winner)) || mAttributes->anyHit(mAttributes->anyHitContext, mTriangles[winner], b1, b2)) {
+            break;
+        }
+        mask &= ~(1 << winner);
+    }
+
+    const uint32_t *index = &mAttributes->indices[mTriangles[winner] * 3];
+    XMVECTOR normal = XMLoadFloat3(&mAttributes->normals[index[0]]) * b0
+                    + XMLoadFloat3(&mAttributes->normals[index[1]]) * b1
+                    + XMLoadFloat3(&mAttributes->normals[index[2]]) * b2;
+
+    // meshes are two sided, both normals are turned towards the incoming ray
+    XMVECTOR p0 = { mVertices[0][0][winner], mVertices[0][1][winner], mVertices[0][2][winner], 0.0f };
+    XMVECTOR p1 = { mVertices[1][0][winner], mVertices[1][1][winner], mVertices[1][2][winner], 0.0f };
+    XMVECTOR p2 = { mVertices[2][0][winner], mVertices[2][1][winner], mVertices[2][2][winner], 0.0f };
+    XMVECTOR geometric = XMVector3Cross(p1 - p0, p2 - p0);
+    if (XMVectorGetX(XMVector3Dot(geometric, ray.Direction())) > 0.0f) {
+        geometric = -geometric;
+    }
+    if (XMVectorGetX(XMVector3Dot(geometric, normal)) < 0.0f) {
+        normal = -normal;
+    }
+
+    record.t = closetHit;
+    record.p = ray.PointAt(closetHit);
+    record.n = XMVector3Normalize(normal);
+    record.matIndex = mAttributes->materials[mTriangles[winner]];
+    record.primIndex = mTriangles[winner];
+    record.u = b1;
+    record.v = b2;
+    return true;
+}
+
+inline void TriangleBatch::Partition(const TriangleAttributes *attributes, const XMFLOAT3 *positions, uint32_t *triangles, int count, std::vector<Hitable *> &batches) {
+    if (count <= 0) {
+        return;
+    }
+    if (count <= SIMD_WIDTH) {
+        batches.push_back(new TriangleBatch(attributes, positions, triangles, count));
+        return;
+    }
+
+    const uint32_t *indices = attributes->indices.data();
+    auto Centroid = [positions, indices](uint32_t tri) {
+        return (XMLoadFloat3(&positions[indices[tri * 3 + 0]]) + XMLoadFloat3(&positions[indices[tri * 3 + 1]]) + XMLoadFloat3(&positions[indices[tri * 3 + 2]])) * (1.0f / 3.0f);
+    };
+
+    AABB centroids;
+    for (int i = 0; i < count; ++i) {
+        centroids.Merge(Centroid(triangles[i]));
+    }
+    XMVECTOR extent = centroids.Max() - centroids.Min();
+    int axis = 0;
+    if (XMVectorGetY(extent) > XMVectorGetByIndex(extent, axis)) { axis = 1; }
+    if (XMVectorGetZ(extent) > XMVectorGetByIndex(extent, axis)) { axis = 2; }
+
+    // split on a multiple of the batch size so only the last batch can be partially filled
+    int mid = (count / SIMD_WIDTH + 1) / 2 * SIMD_WIDTH;
+    std::nth_element(triangles, triangles + mid, triangles + count, [&Centroid, axis](uint32_t a, uint32_t b) {
+        return XMVectorGetByIndex(Centroid(a), axis) < XMVectorGetByIndex(Centroid(b), axis);
+    });
+    Partition(attributes, positions, triangles, mid, batches);
+    Partition(attributes, positions, triangles + mid, count - mid, batches);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Hitable.h"
+#include "BVHNode.h"
+#include "TriangleBatch.h"
+#include "MaterialTable.h"
+#include "Framework/Utils/Model.h"
+
+// Triangle geometry of a Utils::Scene, the same data the DXR path tracer uploads. Only
+// positions (packed into TriangleBatch SoA lanes), normals and indices are taken from
+// the 56 byte vertices; the batches are bound by a BVHNode of their own.
+class TriangleMesh : public Hitable {
+public:
+    TriangleMesh(const Utils::Scene &scene, uint32_t materialBase, int maxLeafSize = 2, const BVHBuildSettings &build = BVHBuildSettings::Create());
+    ~TriangleMesh(void) {
+        for (auto batch : mBatches) {
+            delete batch;
+        }
+    }
+
+    INLINE int TriangleCount(void) const { return static_cast<int>(mAttributes.materials.size()); }
+    INLINE int BatchCount(void) const { return static_cast<int>(mBatches.size()); }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual void HitPacket(RayPacket &packet);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+    // Adds one material per Utils::Scene material and returns the index of the first,
+    // the mapping of PtExample::BuildGeometry: Lambertian base colour plus emission.
+    // Textures are not sampled on the CPU.
+    static uint32_t AddMaterials(const Utils::Scene &scene, MaterialTable &materials);
+
+private:
+    TriangleAttributes          mAttributes;
+    std::vector<Hitable *>      mBatches;
+    std::unique_ptr<BVHNode>    mBVH;
+};
+
+INLINE TriangleMesh::TriangleMesh(const Utils::Scene &scene, uint32_t materialBase, int maxLeafSize, const BVHBuildSettings &build) {
+    size_t vertexCount = scene.mVertices.size();
+    std::vector<XMFLOAT3> positions(vertexCount);
+    mAttributes.normals.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        positions[i] = scene.mVertices[i].position;
+        mAttributes.normals[i] = scene.mVertices[i].normal;
+    }
+
+    mAttributes.indices = scene.mIndices;
+    mAttributes.materials.resize(scene.mIndices.size() / 3);
+    for (auto &shape : scene.mShapes) {
+        uint32_t first = shape.indexOffset / 3;
+        std::fill(mAttributes.materials.begin() + first, mAttributes.materials.begin() + first + shape.indexCount / 3, materialBase + shape.materialIndex);
+    }
+
+    std::vector<uint32_t> triangles(mAttributes.materials.size());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(triangles.size()); ++i) {
+        triangles[i] = i;
+    }
+    TriangleBatch::Partition(&mAttributes, positions.data(), triangles.data(), static_cast<int>(triangles.size()), mBatches);
+    mBVH.reset(new BVHNode(mBatches.data(), static_cast<int>(mBatches.size()), maxLeafSize, build));
+}
+
+INLINE bool TriangleMesh::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    return mBVH->Hit(ray, tMin, tMax, record);
+}
+
+INLINE bool TriangleMesh::BoundingBox(AABB &box) {
+    return mBVH->BoundingBox(box);
+}
+
+INLINE void TriangleMesh::HitPacket(RayPacket &packet) {
+    mBVH->HitPacket(packet);
+}
+
+INLINE bool TriangleMesh::Occluded(const Ray &ray, float tMin, float tMax) {
+    return mBVH->Occluded(ray, tMin, tMax);
+}
+
+INLINE uint32_t TriangleMesh::AddMaterials(const Utils::Scene &scene, MaterialTable &materials) {
+    uint32_t base = materials.Count();
+    for (auto &source : scene.mMaterials) {
+        Material mat = Lambertian::Create(XMLoadFloat4(&source.baseFactor));
+        mat.emission = source.emissiveFactor;
+        materials.Add(mat);
+    }
+    return base;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "Scene.h"
+#include "Random.h"
+#include "RayPacket.h"
+#include "Integrators.h"
+#include "RayStats.h"
+
+// Wavefront path tracing: instead of following one path from the camera to its end,
+// every bounce of a whole batch of paths runs as a sequence of stages.
+//
+//   intersect   all active rays, 16 at a time as RayPacket
+//   bin         counting sort of the hits by material type, escaped paths add the sky
+//   shade       one loop per material type, each calling only its own Scatter
+//   compact     survivors of scattering and roulette form the next active queue
+//
+// Each loop runs one small kernel over many paths, so the instruction cache holds one
+// material's code at a time and the BVH stays warm across the intersect stage. The
+// Lambertian kernel traces its shadow rays to the scene lights as it shades and reads
+// the radiance cache, which is fed once the whole batch has ended. Path state lives in
+// per field arrays sized once for MaxPaths and reused for every batch. Every path
+// consumes its RandomStream exactly as TracePath does, so without a radiance cache the
+// result is bit identical to the depth first integrator.
+class WavefrontTracer {
+public:
+    static constexpr uint32_t MaxPaths = 8192;
+
+    WavefrontTracer(void);
+    ~WavefrontTracer(void) {
+
+    }
+
+    INLINE uint32_t Count(void) const { return mCount; }
+    INLINE bool Full(void) const { return mCount == MaxPaths; }
+
+    INLINE void Clear(void) {
+        mCount = 0;
+        mActive.clear();
+    }
+
+    // generate stage: queues a camera ray, the tag tells the caller where it belongs
+    INLINE uint32_t AddPath(const Ray &ray, const RandomStream &rng, uint32_t tag) {
+        uint32_t path = mCount++;
+        mTags[path] = tag;
+        mRays[path] = ray;
+        mStreams[path] = rng;
+        mThroughput[path] = XMVectorSet(1.0f, 1.0f, 1.0f, 0.0f);
+        mRadiance[path] = XMVectorZero();
+        mScatterPdf[path] = 0.0f;
+        mScatterNormal[path] = XMVectorZero();
+        mCacheCount[path] = 0;
+        mDiffuseBounces[path] = 0;
+        mActive.push_back(path);
+        return path;
+    }
+
+    // runs the stages until every queued path has ended
+    void Trace(const Scene &scene);
+
+    INLINE XMVECTOR Radiance(uint32_t path) const { return mRadiance[path]; }
+    INLINE uint32_t Tag(uint32_t path) const { return mTags[path]; }
+
+private:
+    void Intersect(Hitable *world, float tMin);
+    template <typename Kernel>
+    void ShadeBin(const Scene &scene, const uint32_t *paths, uint32_t count, int depth);
+
+    uint32_t                        mCount;
+    std::vector<uint32_t>           mTags;
+    std::vector<Ray>                mRays;
+    std::vector<RandomStream>       mStreams;
+    std::vector<XMVECTOR>           mThroughput;
+    std::vector<XMVECTOR>           mRadiance;
+    std::vector<float>              mScatterPdf;    // as in ContinuePath
+    std::vector<XMVECTOR>           mScatterNormal;
+    std::vector<RadianceCache::Vertex>  mCacheVertices;     // MaxVertices a path, sized with the first cache
+    std::vector<uint8_t>            mCacheCount;
+    std::vector<uint8_t>            mDiffuseBounces;
+    std::vector<Hitable::Record>    mRecords;
+    std::vector<uint8_t>            mHit;
+    std::vector<uint32_t>           mActive;    // path indices, in queue order
+    std::vector<uint32_t>           mNext;
+    std::vector<uint32_t>           mBinned;    // hits of the active queue, grouped by material type
+};
+
+INLINE WavefrontTracer::WavefrontTracer(void)
+: mCount(0)
+, mTags(MaxPaths)
+, mRays(MaxPaths)
+, mStreams(MaxPaths)
+, mThroughput(MaxPaths)
+, mRadiance(MaxPaths)
+, mScatterPdf(MaxPaths)
+, mScatterNormal(MaxPaths)
+, mCacheCount(MaxPaths)
+, mDiffuseBounces(MaxPaths)
+, mRecords(MaxPaths)
+, mHit(MaxPaths)
+, mBinned(MaxPaths)
+{
+    mActive.reserve(MaxPaths);
+    mNext.reserve(MaxPaths);
+}
+
+INLINE void WavefrontTracer::Intersect(Hitable *world, float tMin) {
+    RayPacket packet;
+    uint32_t active = static_cast<uint32_t>(mActive.size());
+    for (uint32_t begin = 0; begin < active; begin += RayPacket::MaxSize) {
+        uint32_t end = std::min(begin + RayPacket::MaxSize, active);
+        packet.Clear(tMin);
+        for (uint32_t i = begin; i < end; ++i) {
+            packet.Add(mRays[mActive[i]], 1e+38f);
+        }
+        world->HitPacket(packet);
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t path = mActive[i];
+            mHit[path] = packet.hit[i - begin] ? 1 : 0;
+            if (packet.hit[i - begin]) {
+                mRecords[path] = packet.records[i - begin];
+            }
+        }
+    }
+}
+
+template <typename Kernel>
+INLINE void WavefrontTracer::ShadeBin(const Scene &scene, const uint32_t *paths, uint32_t count, int depth) {
+    bool sampleLights = (scene.lights || scene.environment) && std::is_same<Kernel, Lambertian>::value;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t path = paths[i];
+        const Hitable::Record &record = mRecords[path];
+        const Material &mat = scene.materials->Get(record.matIndex);
+        XMVECTOR throughput = mThroughput[path];
+        mRadiance[path] += throughput * Emitted(scene, mRays[path], record, mScatterPdf[path], mScatterNormal[path]);
+
+        RandomStream &rng = mStreams[path];
+        rng.SetBounce(depth + 1);
+        if (depth == maxDepth) {
+            continue;
+        }
+        if (scene.cache && std::is_same<Kernel, Lambertian>::value) {
+            int cachedCount = mCacheCount[path];
+            bool ended = EndOnCache(scene, record, mDiffuseBounces[path], throughput, mRadiance[path], &mCacheVertices[size_t(path) * RadianceCache::MaxVertices], cachedCount);
+            mCacheCount[path] = static_cast<uint8_t>(cachedCount);
+            if (ended) {
+                continue;
+            }
+            ++mDiffuseBounces[path];
+        }
+        if (sampleLights) {
+            mRadiance[path] += throughput * SampleLights(scene, record, mat, rng);
+        }
+        XMVECTOR attenuation;
+        Ray scatter;
+        if (!Kernel::Scatter(mat, mRays[path], record, rng, attenuation, scatter)) {
+            continue;
+        }
+        mScatterPdf[path] = sampleLights ? Lambertian::Pdf(record, scatter.Direction()) : 0.0f;
+        mScatterNormal[path] = record.n;
+        throughput *= attenuation;
+        if (!Roulette(depth, throughput, rng)) {
+            continue;
+        }
+        mThroughput[path] = throughput;
+        mRays[path] = scatter;
+        mNext.push_back(path);
+    }
+}
+
+INLINE void WavefrontTracer::Trace(const Scene &scene) {
+    RayStats &stats = RayStats::Thread();
+    const MaterialTable &materials = *scene.materials;
+    if (scene.cache && mCacheVertices.empty()) {
+        mCacheVertices.resize(size_t(MaxPaths) * RadianceCache::MaxVertices);
+    }
+    for (int depth = 0; !mActive.empty(); ++depth) {
+        Intersect(scene.world, 0.001f);
+        (depth == 0 ? stats.primary : stats.secondary) += mActive.size();
+
+        uint32_t counts[MaterialTypeCount] = {};
+        for (uint32_t path : mActive) {
+            if (!mHit[path]) {
+                mRadiance[path] += mThroughput[path] * Escaped(scene, mRays[path], mScatterPdf[path]);
+                continue;
+            }
+            const Material &mat = materials.Get(mRecords[path].matIndex);
+            if (mat.type < MaterialTypeCount) {
+                ++counts[mat.type];
+            } else {
+                // no kernel scatters it, the path ends on its emission
+                mRadiance[path] += mThroughput[path] * Emitted(scene, mRays[path], mRecords[path], mScatterPdf[path], mScatterNormal[path]);
+            }
+        }
+        uint32_t offsets[MaterialTypeCount];
+        uint32_t sum = 0;
+        for (uint32_t t = 0; t < MaterialTypeCount; ++t) {
+            offsets[t] = sum;
+            sum += counts[t];
+        }
+        // stable, so each bin keeps the queue order
+        for (uint32_t path : mActive) {
+            if (mHit[path]) {
+                uint32_t type = materials.Get(mRecords[path].matIndex).type;
+                if (type < MaterialTypeCount) {
+                    mBinned[offsets[type]++] = path;
+                }
+            }
+        }
+
+        mNext.clear();
+        const uint32_t *bin = mBinned.data();
+        ShadeBin<Lambertian>(scene, bin, counts[LambertianMat], depth);
+        bin += counts[LambertianMat];
+        ShadeBin<Metal>(scene, bin, counts[MetalMat], depth);
+        bin += counts[MetalMat];
+        ShadeBin<Dielectric>(scene, bin, counts[DielectricMat], depth);
+        std::swap(mActive, mNext);
+    }
+    if (scene.cache) {
+        for (uint32_t path = 0; path < mCount; ++path) {
+            scene.cache->Add(&mCacheVertices[size_t(path) * RadianceCache::MaxVertices], mCacheCount[path], mRadiance[path]);
+        }
+    }
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "BVHNode.h"
+#include "SIMD.h"
+
+// Eight wide BVH with compressed child boxes, after Ylitie et al. 2017 ("Efficient
+// Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs"). A binary BVHNode is
+// collapsed top down: a node starts with the binary subtree root as its only child and
+// keeps opening the child with the largest surface area until it has Width of them.
+// Child boxes are stored as 8 bit coordinates on a grid that spans the node and whose
+// cells are a power of two wide per axis, so decoding is exact and the boxes only
+// ever grow. A node takes 80 bytes where the binary tree spends 32 per node.
+// Traversal decodes and slab tests all children of a node SIMD_WIDTH at a time and
+// visits the ones hit nearest first.
+class WideBVH : public Hitable {
+public:
+    static constexpr int Width = 8;
+    // larger binary leaves are split in halves until they fit
+    static constexpr int MaxLeafSize = 4;
+
+    struct Node {
+        XMFLOAT3    origin;             // min corner of the grid
+        int8_t      exponent[3];        // grid cells are 2^exponent wide per axis
+        uint8_t     childMask;          // bit per occupied child slot
+        uint32_t    childBase;          // first interior child, the others follow in rank order
+        uint32_t    primBase;           // first primitive of the leaf children
+        uint8_t     meta[Width];        // InteriorMeta | rank, or count << 5 | offset from primBase for a leaf
+        uint8_t     qmin[3][Width];
+        uint8_t     qmax[3][Width];
+    };
+
+    WideBVH(const BVHNode &bvh);
+    ~WideBVH(void) {
+
+    }
+
+    INLINE const std::vector<Node> & Nodes(void) const { return mNodes; }
+    INLINE int Depth(void) const { return mDepth; }
+
+    virtual bool Hit(const Ray &ray, float tMin, float tMax, Record &record);
+    virtual bool BoundingBox(AABB &box);
+    virtual bool Occluded(const Ray &ray, float tMin, float tMax);
+
+private:
+    static constexpr uint8_t    InteriorMeta = 0x08;
+    // the binary tree stops at depth 64, halving the leaves it could not split adds at most 32
+    static constexpr int        MaxDepth = 96;
+    static constexpr int        StackSize = (Width - 1) * MaxDepth + 1;
+
+    // a child in the making: an interior binary node or a range of primitives
+    struct Item {
+        AABB        box;
+        uint32_t    first;      // binary node, or first primitive of the range
+        uint32_t    count;      // 0 for a binary node
+    };
+
+    // a ray prepared for the slab tests of a node
+    struct RayData {
+        XMFLOAT3    origin;
+        XMFLOAT3    invDir;
+        bool        negative[3];
+    };
+
+    struct Entry {
+        uint32_t    ref;        // node, or first primitive of a leaf
+        uint32_t    count;      // 0 for a node
+        float       tNear;
+    };
+
+    INLINE static bool IsOpen(const Item &item) { return item.count == 0 || item.count > MaxLeafSize; }
+
+    Item MakeItem(const BVHNode &bvh, uint32_t node) const;
+    Item MakeRange(const BVHNode &bvh, uint32_t first, uint32_t count) const;
+    void Open(const BVHNode &bvh, const Item &item, Item &a, Item &b) const;
+    void BuildNode(const BVHNode &bvh, const Item &root, uint32_t index, int depth);
+    void Quantize(Node &node, const Item *children, int count) const;
+
+    static RayData Prepare(const Ray &ray);
+    // mask of the children hit between tMin and tMax, their entry distances in tNear
+    int Intersect(const Node &node, const RayData &ray, float tMin, float tMax, float *tNear) const;
+    INLINE static Entry ChildEntry(const Node &node, int slot, float tNear);
+
+    std::vector<Node>       mNodes;
+    std::vector<Hitable *>  mPrims;     // leaf primitives, those of a node contiguous
+    AABB                    mBounds;
+    int                     mDepth;
+};
+
+static_assert(sizeof(WideBVH::Node) == 80, "compressed node is 80 bytes");
+
+INLINE WideBVH::WideBVH(const BVHNode &bvh)
+: mDepth(0)
+{
+    if (bvh.Nodes().empty()) {
+        return;
+    }
+    Item root = MakeItem(bvh, 0);
+    mBounds = root.box;
+    mPrims.reserve(bvh.Prims().size());
+    mNodes.resize(1);
+    BuildNode(bvh, root, 0, 1);
+    mNodes.shrink_to_fit();
+}
+
+INLINE WideBVH::Item WideBVH::MakeItem(const BVHNode &bvh, uint32_t node) const {
+    const BVHNode::Node &source = bvh.Nodes()[node];
+    Item item;
+    item.box = AABB(XMLoadFloat3(&source.min), XMLoadFloat3(&source.max));
+    item.first = source.count > 0 ? source.offset : node;
+    item.count = source.count;
+    return item;
+}
+
+INLINE WideBVH::Item WideBVH::MakeRange(const BVHNode &bvh, uint32_t first, uint32_t count) const {
+    Item item;
+    item.first = first;
+    item.count = count;
+    for (uint32_t i = first; i < first + count; ++i) {
+        AABB box;
+        bvh.Prims()[i]->BoundingBox(box);
+        item.box.Merge(box);
+    }
+    return item;
+}
+
+INLINE void WideBVH::Open(const BVHNode &bvh, const Item &item, Item &a, Item &b) const {
+    if (item.count == 0) {
+        a = MakeItem(bvh, item.first + 1);
+        b = MakeItem(bvh, bvh.Nodes()[item.first].offset);
+    } else {
+        uint32_t half = item.count / 2;
+        a = MakeRange(bvh, item.first, half);
+        b = MakeRange(bvh, item.first + half, item.count - half);
+    }
+}
+
+inline void WideBVH::BuildNode(const BVHNode &bvh, const Item &root, uint32_t index, int depth) {
+    mDepth = std::max(mDepth, depth);
+
+    Item children[Width];
+    int count = 1;
+    children[0] = root;
+    while (count < Width) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int c = 0; c < count; ++c) {
+            float area = children[c].box.SurfaceArea();
+            if (IsOpen(children[c]) && area > bestArea) {
+                best = c;
+                bestArea = area;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        Item item = children[best];
+        Open(bvh, item, children[best], children[count++]);
+    }
+
+    // interior children are allocated together so a rank finds them
+    int interior = 0;
+    for (int c = 0; c < count; ++c) {
+        interior += IsOpen(children[c]) ? 1 : 0;
+    }
+    uint32_t childBase = static_cast<uint32_t>(mNodes.size());
+    mNodes.resize(mNodes.size() + interior);
+
+    Node &node = mNodes[index];
+    Quantize(node, children, count);
+    node.childBase = childBase;
+    node.primBase = static_cast<uint32_t>(mPrims.size());
+    int rank = 0;
+    for (int c = 0; c < count; ++c) {
+        if (IsOpen(children[c])) {
+            node.meta[c] = static_cast<uint8_t>(InteriorMeta | rank++);
+        } else {
+            node.meta[c] = static_cast<uint8_t>((children[c].count << 5) | (mPrims.size() - node.primBase));
+            mPrims.insert(mPrims.end(), bvh.Prims().begin() + children[c].first, bvh.Prims().begin() + children[c].first + children[c].count);
+        }
+    }
+
+    rank = 0;
+    for (int c = 0; c < count; ++c) {
+        if (IsOpen(children[c])) {
+            BuildNode(bvh, children[c], childBase + rank++, depth + 1);
+        }
+    }
+}
+
+INLINE void WideBVH::Quantize(Node &node, const Item *children, int count) const {
+    AABB bounds;
+    for (int c = 0; c < count; ++c) {
+        bounds.Merge(children[c].box);
+    }
+    XMFLOAT3 origin, extent;
+    XMStoreFloat3(&origin, bounds.Min());
+    XMStoreFloat3(&extent, bounds.Max() - bounds.Min());
+    node.origin = origin;
+    node.childMask = static_cast<uint8_t>((1 << count) - 1);
+
+    const float *originAxis = &origin.x;
+    const float *extentAxis = &extent.x;
+    for (int axis = 0; axis < 3; ++axis) {
+        // the smallest power of two with 255 cells covering the extent
+        int exponent;
+        std::frexp(extentAxis[axis] / 255.0f, &exponent);
+        exponent = std::min(std::max(exponent, -126), 127);
+        node.exponent[axis] = static_cast<int8_t>(exponent);
+        float scale = std::ldexp(1.0f, exponent);
+
+        for (int c = 0; c < Width; ++c) {
+            if (c >= count) {
+                // empty slots never pass the childMask, an inverted box all the same
+                node.qmin[axis][c] = 255;
+                node.qmax[axis][c] = 0;
+                continue;
+            }
+            XMFLOAT3 cmin, cmax;
+            XMStoreFloat3(&cmin, children[c].box.Min());
+            XMStoreFloat3(&cmax, children[c].box.Max());
+            float lo = (&cmin.x)[axis], hi = (&cmax.x)[axis];
+            int qlo = std::min(std::max(int(std::floor((lo - originAxis[axis]) / scale)), 0), 255);
+            int qhi = std::min(std::max(int(std::ceil((hi - originAxis[axis]) / scale)), 0), 255);
+            // rounding of the decode may not shrink the box
+            while (qlo > 0 && originAxis[axis] + qlo * scale > lo) {
+                --qlo;
+            }
+            while (qhi < 255 && originAxis[axis] + qhi * scale < hi) {
+                ++qhi;
+            }
+            node.qmin[axis][c] = static_cast<uint8_t>(qlo);
+            node.qmax[axis][c] = static_cast<uint8_t>(qhi);
+        }
+    }
+}
+
+INLINE bool WideBVH::BoundingBox(AABB &box) {
+    if (mNodes.empty()) {
+        return false;
+    }
+    box = mBounds;
+    return true;
+}
+
+INLINE WideBVH::RayData WideBVH::Prepare(const Ray &ray) {
+    RayData data;
+    XMStoreFloat3(&data.origin, ray.Origin());
+    XMStoreFloat3(&data.invDir, XMVectorReciprocal(ray.Direction()));
+    data.negative[0] = data.invDir.x < 0.0f;
+    data.negative[1] = data.invDir.y < 0.0f;
+    data.negative[2] = data.invDir.z < 0.0f;
+    return data;
+}
+
+INLINE int WideBVH::Intersect(const Node &node, const RayData &ray, float tMin, float tMax, float *tNear) const {
+    // t of grid plane q is q * scale * invDir + (origin - rayOrigin) * invDir
+    SIMDFloat scale[3], offset[3];
+    const uint8_t *nearPlanes[3], *farPlanes[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float invDir = (&ray.invDir.x)[axis];
+        scale[axis] = SIMDSet1(std::ldexp(1.0f, node.exponent[axis]) * invDir);
+        offset[axis] = SIMDSet1(((&node.origin.x)[axis] - (&ray.origin.x)[axis]) * invDir);
+        nearPlanes[axis] = ray.negative[axis] ? node.qmax[axis] : node.qmin[axis];
+        farPlanes[axis] = ray.negative[axis] ? node.qmin[axis] : node.qmax[axis];
+    }
+
+    int mask = 0;
+    for (int c = 0; c < Width; c += SIMD_WIDTH) {
+        SIMDFloat t0 = SIMDSet1(tMin);
+        SIMDFloat t1 = SIMDSet1(FLT_MAX);
+        for (int axis = 0; axis < 3; ++axis) {
+            t0 = SIMDMax(t0, SIMDAdd(SIMDMul(SIMDLoadBytes(nearPlanes[axis] + c), scale[axis]), offset[axis]));
+            t1 = SIMDMin(t1, SIMDAdd(SIMDMul(SIMDLoadBytes(farPlanes[axis] + c), scale[axis]), offset[axis]));
+        }
+        // widened like AABB::Hit so a grazing ray is not lost to rounding
+        t1 = SIMDMin(SIMDMul(t1, SIMDSet1(1.0000004f)), SIMDSet1(tMax));
+        SIMDStore(tNear + c, t0);
+        mask |= (~SIMDMask(SIMDGreater(t0, t1)) & ((1 << SIMD_WIDTH) - 1)) << c;
+    }
+    return mask & node.childMask;
+}
+
+INLINE WideBVH::Entry WideBVH::ChildEntry(const Node &node, int slot, float tNear) {
+    uint8_t meta = node.meta[slot];
+    uint32_t count = meta >> 5;
+    if (count == 0) {
+        return { node.childBase + (meta & (InteriorMeta - 1)), 0, tNear };
+    }
+    return { node.primBase + (meta & 31), count, tNear };
+}
+
+INLINE bool WideBVH::Hit(const Ray &ray, float tMin, float tMax, Record &record) {
+    if (mNodes.empty()) {
+        return false;
+    }
+    RayData data = Prepare(ray);
+    Entry stack[StackSize];
+    int top = 0;
+    stack[top++] = { 0, 0, tMin };
+
+    Record temp;
+    bool isHit = false;
+    float closetHit = tMax;
+    float tNear[Width];
+    while (top > 0) {
+        Entry entry = stack[--top];
+        // a closer hit was found after this entry got pushed
+        if (entry.tNear > closetHit) {
+            continue;
+        }
+
+        if (entry.count > 0) {
+            for (uint32_t i = entry.ref; i < entry.ref + entry.count; ++i) {
+                if (mPrims[i]->Hit(ray, tMin, closetHit, temp)) {
+                    isHit = true;
+                    closetHit = temp.t;
+                    record = temp;
+                }
+            }
+            continue;
+        }
+
+        const Node &node = mNodes[entry.ref];
+        int mask = Intersect(node, data, tMin, closetHit, tNear);
+        // insertion sort on the way onto the stack, far first so the nearest pops next
+        int base = top;
+        for (int slot = 0; slot < Width; ++slot) {
+            if (!(mask & (1 << slot))) {
+                continue;
+            }
+            Entry child = ChildEntry(node, slot, tNear[slot]);
+            int i = top++;
+            for (; i > base && stack[i - 1].tNear < child.tNear; --i) {
+                stack[i] = stack[i - 1];
+            }
+            stack[i] = child;
+        }
+    }
+
+    return isHit;
+}
+
+// Any hit traversal: no record, no front to back order, done at the first primitive
+// that blocks the ray.
+INLINE bool WideBVH::Occluded(const Ray &ray, float tMin, float tMax) {
+    if (mNodes.empty()) {
+        return false;
+    }
+    RayData data = Prepare(ray);
+    Entry stack[StackSize];
+    int top = 0;
+    stack[top++] = { 0, 0, tMin };
+
+    float tNear[Width];
+    while (top > 0) {
+        Entry entry = stack[--top];
+        if (entry.count > 0) {
+            for (uint32_t i = entry.ref; i < entry.ref + entry.count; ++i) {
+                if (mPrims[i]->Occluded(ray, tMin, tMax)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        const Node &node = mNodes[entry.ref];
+        int mask = Intersect(node, data, tMin, tMax, tNear);
+        for (int slot = 0; slot < Width; ++slot) {
+            if (mask & (1 << slot)) {
+                stack[top++] = ChildEntry(node, slot, tNear[slot]);
+            }
+        }
+    }
+    return false;
+}
@@ -2,12 +2,23 @@
 #ifndef PCH_H
 #define PCH_H
 
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <random>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -20,18 +31,10 @@
 #include <windows.h>
 
 #include <DirectXMath.h>
+#include <DirectXPackedVector.h>
 
 using namespace DirectX;
 
 #define INLINE __forceinline
 
-// random value from [0.0 ~ 1.0)
-extern float RandomUnit(void);
-
-// (-1.0 ~ 1.0)
-extern XMVECTOR RandomInUnitDisk(void);
-
-// (-1.0 ~ 1.0)
-extern XMVECTOR RandomInUnitSphere(void);
-
 #endif //PCH_H